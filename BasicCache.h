@@ -0,0 +1,340 @@
+#pragma once
+
+#include "CachePolicy.h"
+#include "CacheStats.h"
+#include "FlatIndex.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+
+namespace MinCache {
+
+//--------------------------------------------------------------------
+// Lock types for BasicCache. Anything with lock(), unlock() and
+// try_lock() works; std::mutex and std::shared_mutex (always taken
+// exclusively, a hit reorders the policy) are the usual choices.
+//--------------------------------------------------------------------
+
+// for caches owned by a single thread, every lock call compiles away
+struct NullLock {
+    void lock() {}
+    void unlock() {}
+    bool try_lock() { return true; }
+};
+
+// test-and-test-and-set, for short critical sections under light
+// contention where parking a thread costs more than spinning
+class SpinLock {
+public:
+    void lock() {
+        while (_locked.exchange(true, std::memory_order_acquire)) {
+            while (_locked.load(std::memory_order_relaxed)) {
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64)
+                _mm_pause();
+#endif
+            }
+        }
+    }
+
+    void unlock() { _locked.store(false, std::memory_order_release); }
+
+    bool try_lock() {
+        return !_locked.load(std::memory_order_relaxed) &&
+               !_locked.exchange(true, std::memory_order_acquire);
+    }
+
+private:
+    std::atomic<bool> _locked{false};
+};
+
+//--------------------------------------------------------------------
+// Eviction policies for BasicCache. A policy only sees slot numbers in
+// [0, capacity): reserve(capacity) is called once, then on_insert,
+// on_access and on_erase as entries come and go, and victim() names the
+// slot to evict from a full cache.
+//--------------------------------------------------------------------
+
+// doubly linked recency list over slot numbers, sentinel at capacity
+class LruPolicy {
+public:
+    void reserve(size_t capacity) {
+        _sentinel = static_cast<uint32_t>(capacity);
+        _links.assign(capacity + 1, {_sentinel, _sentinel});
+    }
+
+    void on_insert(uint32_t slot) { link_front(slot); }
+
+    void on_access(uint32_t slot) {
+        unlink(slot);
+        link_front(slot);
+    }
+
+    void on_erase(uint32_t slot) { unlink(slot); }
+
+    uint32_t victim() const { return _links[_sentinel].prev; }
+
+protected:
+    struct Link {
+        uint32_t prev;
+        uint32_t next;
+    };
+
+    void link_front(uint32_t slot) {
+        uint32_t first = _links[_sentinel].next;
+        _links[slot] = {_sentinel, first};
+        _links[first].prev = slot;
+        _links[_sentinel].next = slot;
+    }
+
+    void unlink(uint32_t slot) {
+        _links[_links[slot].prev].next = _links[slot].next;
+        _links[_links[slot].next].prev = _links[slot].prev;
+    }
+
+    std::vector<Link> _links;
+    uint32_t _sentinel = 0;
+};
+
+// insertion order, hits change nothing
+class FifoPolicy : public LruPolicy {
+public:
+    void on_access(uint32_t) {}
+};
+
+// second chance: a hit sets the slot's bit, the hand clears bits until
+// it finds a slot without one
+class ClockPolicy {
+public:
+    void reserve(size_t capacity) {
+        _state.assign(capacity, kEmpty);
+        _hand = 0;
+    }
+
+    void on_insert(uint32_t slot) { _state[slot] = kReferenced; }
+    void on_access(uint32_t slot) { _state[slot] = kReferenced; }
+    void on_erase(uint32_t slot) { _state[slot] = kEmpty; }
+
+    uint32_t victim() {
+        while (true) {
+            uint32_t slot = _hand;
+            _hand = _hand + 1 == _state.size() ? 0 : _hand + 1;
+            if (_state[slot] == kResident) {
+                return slot;
+            }
+            if (_state[slot] == kReferenced) {
+                _state[slot] = kResident;
+            }
+        }
+    }
+
+private:
+    static constexpr uint8_t kEmpty = 0;
+    static constexpr uint8_t kResident = 1;
+    static constexpr uint8_t kReferenced = 2;
+
+    std::vector<uint8_t> _state;
+    uint32_t _hand = 0;
+};
+
+//--------------------------------------------------------------------
+// BasicCache: compile-time composed cache. The eviction policy, the
+// lock, the hasher, the key index and the node allocator are template
+// parameters and every call is resolved statically, so a
+// BasicCache<K, V, LruPolicy, NullLock> is a fully inlined single-thread
+// cache for per-worker use. Entries live in a slab of capacity nodes;
+// the index maps a key to its slot (see FlatIndex for the interface) and
+// the policy orders the slots. Wrap it in CacheAdapter where a
+// CachePolicy is needed.
+//--------------------------------------------------------------------
+
+template <typename Key, typename Value, typename Policy = LruPolicy,
+          typename Lock = std::mutex, typename Hash = std::hash<Key>,
+          typename Index = FlatIndex<Key, Hash>,
+          typename Allocator = std::allocator<std::pair<const Key, Value>>>
+class BasicCache {
+public:
+    using key_type = Key;
+    using mapped_type = Value;
+
+    explicit BasicCache(int capacity)
+        : _capacity(capacity > 0 ? static_cast<uint32_t>(capacity) : 0),
+          _index(_capacity) {
+        _nodes.reserve(_capacity);
+        _policy.reserve(_capacity);
+    }
+
+    void put(const Key &key, const Value &value) { put_internal(key, value); }
+
+    void put(Key &&key, Value &&value) {
+        put_internal(std::move(key), std::move(value));
+    }
+
+    bool get(const Key &key, Value &value) {
+        return visit(key, [&value](const Value &cached) { value = cached; });
+    }
+
+    Value get(const Key &key) {
+        Value value{};
+        get(key, value);
+        return value;
+    }
+
+    // calls func(const Value &) on a hit while the lock is held
+    template <typename Func> bool visit(const Key &key, Func &&func) {
+        auto lock = _stats.lock(_lock);
+        uint32_t slot = find_slot(key);
+        if (slot == kNullSlot) {
+            _stats.record_miss();
+            return false;
+        }
+        _stats.record_hit();
+        _policy.on_access(slot);
+        func(static_cast<const Value &>(_nodes[slot].value));
+        return true;
+    }
+
+    bool remove(const Key &key) {
+        auto lock = _stats.lock(_lock);
+        uint32_t slot = find_slot(key);
+        if (slot == kNullSlot) {
+            return false;
+        }
+        erase_slot(slot);
+        return true;
+    }
+
+    size_t size() {
+        std::lock_guard<Lock> lock(_lock);
+        return _index.size();
+    }
+
+    size_t capacity() const { return _capacity; }
+
+    CacheStatsSnapshot stats() const { return _stats.snapshot(); }
+
+private:
+    static constexpr uint32_t kNullSlot = UINT32_MAX;
+
+    struct Node {
+        Key key;
+        Value value;
+    };
+
+    using NodeAllocator =
+        typename std::allocator_traits<Allocator>::template rebind_alloc<Node>;
+    using SlotAllocator = typename std::allocator_traits<
+        Allocator>::template rebind_alloc<uint32_t>;
+
+    uint32_t find_slot(const Key &key) const {
+        uint32_t slot = _index.find(
+            key, [this](uint32_t i) -> const Key & { return _nodes[i].key; });
+        return slot == Index::kNotFound ? kNullSlot : slot;
+    }
+
+    template <typename K, typename V> void put_internal(K &&key, V &&value);
+    void erase_slot(uint32_t slot);
+
+private:
+    const uint32_t _capacity;
+    Lock _lock;
+    Index _index;
+    Policy _policy;
+    std::vector<Node, NodeAllocator> _nodes;
+    // slots of erased nodes, reused before the slab grows
+    std::vector<uint32_t, SlotAllocator> _freeSlots;
+    CacheStats _stats;
+};
+
+template <typename Key, typename Value, typename Policy, typename Lock,
+          typename Hash, typename Index, typename Allocator>
+template <typename K, typename V>
+void BasicCache<Key, Value, Policy, Lock, Hash, Index, Allocator>::put_internal(
+    K &&key, V &&value) {
+    if (_capacity == 0) {
+        return;
+    }
+
+    auto lock = _stats.lock(_lock);
+    uint32_t slot = find_slot(key);
+    if (slot != kNullSlot) {
+        _stats.record_update();
+        _nodes[slot].value = std::forward<V>(value);
+        _policy.on_access(slot);
+        return;
+    }
+
+    if (_index.size() == _capacity) {
+        _stats.record_eviction();
+        erase_slot(_policy.victim());
+    }
+    if (!_freeSlots.empty()) {
+        slot = _freeSlots.back();
+        _freeSlots.pop_back();
+        _nodes[slot].key = std::forward<K>(key);
+        _nodes[slot].value = std::forward<V>(value);
+    } else {
+        slot = static_cast<uint32_t>(_nodes.size());
+        _nodes.push_back({std::forward<K>(key), std::forward<V>(value)});
+    }
+    _index.insert(_nodes[slot].key, slot);
+    _policy.on_insert(slot);
+    _stats.record_insert();
+}
+
+template <typename Key, typename Value, typename Policy, typename Lock,
+          typename Hash, typename Index, typename Allocator>
+void BasicCache<Key, Value, Policy, Lock, Hash, Index, Allocator>::erase_slot(
+    uint32_t slot) {
+    _policy.on_erase(slot);
+    _index.erase(_nodes[slot].key, slot);
+    // drop the payload now instead of when the slot is reused
+    _nodes[slot].value = Value();
+    _freeSlots.push_back(slot);
+}
+
+//--------------------------------------------------------------------
+// CacheAdapter: CachePolicy view of a statically composed cache, for
+// code that picks the cache at runtime. Constructor arguments are
+// forwarded to the wrapped cache.
+//--------------------------------------------------------------------
+
+template <typename Cache>
+class CacheAdapter : public CachePolicy<typename Cache::key_type,
+                                        typename Cache::mapped_type> {
+public:
+    using Key = typename Cache::key_type;
+    using Value = typename Cache::mapped_type;
+
+    template <typename... Args>
+    explicit CacheAdapter(Args &&...args) : _cache(std::forward<Args>(args)...) {}
+
+    void put(const Key &key, const Value &value) override {
+        _cache.put(key, value);
+    }
+
+    void put(Key &&key, Value &&value) override {
+        _cache.put(std::move(key), std::move(value));
+    }
+
+    bool get(const Key &key, Value &value) override {
+        return _cache.get(key, value);
+    }
+
+    Value get(const Key &key) override { return _cache.get(key); }
+
+    Cache &cache() { return _cache; }
+
+private:
+    Cache _cache;
+};
+
+} // namespace MinCache
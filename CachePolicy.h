@@ -8,12 +8,14 @@ class CachePolicy {
 public:
     virtual ~CachePolicy() = default;
     // add cache api:
-    virtual void put(Key key, Value value) = 0;
+    virtual void put(const Key &key, const Value &value) = 0;
+    // move-aware put, policies override it to avoid copying the entry
+    virtual void put(Key &&key, Value &&value) { put(key, value); }
     //
-    virtual bool get(Key key, Value &value) = 0;
+    virtual bool get(const Key &key, Value &value) = 0;
 
     // if find the key in the cache, return value
-    virtual Value get(Key key) = 0;
+    virtual Value get(const Key &key) = 0;
 };
 
 } // namespace MinCache
@@ -0,0 +1,183 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <shared_mutex>
+#include <sstream>
+#include <string>
+
+// Define MINCACHE_ENABLE_STATS=1 (cmake -DMINCACHE_ENABLE_STATS=ON) to
+// count cache events. Without it every counter call is an empty inline
+// function and locks are taken exactly as before.
+#ifndef MINCACHE_ENABLE_STATS
+#define MINCACHE_ENABLE_STATS 0
+#endif
+
+namespace MinCache {
+
+inline constexpr bool kStatsEnabled = MINCACHE_ENABLE_STATS != 0;
+
+// point-in-time totals, summed over slices by the sharded caches
+struct CacheStatsSnapshot {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t inserts = 0;
+    uint64_t updates = 0;
+    uint64_t evictions = 0;
+    uint64_t expirations = 0;
+    uint64_t lockAcquisitions = 0;
+    uint64_t lockContentions = 0;
+    uint64_t lockWaitNanos = 0;
+
+    double hit_ratio() const {
+        uint64_t lookups = hits + misses;
+        return lookups ? static_cast<double>(hits) / lookups : 0.0;
+    }
+
+    CacheStatsSnapshot &operator+=(const CacheStatsSnapshot &other) {
+        hits += other.hits;
+        misses += other.misses;
+        inserts += other.inserts;
+        updates += other.updates;
+        evictions += other.evictions;
+        expirations += other.expirations;
+        lockAcquisitions += other.lockAcquisitions;
+        lockContentions += other.lockContentions;
+        lockWaitNanos += other.lockWaitNanos;
+        return *this;
+    }
+
+    std::string to_string() const {
+        std::ostringstream out;
+        out << "hits: " << hits << ", misses: " << misses
+            << ", hit ratio: " << hit_ratio() << ", inserts: " << inserts
+            << ", updates: " << updates << ", evictions: " << evictions
+            << ", expirations: " << expirations
+            << ", lock acquisitions: " << lockAcquisitions
+            << ", contended: " << lockContentions
+            << ", lock wait ns: " << lockWaitNanos;
+        return out.str();
+    }
+
+    std::string to_json() const {
+        std::ostringstream out;
+        out << "{\"hits\": " << hits << ", \"misses\": " << misses
+            << ", \"hit_ratio\": " << hit_ratio()
+            << ", \"inserts\": " << inserts << ", \"updates\": " << updates
+            << ", \"evictions\": " << evictions
+            << ", \"expirations\": " << expirations
+            << ", \"lock_acquisitions\": " << lockAcquisitions
+            << ", \"lock_contentions\": " << lockContentions
+            << ", \"lock_wait_ns\": " << lockWaitNanos << "}";
+        return out.str();
+    }
+};
+
+template <bool Enabled> class BasicCacheStats;
+
+template <> class BasicCacheStats<false> {
+public:
+    void record_hit() {}
+    void record_miss() {}
+    void record_insert() {}
+    void record_update() {}
+    void record_eviction() {}
+    void record_expiration() {}
+
+    template <typename Mutex> std::unique_lock<Mutex> lock(Mutex &mutex) {
+        return std::unique_lock<Mutex>(mutex);
+    }
+
+    template <typename Mutex>
+    std::shared_lock<Mutex> lock_shared(Mutex &mutex) {
+        return std::shared_lock<Mutex>(mutex);
+    }
+
+    CacheStatsSnapshot snapshot() const { return {}; }
+};
+
+//--------------------------------------------------------------------
+// One block of relaxed counters per cache slice, aligned to its own
+// cache lines so slices never share a line. Locks are first tried
+// without blocking; only a failed try is timed and counted as contended.
+//--------------------------------------------------------------------
+
+template <> class alignas(64) BasicCacheStats<true> {
+public:
+    void record_hit() { add(_hits); }
+    void record_miss() { add(_misses); }
+    void record_insert() { add(_inserts); }
+    void record_update() { add(_updates); }
+    void record_eviction() { add(_evictions); }
+    void record_expiration() { add(_expirations); }
+
+    template <typename Mutex> std::unique_lock<Mutex> lock(Mutex &mutex) {
+        std::unique_lock<Mutex> lock(mutex, std::try_to_lock);
+        if (!lock.owns_lock()) {
+            auto begin = std::chrono::steady_clock::now();
+            lock.lock();
+            record_wait(begin);
+        }
+        add(_lockAcquisitions);
+        return lock;
+    }
+
+    template <typename Mutex>
+    std::shared_lock<Mutex> lock_shared(Mutex &mutex) {
+        std::shared_lock<Mutex> lock(mutex, std::try_to_lock);
+        if (!lock.owns_lock()) {
+            auto begin = std::chrono::steady_clock::now();
+            lock.lock();
+            record_wait(begin);
+        }
+        add(_lockAcquisitions);
+        return lock;
+    }
+
+    CacheStatsSnapshot snapshot() const {
+        CacheStatsSnapshot snapshot;
+        snapshot.hits = _hits.load(std::memory_order_relaxed);
+        snapshot.misses = _misses.load(std::memory_order_relaxed);
+        snapshot.inserts = _inserts.load(std::memory_order_relaxed);
+        snapshot.updates = _updates.load(std::memory_order_relaxed);
+        snapshot.evictions = _evictions.load(std::memory_order_relaxed);
+        snapshot.expirations = _expirations.load(std::memory_order_relaxed);
+        snapshot.lockAcquisitions =
+            _lockAcquisitions.load(std::memory_order_relaxed);
+        snapshot.lockContentions =
+            _lockContentions.load(std::memory_order_relaxed);
+        snapshot.lockWaitNanos = _lockWaitNanos.load(std::memory_order_relaxed);
+        return snapshot;
+    }
+
+private:
+    static void add(std::atomic<uint64_t> &counter, uint64_t n = 1) {
+        counter.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    void record_wait(std::chrono::steady_clock::time_point begin) {
+        add(_lockContentions);
+        add(_lockWaitNanos,
+            static_cast<uint64_t>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - begin)
+                    .count()));
+    }
+
+private:
+    std::atomic<uint64_t> _hits{0};
+    std::atomic<uint64_t> _misses{0};
+    std::atomic<uint64_t> _inserts{0};
+    std::atomic<uint64_t> _updates{0};
+    std::atomic<uint64_t> _evictions{0};
+    std::atomic<uint64_t> _expirations{0};
+    std::atomic<uint64_t> _lockAcquisitions{0};
+    std::atomic<uint64_t> _lockContentions{0};
+    std::atomic<uint64_t> _lockWaitNanos{0};
+};
+
+using CacheStats = BasicCacheStats<kStatsEnabled>;
+
+} // namespace MinCache
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <utility>
+#include <vector>
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+
+namespace MinCache {
+
+// murmur3 finaliser: every input bit affects every output bit
+inline uint64_t mix_hash(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+// default hasher of the sharded caches: std::hash is the identity for
+// integers on common standard libraries, so its result is mixed first
+template <typename Key> struct MixedHash {
+    size_t operator()(const Key &key) const {
+        return static_cast<size_t>(mix_hash(std::hash<Key>()(key)));
+    }
+};
+
+inline size_t round_upPowerOfTwo(size_t n) {
+    size_t power = 1;
+    while (power < n) {
+        power <<= 1;
+    }
+    return power;
+}
+
+// picks a slice from the upper half of a Fibonacci product, which stays
+// independent of the low hash bits each slice's index probes with
+inline size_t slice_of(size_t hash, size_t sliceMask) {
+    return static_cast<size_t>(
+               (static_cast<uint64_t>(hash) * 0x9e3779b97f4a7c15ULL) >> 32) &
+           sliceMask;
+}
+
+inline void prefetch_read(const void *address) {
+#if defined(__GNUC__) || defined(__clang__)
+    __builtin_prefetch(address, 0, 3);
+#else
+    (void)address;
+#endif
+}
+
+// index of the lowest set bit, x must not be zero
+inline int count_trailingZeros(uint64_t x) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_ctzll(x);
+#elif defined(_MSC_VER) && defined(_WIN64)
+    unsigned long index;
+    _BitScanForward64(&index, x);
+    return static_cast<int>(index);
+#elif defined(_MSC_VER)
+    unsigned long index;
+    if (_BitScanForward(&index, static_cast<unsigned long>(x))) {
+        return static_cast<int>(index);
+    }
+    _BitScanForward(&index, static_cast<unsigned long>(x >> 32));
+    return static_cast<int>(index) + 32;
+#else
+    int count = 0;
+    while ((x & 1) == 0) {
+        x >>= 1;
+        ++count;
+    }
+    return count;
+#endif
+}
+
+// number of zero bits above the highest set bit, x must not be zero
+inline int count_leadingZeros(uint64_t x) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_clzll(x);
+#elif defined(_MSC_VER) && defined(_WIN64)
+    unsigned long index;
+    _BitScanReverse64(&index, x);
+    return 63 - static_cast<int>(index);
+#elif defined(_MSC_VER)
+    unsigned long index;
+    if (_BitScanReverse(&index, static_cast<unsigned long>(x >> 32))) {
+        return 31 - static_cast<int>(index);
+    }
+    _BitScanReverse(&index, static_cast<unsigned long>(x));
+    return 63 - static_cast<int>(index);
+#else
+    int count = 0;
+    while ((x & (uint64_t(1) << 63)) == 0) {
+        x <<= 1;
+        ++count;
+    }
+    return count;
+#endif
+}
+
+// counting sort of batch positions by slice: positions of slice s end up
+// in order[offsets[s], offsets[s + 1]) keeping their original order
+inline void group_bySlice(const std::vector<uint32_t> &slices, size_t sliceNum,
+                          std::vector<uint32_t> &order,
+                          std::vector<uint32_t> &offsets) {
+    offsets.assign(sliceNum + 1, 0);
+    for (uint32_t slice : slices) {
+        ++offsets[slice + 1];
+    }
+    for (size_t i = 0; i < sliceNum; ++i) {
+        offsets[i + 1] += offsets[i];
+    }
+
+    order.resize(slices.size());
+    std::vector<uint32_t> cursor(offsets.begin(), offsets.end() - 1);
+    for (uint32_t i = 0; i < slices.size(); ++i) {
+        order[cursor[slices[i]]++] = i;
+    }
+}
+
+} // namespace MinCache
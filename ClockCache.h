@@ -0,0 +1,339 @@
+#pragma once
+
+#include "CachePolicy.h"
+#include "CacheStats.h"
+#include "CacheUtil.h"
+#include "Epoch.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <utility>
+
+namespace MinCache {
+
+//--------------------------------------------------------------------
+// ClockCache: CLOCK eviction over an open addressing table whose
+// readers never lock. Every slot holds an atomic pointer to an immutable
+// entry; get probes the table inside an epoch guard, sets the entry's
+// reference bit and copies the value out. Writers swap whole entries
+// with CAS and retire the old ones through the epoch domain.
+//
+// Writers of one key are serialised by a small array of striped locks
+// so a key can never be inserted twice; the CLOCK hand evicts with CAS
+// and needs no key lock. Removed slots become tombstones that keep probe
+// chains intact; when they pile up a writer rebuilds the table under an
+// exclusive maintenance lock that every other writer holds shared, while
+// readers keep using the old table until the epoch frees it.
+//--------------------------------------------------------------------
+
+template <typename Key, typename Value, typename Hash = MixedHash<Key>>
+class ClockCache : public CachePolicy<Key, Value> {
+public:
+    explicit ClockCache(int capacity)
+        : _capacity(capacity > 0 ? static_cast<size_t>(capacity) : 0),
+          _table(new Table(table_slots(_capacity))) {}
+
+    ~ClockCache() override {
+        Table *table = _table.load(std::memory_order_relaxed);
+        for (size_t i = 0; i <= table->mask; ++i) {
+            Entry *entry = table->slots[i].load(std::memory_order_relaxed);
+            if (is_live(entry)) {
+                delete entry;
+            }
+        }
+        delete table;
+    }
+
+    ClockCache(const ClockCache &) = delete;
+    ClockCache &operator=(const ClockCache &) = delete;
+
+    void put(const Key &key, const Value &value) override {
+        if (_capacity > 0) {
+            store(new Entry(key, value, _hasher(key)));
+        }
+    }
+
+    void put(Key &&key, Value &&value) override {
+        if (_capacity > 0) {
+            size_t hash = _hasher(key);
+            store(new Entry(std::move(key), std::move(value), hash));
+        }
+    }
+
+    bool get(const Key &key, Value &value) override {
+        return visit(key, [&value](const Value &v) { value = v; });
+    }
+
+    Value get(const Key &key) override {
+        Value value{};
+        get(key, value);
+        return value;
+    }
+
+    // calls func on the cached value without taking any lock
+    template <typename Func> bool visit(const Key &key, Func &&func) {
+        size_t hash = _hasher(key);
+        EpochDomain::Guard guard;
+        const Table *table = _table.load(std::memory_order_acquire);
+        Entry *entry = find(*table, key, hash, nullptr);
+        if (!entry) {
+            _stats.record_miss();
+            return false;
+        }
+        // most hits find the bit already set; skip the store so hot
+        // entries do not bounce their cache line between readers
+        if (!entry->referenced.load(std::memory_order_relaxed)) {
+            entry->referenced.store(true, std::memory_order_relaxed);
+        }
+        _stats.record_hit();
+        func(static_cast<const Value &>(entry->value));
+        return true;
+    }
+
+    bool remove(const Key &key) {
+        size_t hash = _hasher(key);
+        std::shared_lock<std::shared_mutex> maintenance(_maintenanceMutex);
+        auto lock = _stats.lock(stripe_of(hash));
+        EpochDomain::Guard guard;
+        Table *table = _table.load(std::memory_order_acquire);
+        size_t position;
+        while (Entry *entry = find(*table, key, hash, &position)) {
+            // the CLOCK hand may take the entry first
+            if (table->slots[position].compare_exchange_strong(
+                    entry, tombstone(), std::memory_order_acq_rel)) {
+                unlink(entry);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    size_t size() const { return _size.load(std::memory_order_relaxed); }
+
+    size_t capacity() const { return _capacity; }
+
+    CacheStatsSnapshot stats() const { return _stats.snapshot(); }
+
+private:
+    struct Entry {
+        template <typename K, typename V>
+        Entry(K &&k, V &&v, size_t h)
+            : key(std::forward<K>(k)), value(std::forward<V>(v)), hash(h) {}
+
+        const Key key;
+        const Value value;
+        const size_t hash;
+        // CLOCK reference bit, new entries get one second chance
+        std::atomic<bool> referenced{true};
+    };
+
+    struct Table {
+        explicit Table(size_t slotCount)
+            : mask(slotCount - 1), slots(new std::atomic<Entry *>[slotCount]) {
+            for (size_t i = 0; i < slotCount; ++i) {
+                slots[i].store(nullptr, std::memory_order_relaxed);
+            }
+        }
+
+        const size_t mask;
+        std::unique_ptr<std::atomic<Entry *>[]> slots;
+    };
+
+    static constexpr size_t kStripes = 64;
+
+    // at most half the slots are live, so probes stay short and a
+    // rebuild is only needed once tombstones take another quarter
+    static size_t table_slots(size_t capacity) {
+        return round_upPowerOfTwo(capacity * 2 + 16);
+    }
+
+    static size_t max_used(const Table &table) {
+        return (table.mask + 1) / 4 * 3;
+    }
+
+    static Entry *tombstone() {
+        return reinterpret_cast<Entry *>(static_cast<uintptr_t>(1));
+    }
+
+    static bool is_live(const Entry *entry) {
+        return entry != nullptr && entry != tombstone();
+    }
+
+    std::mutex &stripe_of(size_t hash) {
+        return _stripes[slice_of(hash, kStripes - 1)].mutex;
+    }
+
+    // probes until an empty slot; position receives the slot of the hit
+    static Entry *find(const Table &table, const Key &key, size_t hash,
+                       size_t *position) {
+        size_t index = hash & table.mask;
+        for (size_t probes = 0; probes <= table.mask; ++probes) {
+            Entry *entry = table.slots[index].load(std::memory_order_acquire);
+            if (entry == nullptr) {
+                return nullptr;
+            }
+            if (entry != tombstone() && entry->hash == hash &&
+                entry->key == key) {
+                if (position) {
+                    *position = index;
+                }
+                return entry;
+            }
+            index = (index + 1) & table.mask;
+        }
+        return nullptr;
+    }
+
+    void store(Entry *fresh);
+    bool try_store(Entry *fresh);
+    bool evict_one(Table &table);
+    void unlink(Entry *entry);
+    void rebuild();
+
+private:
+    struct alignas(64) Stripe {
+        std::mutex mutex;
+    };
+
+    const size_t _capacity;
+    Hash _hasher;
+    std::atomic<Table *> _table;
+    alignas(64) std::atomic<size_t> _size{0};
+    std::atomic<size_t> _tombstones{0};
+    alignas(64) std::atomic<size_t> _hand{0};
+    // writers hold it shared, a table rebuild exclusively
+    std::shared_mutex _maintenanceMutex;
+    Stripe _stripes[kStripes];
+    CacheStats _stats;
+};
+
+template <typename Key, typename Value, typename Hash>
+void ClockCache<Key, Value, Hash>::store(Entry *fresh) {
+    while (!try_store(fresh)) {
+        rebuild();
+    }
+}
+
+// false when the table has no room left for another slot
+template <typename Key, typename Value, typename Hash>
+bool ClockCache<Key, Value, Hash>::try_store(Entry *fresh) {
+    std::shared_lock<std::shared_mutex> maintenance(_maintenanceMutex);
+    auto lock = _stats.lock(stripe_of(fresh->hash));
+    EpochDomain::Guard guard;
+    Table *table = _table.load(std::memory_order_acquire);
+
+    size_t position;
+    while (Entry *current = find(*table, fresh->key, fresh->hash, &position)) {
+        if (table->slots[position].compare_exchange_strong(
+                current, fresh, std::memory_order_acq_rel)) {
+            _stats.record_update();
+            EpochDomain::global().retire(current);
+            return true;
+        }
+    }
+
+    // the entry's place in _size is taken before it is inserted, so
+    // writers of different stripes never take the cache past capacity
+    size_t size = _size.load(std::memory_order_relaxed);
+    while (size >= _capacity ||
+           !_size.compare_exchange_weak(size, size + 1,
+                                        std::memory_order_relaxed)) {
+        if (size >= _capacity) {
+            if (!evict_one(*table)) {
+                // the counted entries are still on their way in
+                std::this_thread::yield();
+            }
+            size = _size.load(std::memory_order_relaxed);
+        }
+    }
+    if (_size.load(std::memory_order_relaxed) +
+            _tombstones.load(std::memory_order_relaxed) >
+        max_used(*table)) {
+        _size.fetch_sub(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    // nobody else can insert this key while the stripe is held, so
+    // claiming the first free slot of the probe chain cannot duplicate it
+
+    size_t index = fresh->hash & table->mask;
+    for (size_t probes = 0; probes <= table->mask; ++probes) {
+        Entry *slot = table->slots[index].load(std::memory_order_acquire);
+        if (!is_live(slot) && table->slots[index].compare_exchange_strong(
+                                  slot, fresh, std::memory_order_acq_rel)) {
+            if (slot == tombstone()) {
+                _tombstones.fetch_sub(1, std::memory_order_relaxed);
+            }
+            _stats.record_insert();
+            return true;
+        }
+        index = (index + 1) & table->mask;
+    }
+    _size.fetch_sub(1, std::memory_order_relaxed);
+    return false;
+}
+
+// advances the hand, clearing reference bits, until one entry goes
+template <typename Key, typename Value, typename Hash>
+bool ClockCache<Key, Value, Hash>::evict_one(Table &table) {
+    // two sweeps clear every bit once and then find a victim
+    for (size_t step = 0; step <= 2 * (table.mask + 1); ++step) {
+        size_t index = _hand.fetch_add(1, std::memory_order_relaxed) & table.mask;
+        Entry *entry = table.slots[index].load(std::memory_order_acquire);
+        if (!is_live(entry)) {
+            continue;
+        }
+        if (entry->referenced.load(std::memory_order_relaxed)) {
+            entry->referenced.store(false, std::memory_order_relaxed);
+            continue;
+        }
+        if (table.slots[index].compare_exchange_strong(
+                entry, tombstone(), std::memory_order_acq_rel)) {
+            _stats.record_eviction();
+            unlink(entry);
+            return true;
+        }
+    }
+    return false;
+}
+
+template <typename Key, typename Value, typename Hash>
+void ClockCache<Key, Value, Hash>::unlink(Entry *entry) {
+    _size.fetch_sub(1, std::memory_order_relaxed);
+    _tombstones.fetch_add(1, std::memory_order_relaxed);
+    EpochDomain::global().retire(entry);
+}
+
+// copies the live entries into a fresh table without tombstones
+template <typename Key, typename Value, typename Hash>
+void ClockCache<Key, Value, Hash>::rebuild() {
+    std::unique_lock<std::shared_mutex> maintenance(_maintenanceMutex);
+    Table *table = _table.load(std::memory_order_relaxed);
+    if (_size.load(std::memory_order_relaxed) +
+            _tombstones.load(std::memory_order_relaxed) <
+        max_used(*table)) {
+        return;
+    }
+
+    Table *fresh = new Table(table->mask + 1);
+    for (size_t i = 0; i <= table->mask; ++i) {
+        Entry *entry = table->slots[i].load(std::memory_order_relaxed);
+        if (!is_live(entry)) {
+            continue;
+        }
+        size_t index = entry->hash & fresh->mask;
+        while (fresh->slots[index].load(std::memory_order_relaxed)) {
+            index = (index + 1) & fresh->mask;
+        }
+        fresh->slots[index].store(entry, std::memory_order_relaxed);
+    }
+    _tombstones.store(0, std::memory_order_relaxed);
+    _table.store(fresh, std::memory_order_release);
+    EpochDomain::global().retire(table);
+}
+
+} // namespace MinCache
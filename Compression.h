@@ -0,0 +1,299 @@
+#pragma once
+
+#include "LruCache.h"
+#include "Snapshot.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <utility>
+
+namespace MinCache {
+
+//--------------------------------------------------------------------
+// LzCodec: small LZ77 block codec in the spirit of LZ4. The input is a
+// run of sequences, each a token byte (literal count in the high
+// nibble, match length - 4 in the low one, 15 meaning more bytes
+// follow), the literals, a 16-bit offset and the extra match length;
+// the last sequence has literals only. Matches are found through a
+// hash table of 4-byte prefixes and the scan speeds up over stretches
+// without matches, so incompressible input costs little.
+//
+// Any codec with the same two static functions can replace it.
+//--------------------------------------------------------------------
+
+struct LzCodec {
+    // appends the compressed form of data to out; false, with out
+    // unchanged, if it would not be smaller than the input
+    static bool compress(const char *data, size_t size, std::string &out) {
+        if (size < kMinInput) {
+            return false;
+        }
+        size_t base = out.size();
+        out.reserve(base + size);
+        uint32_t table[kTableSize] = {};
+        const unsigned char *src = reinterpret_cast<const unsigned char *>(data);
+        // the last match starts at least kLastLiterals bytes before the end
+        size_t matchLimit = size - kLastLiterals;
+        size_t anchor = 0;
+        size_t position = 1;
+
+        while (position + kMinMatch <= matchLimit) {
+            uint32_t h = hash4(src + position);
+            size_t candidate = table[h];
+            table[h] = static_cast<uint32_t>(position);
+            if (position - candidate > kMaxOffset ||
+                std::memcmp(src + candidate, src + position, kMinMatch) != 0) {
+                // skip ahead faster the longer nothing matched
+                position += 1 + ((position - anchor) >> kSkipShift);
+                continue;
+            }
+
+            size_t length = kMinMatch;
+            while (position + length < matchLimit &&
+                   src[candidate + length] == src[position + length]) {
+                ++length;
+            }
+            if (!emit(out, base, size, src + anchor, position - anchor,
+                      position - candidate, length)) {
+                out.resize(base);
+                return false;
+            }
+            position += length;
+            anchor = position;
+        }
+
+        if (!emit(out, base, size, src + anchor, size - anchor, 0, 0)) {
+            out.resize(base);
+            return false;
+        }
+        return true;
+    }
+
+    // decodes size bytes of compressed data into exactly rawSize bytes;
+    // false on malformed input
+    static bool decompress(const char *data, size_t size, size_t rawSize,
+                           std::string &out) {
+        out.resize(rawSize);
+        const unsigned char *in = reinterpret_cast<const unsigned char *>(data);
+        const unsigned char *end = in + size;
+        char *dst = out.empty() ? nullptr : &out[0];
+        size_t written = 0;
+
+        while (in < end) {
+            unsigned token = *in++;
+            size_t literals = token >> 4;
+            if (literals == 15 && !read_length(in, end, literals)) {
+                return false;
+            }
+            if (literals > static_cast<size_t>(end - in) ||
+                literals > rawSize - written) {
+                return false;
+            }
+            std::memcpy(dst + written, in, literals);
+            in += literals;
+            written += literals;
+            if (in == end) {
+                break;
+            }
+
+            if (end - in < 2) {
+                return false;
+            }
+            size_t offset = in[0] | static_cast<size_t>(in[1]) << 8;
+            in += 2;
+            size_t length = token & 15;
+            if (length == 15 && !read_length(in, end, length)) {
+                return false;
+            }
+            length += kMinMatch;
+            if (offset == 0 || offset > written || length > rawSize - written) {
+                return false;
+            }
+            const char *from = dst + written - offset;
+            if (offset >= length) {
+                std::memcpy(dst + written, from, length);
+            } else {
+                // the match overlaps the bytes it produces
+                for (size_t i = 0; i < length; ++i) {
+                    dst[written + i] = from[i];
+                }
+            }
+            written += length;
+        }
+        return written == rawSize;
+    }
+
+private:
+    static constexpr size_t kMinMatch = 4;
+    static constexpr size_t kLastLiterals = 5;
+    static constexpr size_t kMinInput = 16;
+    static constexpr size_t kMaxOffset = 65535;
+    static constexpr int kTableBits = 12;
+    static constexpr size_t kTableSize = size_t(1) << kTableBits;
+    static constexpr int kSkipShift = 6;
+
+    static uint32_t hash4(const unsigned char *p) {
+        uint32_t value;
+        std::memcpy(&value, p, sizeof(value));
+        return (value * 2654435761u) >> (32 - kTableBits);
+    }
+
+    static void put_length(std::string &out, size_t length) {
+        while (length >= 255) {
+            out.push_back(static_cast<char>(255));
+            length -= 255;
+        }
+        out.push_back(static_cast<char>(length));
+    }
+
+    static bool read_length(const unsigned char *&in, const unsigned char *end,
+                            size_t &length) {
+        while (in < end) {
+            unsigned byte = *in++;
+            length += byte;
+            if (byte != 255) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // one sequence; matchLength zero ends the block. False once the
+    // output has grown as large as the input
+    static bool emit(std::string &out, size_t base, size_t inputSize,
+                     const unsigned char *literals, size_t literalCount,
+                     size_t offset, size_t matchLength) {
+        size_t matchCode = matchLength ? matchLength - kMinMatch : 0;
+        out.push_back(static_cast<char>(
+            (literalCount < 15 ? literalCount : 15) << 4 |
+            (matchCode < 15 ? matchCode : 15)));
+        if (literalCount >= 15) {
+            put_length(out, literalCount - 15);
+        }
+        out.append(reinterpret_cast<const char *>(literals), literalCount);
+        if (matchLength) {
+            out.push_back(static_cast<char>(offset & 0xff));
+            out.push_back(static_cast<char>(offset >> 8));
+            if (matchCode >= 15) {
+                put_length(out, matchCode - 15);
+            }
+        }
+        return out.size() - base < inputSize;
+    }
+};
+
+struct CompressionStats {
+    // value bytes handed to put, and what was stored for them
+    uint64_t rawBytes = 0;
+    uint64_t storedBytes = 0;
+    uint64_t compressed = 0;
+    uint64_t storedRaw = 0;
+};
+
+//--------------------------------------------------------------------
+// CompressedCache: string values compressed before they reach the
+// cache (HashLruCache by default, HashLfuCache works the same). put
+// compresses before calling into the cache and get decompresses after
+// the stored form is copied out, so neither runs under a slice lock.
+// Values below the threshold, or that do not shrink, are stored as
+// they are. The stored form is a tag byte, for compressed values the
+// raw size as a varint, then the payload; in weighted mode entries are
+// weighed by that stored size.
+//--------------------------------------------------------------------
+
+template <typename Key, typename Cache = HashLruCache<Key, std::string>,
+          typename Codec = LzCodec>
+class CompressedCache {
+public:
+    // values shorter than threshold bytes are never compressed;
+    // cacheArgs are forwarded to the cache
+    template <typename... Args>
+    explicit CompressedCache(size_t threshold, Args &&...cacheArgs)
+        : _threshold(threshold), _cache(std::forward<Args>(cacheArgs)...) {}
+
+    void put(const Key &key, const std::string &value) {
+        std::string stored;
+        encode(value, stored);
+        // emplace moves the stored form into the slot instead of copying
+        _cache.emplace(key, std::move(stored));
+    }
+
+    bool get(const Key &key, std::string &value) {
+        thread_local std::string stored;
+        return _cache.get(key, stored) && decode(stored, value);
+    }
+
+    std::string get(const Key &key) {
+        std::string value;
+        get(key, value);
+        return value;
+    }
+
+    void remove(const Key &key) { _cache.remove(key); }
+
+    // byte budget over the compressed size of the entries, see the
+    // cache's set_weighted
+    void set_weighted(size_t maxWeight) {
+        _cache.set_weighted(maxWeight, [](const Key &, const std::string &stored) {
+            return stored.size();
+        });
+    }
+
+    CompressionStats stats() const {
+        CompressionStats stats;
+        stats.rawBytes = _rawBytes.load(std::memory_order_relaxed);
+        stats.storedBytes = _storedBytes.load(std::memory_order_relaxed);
+        stats.compressed = _compressed.load(std::memory_order_relaxed);
+        stats.storedRaw = _storedRaw.load(std::memory_order_relaxed);
+        return stats;
+    }
+
+    Cache &cache() { return _cache; }
+
+private:
+    static constexpr char kRaw = 0;
+    static constexpr char kCompressed = 1;
+
+    void encode(const std::string &value, std::string &stored) {
+        stored.push_back(kCompressed);
+        put_varint(stored, value.size());
+        bool compressed = value.size() >= _threshold &&
+                          Codec::compress(value.data(), value.size(), stored);
+        if (!compressed) {
+            stored.assign(1, kRaw);
+            stored.append(value);
+        }
+        (compressed ? _compressed : _storedRaw)
+            .fetch_add(1, std::memory_order_relaxed);
+        _rawBytes.fetch_add(value.size(), std::memory_order_relaxed);
+        _storedBytes.fetch_add(stored.size(), std::memory_order_relaxed);
+    }
+
+    static bool decode(const std::string &stored, std::string &value) {
+        if (stored.empty()) {
+            return false;
+        }
+        if (stored[0] == kRaw) {
+            value.assign(stored, 1, std::string::npos);
+            return true;
+        }
+        const char *p = stored.data() + 1;
+        const char *end = stored.data() + stored.size();
+        uint64_t rawSize;
+        return get_varint(p, end, rawSize) &&
+               Codec::decompress(p, static_cast<size_t>(end - p),
+                                 static_cast<size_t>(rawSize), value);
+    }
+
+private:
+    const size_t _threshold;
+    Cache _cache;
+    std::atomic<uint64_t> _rawBytes{0};
+    std::atomic<uint64_t> _storedBytes{0};
+    std::atomic<uint64_t> _compressed{0};
+    std::atomic<uint64_t> _storedRaw{0};
+};
+
+} // namespace MinCache
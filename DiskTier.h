@@ -0,0 +1,620 @@
+#pragma once
+
+#include "CacheUtil.h"
+#include "FlatIndex.h"
+#include "LruCache.h"
+#include "Snapshot.h"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
+#include <mutex>
+#include <string>
+#include <sys/types.h>
+#include <thread>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+namespace MinCache {
+
+struct DiskTierStats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t writes = 0;
+    // appends given up for lack of a free region or of write bandwidth
+    uint64_t drops = 0;
+    uint64_t compactedRegions = 0;
+    uint64_t evictedRegions = 0;
+};
+
+//--------------------------------------------------------------------
+// DiskTier: secondary cache tier in a log structured file, meant to
+// take the entries a memory cache evicts (see TieredCache). The file is
+// split into regions that are written strictly in sequence, sealed when
+// full and reclaimed as a whole. Only a compact index lives in memory,
+// key hash to record offset and size, about 34 bytes per entry whatever
+// the key and value sizes; the key is stored with its record and
+// compared on every read.
+//
+// An append only copies the record into an in-memory chunk. A
+// background thread writes full chunks out and keeps kFreeReserve
+// regions free: a sealed region that is at most half live is compacted,
+// its live records appended again, otherwise the oldest sealed region
+// is dropped whole. Appends that find no free region or too much data
+// still waiting for the disk are dropped instead of blocking. Records
+// carry a CRC32C, so a read racing with the reuse of its region is a
+// miss rather than a wrong value.
+//--------------------------------------------------------------------
+
+template <typename Key, typename Value, typename Hash = MixedHash<Key>>
+class DiskTier {
+public:
+    // path is created or truncated and unlinked right away, so nothing is
+    // left behind; maxBytes is the size of the file
+    DiskTier(const std::string &path, size_t maxBytes) {
+        _regionBytes =
+            std::min(kMaxRegionBytes, maxBytes / kMinRegions) & ~size_t(4095);
+        if (_regionBytes == 0) {
+            return;
+        }
+        size_t regions = maxBytes / _regionBytes;
+        _fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+        if (_fd < 0) {
+            return;
+        }
+        ::unlink(path.c_str());
+        if (::ftruncate(_fd, static_cast<off_t>(regions * _regionBytes)) != 0) {
+            ::close(_fd);
+            _fd = -1;
+            return;
+        }
+
+        _regionLive.assign(regions, 0);
+        _regionUsed.assign(regions, 0);
+        for (uint32_t region = 1; region < regions; ++region) {
+            _freeRegions.push_back(region);
+        }
+        _activeRegion = 0;
+        _chunks.push_back({0, std::string()});
+        _worker = std::thread([this] { run(); });
+    }
+
+    ~DiskTier() {
+        if (_worker.joinable()) {
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _stop = true;
+            }
+            _wake.notify_one();
+            _worker.join();
+        }
+        if (_fd >= 0) {
+            ::close(_fd);
+        }
+    }
+
+    DiskTier(const DiskTier &) = delete;
+    DiskTier &operator=(const DiskTier &) = delete;
+
+    bool is_open() const { return _fd >= 0; }
+
+    // stores the entry, replacing any older record of the key; false if
+    // the record was dropped
+    bool put(const Key &key, const Value &value) {
+        if (!is_open()) {
+            return false;
+        }
+        thread_local std::string record;
+        encode_record(_hasher(key), key, value, record);
+        bool wake = false;
+        bool stored = false;
+        if (record.size() <= _regionBytes) {
+            std::lock_guard<std::mutex> lock(_mutex);
+            stored = append_locked(record.data(), record.size(), wake);
+        }
+        if (!stored) {
+            _drops.fetch_add(1, std::memory_order_relaxed);
+        }
+        if (wake) {
+            _wake.notify_one();
+        }
+        return stored;
+    }
+
+    bool get(const Key &key, Value &value) { return read(key, value, false); }
+
+    // get that also drops the record, for promotion to the memory tier
+    bool take(const Key &key, Value &value) { return read(key, value, true); }
+
+    bool remove(const Key &key) {
+        if (_entries.load(std::memory_order_relaxed) == 0) {
+            return false;
+        }
+        std::lock_guard<std::mutex> lock(_mutex);
+        uint32_t slot = find_slot(_hasher(key));
+        if (slot == kNotFound) {
+            return false;
+        }
+        erase_slot(slot);
+        return true;
+    }
+
+    size_t size() const { return _entries.load(std::memory_order_relaxed); }
+
+    DiskTierStats stats() const {
+        DiskTierStats stats;
+        stats.hits = _hits.load(std::memory_order_relaxed);
+        stats.misses = _misses.load(std::memory_order_relaxed);
+        stats.writes = _writes.load(std::memory_order_relaxed);
+        stats.drops = _drops.load(std::memory_order_relaxed);
+        stats.compactedRegions = _compacted.load(std::memory_order_relaxed);
+        stats.evictedRegions = _evicted.load(std::memory_order_relaxed);
+        return stats;
+    }
+
+private:
+    static constexpr uint32_t kNotFound = FlatIndex<uint64_t>::kNotFound;
+    static constexpr size_t kMinRegions = 16;
+    static constexpr size_t kMaxRegionBytes = 64 << 20;
+    static constexpr size_t kFreeReserve = 2;
+    static constexpr size_t kChunkBytes = 256 << 10;
+    static constexpr size_t kMaxPendingBytes = 16 << 20;
+    // records a reclaim moves per lock acquisition
+    static constexpr size_t kReclaimBatch = 64;
+
+    // a record is a header followed by the encoded key and value, the crc
+    // covers the hash and the payload
+    struct RecordHeader {
+        uint32_t bytes;
+        uint32_t crc;
+        uint64_t hash;
+    };
+
+    struct Location {
+        uint64_t hash;
+        uint64_t offset;
+        uint32_t bytes;
+        uint32_t next; // free list link
+    };
+
+    // records not on disk yet; only the last chunk still grows
+    struct Chunk {
+        uint64_t offset;
+        std::string data;
+    };
+
+    static void encode_record(uint64_t hash, const Key &key, const Value &value,
+                              std::string &record) {
+        record.assign(sizeof(RecordHeader), '\0');
+        SnapshotCodec<Key>::encode(key, record);
+        SnapshotCodec<Value>::encode(value, record);
+        RecordHeader header;
+        header.bytes = static_cast<uint32_t>(record.size());
+        header.hash = hash;
+        header.crc = record_crc(header.hash, record.data() + sizeof(header),
+                                record.size() - sizeof(header));
+        std::memcpy(&record[0], &header, sizeof(header));
+    }
+
+    static uint32_t record_crc(uint64_t hash, const char *payload, size_t bytes) {
+        return crc32c(payload, bytes, crc32c(&hash, sizeof(hash)));
+    }
+
+    uint64_t region_offset(uint32_t region) const {
+        return static_cast<uint64_t>(region) * _regionBytes;
+    }
+
+    uint32_t region_of(uint64_t offset) const {
+        return static_cast<uint32_t>(offset / _regionBytes);
+    }
+
+    uint32_t find_slot(uint64_t hash) const {
+        return _index.find(
+            hash, [this](uint32_t slot) -> const uint64_t & {
+                return _slots[slot].hash;
+            });
+    }
+
+    void erase_slot(uint32_t slot) {
+        Location &location = _slots[slot];
+        _regionLive[region_of(location.offset)] -= location.bytes;
+        _index.erase(location.hash, slot);
+        location.next = _freeSlots;
+        _freeSlots = slot;
+        _entries.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    bool append_locked(const char *record, size_t bytes, bool &wake);
+    bool read(const Key &key, Value &value, bool erase);
+    bool copy_pending(uint64_t offset, size_t bytes, char *out) const;
+    bool read_at(uint64_t offset, char *out, size_t bytes) const;
+    bool write_at(uint64_t offset, const char *data, size_t bytes) const;
+    void run();
+    void flush_chunks();
+    void reclaim();
+
+private:
+    int _fd = -1;
+    size_t _regionBytes = 0;
+    Hash _hasher;
+    std::mutex _mutex;
+    std::condition_variable _wake;
+    bool _stop = false;
+
+    FlatIndex<uint64_t> _index;
+    std::vector<Location> _slots;
+    uint32_t _freeSlots = kNotFound;
+    std::atomic<size_t> _entries{0};
+
+    // live bytes per region, and how far a sealed region was filled
+    std::vector<uint64_t> _regionLive;
+    std::vector<uint64_t> _regionUsed;
+    std::deque<uint32_t> _freeRegions;
+    // oldest first
+    std::deque<uint32_t> _sealedRegions;
+    uint32_t _activeRegion = 0;
+    uint64_t _writePos = 0;
+    std::deque<Chunk> _chunks;
+    size_t _pendingBytes = 0;
+    std::thread _worker;
+
+    std::atomic<uint64_t> _hits{0};
+    std::atomic<uint64_t> _misses{0};
+    std::atomic<uint64_t> _writes{0};
+    std::atomic<uint64_t> _drops{0};
+    std::atomic<uint64_t> _compacted{0};
+    std::atomic<uint64_t> _evicted{0};
+};
+
+// appends a complete record and points the index at it; wake is set when
+// the background thread has work
+template <typename Key, typename Value, typename Hash>
+bool DiskTier<Key, Value, Hash>::append_locked(const char *record, size_t bytes,
+                                               bool &wake) {
+    if (_pendingBytes + bytes > kMaxPendingBytes) {
+        wake = true;
+        return false;
+    }
+    if (_writePos + bytes > _regionBytes) {
+        if (_freeRegions.empty()) {
+            wake = true;
+            return false;
+        }
+        _regionUsed[_activeRegion] = _writePos;
+        _sealedRegions.push_back(_activeRegion);
+        _activeRegion = _freeRegions.front();
+        _freeRegions.pop_front();
+        _writePos = 0;
+        _chunks.push_back({region_offset(_activeRegion), std::string()});
+        wake = true;
+    } else if (_chunks.back().data.size() >= kChunkBytes) {
+        _chunks.push_back({region_offset(_activeRegion) + _writePos,
+                           std::string()});
+        wake = true;
+    }
+
+    uint64_t offset = region_offset(_activeRegion) + _writePos;
+    _chunks.back().data.append(record, bytes);
+    _writePos += bytes;
+    _pendingBytes += bytes;
+    _regionLive[_activeRegion] += bytes;
+
+    uint64_t hash;
+    std::memcpy(&hash, record + offsetof(RecordHeader, hash), sizeof(hash));
+    uint32_t slot = find_slot(hash);
+    if (slot != kNotFound) {
+        _regionLive[region_of(_slots[slot].offset)] -= _slots[slot].bytes;
+    } else {
+        if (_freeSlots != kNotFound) {
+            slot = _freeSlots;
+            _freeSlots = _slots[slot].next;
+        } else {
+            slot = static_cast<uint32_t>(_slots.size());
+            _slots.emplace_back();
+        }
+        _slots[slot].hash = hash;
+        _index.insert(hash, slot);
+        _entries.fetch_add(1, std::memory_order_relaxed);
+    }
+    _slots[slot].offset = offset;
+    _slots[slot].bytes = static_cast<uint32_t>(bytes);
+    _writes.fetch_add(1, std::memory_order_relaxed);
+    wake = wake || _freeRegions.size() < kFreeReserve;
+    return true;
+}
+
+template <typename Key, typename Value, typename Hash>
+bool DiskTier<Key, Value, Hash>::read(const Key &key, Value &value,
+                                      bool erase) {
+    if (_entries.load(std::memory_order_relaxed) == 0) {
+        _misses.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    uint64_t hash = _hasher(key);
+    uint64_t offset;
+    thread_local std::string record;
+    bool copied;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        uint32_t slot = find_slot(hash);
+        if (slot == kNotFound) {
+            _misses.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        offset = _slots[slot].offset;
+        record.resize(_slots[slot].bytes);
+        copied = copy_pending(offset, record.size(), &record[0]);
+    }
+
+    // the disk read runs unlocked; if the region is reused meanwhile the
+    // crc no longer matches
+    bool intact = copied || read_at(offset, &record[0], record.size());
+    RecordHeader header;
+    if (intact) {
+        std::memcpy(&header, record.data(), sizeof(header));
+        intact = header.bytes == record.size() && header.hash == hash &&
+                 header.crc == record_crc(hash, record.data() + sizeof(header),
+                                          record.size() - sizeof(header));
+    }
+    // a different key with the same hash is a plain miss
+    bool found = false;
+    if (intact) {
+        Key stored{};
+        const char *p = record.data() + sizeof(header);
+        const char *end = record.data() + record.size();
+        found = SnapshotCodec<Key>::decode(p, end, stored) && stored == key &&
+                SnapshotCodec<Value>::decode(p, end, value);
+    }
+
+    if ((erase && found) || !intact) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        uint32_t slot = find_slot(hash);
+        // damaged records go too, unless they were moved or replaced
+        if (slot != kNotFound && _slots[slot].offset == offset) {
+            erase_slot(slot);
+        }
+    }
+    (found ? _hits : _misses).fetch_add(1, std::memory_order_relaxed);
+    return found;
+}
+
+// copies a record that is still waiting in a chunk
+template <typename Key, typename Value, typename Hash>
+bool DiskTier<Key, Value, Hash>::copy_pending(uint64_t offset, size_t bytes,
+                                              char *out) const {
+    for (const Chunk &chunk : _chunks) {
+        if (offset >= chunk.offset && offset < chunk.offset + chunk.data.size()) {
+            std::memcpy(out, chunk.data.data() + (offset - chunk.offset), bytes);
+            return true;
+        }
+    }
+    return false;
+}
+
+template <typename Key, typename Value, typename Hash>
+bool DiskTier<Key, Value, Hash>::read_at(uint64_t offset, char *out,
+                                         size_t bytes) const {
+    while (bytes > 0) {
+        ssize_t n = ::pread(_fd, out, bytes, static_cast<off_t>(offset));
+        if (n <= 0) {
+            return false;
+        }
+        out += n;
+        offset += static_cast<uint64_t>(n);
+        bytes -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+template <typename Key, typename Value, typename Hash>
+bool DiskTier<Key, Value, Hash>::write_at(uint64_t offset, const char *data,
+                                          size_t bytes) const {
+    while (bytes > 0) {
+        ssize_t n = ::pwrite(_fd, data, bytes, static_cast<off_t>(offset));
+        if (n <= 0) {
+            return false;
+        }
+        data += n;
+        offset += static_cast<uint64_t>(n);
+        bytes -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+template <typename Key, typename Value, typename Hash>
+void DiskTier<Key, Value, Hash>::run() {
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (true) {
+        _wake.wait(lock, [this] {
+            return _stop || _chunks.size() > 1 ||
+                   (_freeRegions.size() < kFreeReserve &&
+                    !_sealedRegions.empty());
+        });
+        if (_stop) {
+            return;
+        }
+        lock.unlock();
+        flush_chunks();
+        reclaim();
+        lock.lock();
+    }
+}
+
+// writes every chunk but the growing one; a chunk stays readable from
+// memory until it is on disk
+template <typename Key, typename Value, typename Hash>
+void DiskTier<Key, Value, Hash>::flush_chunks() {
+    while (true) {
+        const Chunk *chunk;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (_chunks.size() <= 1) {
+                return;
+            }
+            chunk = &_chunks.front();
+        }
+        // a failed write leaves records the crc check turns into misses
+        write_at(chunk->offset, chunk->data.data(), chunk->data.size());
+        std::lock_guard<std::mutex> lock(_mutex);
+        _pendingBytes -= chunk->data.size();
+        _chunks.pop_front();
+    }
+}
+
+// frees one sealed region if fewer than kFreeReserve are free
+template <typename Key, typename Value, typename Hash>
+void DiskTier<Key, Value, Hash>::reclaim() {
+    uint32_t region;
+    bool compact;
+    while (true) {
+        flush_chunks();
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_freeRegions.size() >= kFreeReserve || _sealedRegions.empty()) {
+            return;
+        }
+        // only the active region may have records in memory, otherwise
+        // a region sealed since the flush could be freed before its
+        // last chunk lands in it
+        if (_chunks.size() > 1) {
+            continue;
+        }
+        auto sparsest = std::min_element(
+            _sealedRegions.begin(), _sealedRegions.end(),
+            [this](uint32_t a, uint32_t b) {
+                return _regionLive[a] < _regionLive[b];
+            });
+        compact = _regionLive[*sparsest] * 2 <= _regionBytes;
+        auto victim = compact ? sparsest : _sealedRegions.begin();
+        region = *victim;
+        _sealedRegions.erase(victim);
+        break;
+    }
+
+    std::string data;
+    data.resize(static_cast<size_t>(_regionUsed[region]));
+    if (!read_at(region_offset(region), &data[0], data.size())) {
+        data.clear();
+    }
+
+    size_t position = 0;
+    while (position + sizeof(RecordHeader) <= data.size()) {
+        bool wake = false;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            for (size_t n = 0; n < kReclaimBatch &&
+                               position + sizeof(RecordHeader) <= data.size();
+                 ++n) {
+                RecordHeader header;
+                std::memcpy(&header, data.data() + position, sizeof(header));
+                if (header.bytes < sizeof(header) ||
+                    header.bytes > data.size() - position) {
+                    position = data.size();
+                    break;
+                }
+                uint32_t slot = find_slot(header.hash);
+                if (slot != kNotFound &&
+                    _slots[slot].offset == region_offset(region) + position) {
+                    if (!compact ||
+                        !append_locked(data.data() + position, header.bytes,
+                                       wake)) {
+                        erase_slot(slot);
+                    }
+                }
+                position += header.bytes;
+            }
+        }
+        // keep the chunks of moved records from piling up
+        flush_chunks();
+    }
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    // entries the scan could not reach point nowhere useful any more
+    if (_regionLive[region] != 0) {
+        for (uint32_t slot = 0; slot < _slots.size(); ++slot) {
+            if (region_of(_slots[slot].offset) == region &&
+                find_slot(_slots[slot].hash) == slot) {
+                erase_slot(slot);
+            }
+        }
+    }
+    _regionUsed[region] = 0;
+    _freeRegions.push_back(region);
+    (compact ? _compacted : _evicted).fetch_add(1, std::memory_order_relaxed);
+}
+
+//--------------------------------------------------------------------
+// TieredCache: a memory cache (HashLruCache by default, HashLfuCache
+// works the same) whose evictions spill into a DiskTier. A memory miss
+// that hits on disk moves the entry back into memory, so a key lives in
+// one tier at a time. Spilled entries lose their ttl and come back with
+// the memory cache's default one. A get promoting a key while another
+// thread removes it may bring the removed entry back.
+//--------------------------------------------------------------------
+
+template <typename Key, typename Value,
+          typename Cache = HashLruCache<Key, Value>,
+          typename Hash = MixedHash<Key>>
+class TieredCache {
+public:
+    // diskBytes of disk tier in a file at path; memoryArgs are forwarded
+    // to the memory cache. Without a usable file it is a plain memory
+    // cache, see disk_enabled
+    template <typename... Args>
+    TieredCache(const std::string &path, size_t diskBytes, Args &&...memoryArgs)
+        : _disk(path, diskBytes), _memory(std::forward<Args>(memoryArgs)...) {
+        if (_disk.is_open()) {
+            _memory.set_evictionSink(
+                [this](Key &&key, Value &&value) { _disk.put(key, value); });
+        }
+    }
+
+    TieredCache(const TieredCache &) = delete;
+    TieredCache &operator=(const TieredCache &) = delete;
+
+    // an older copy on disk must not outlive the new value
+    void put(const Key &key, const Value &value) {
+        _memory.put(key, value);
+        _disk.remove(key);
+    }
+
+    bool get(const Key &key, Value &value) {
+        if (_memory.get(key, value)) {
+            return true;
+        }
+        if (!_disk.take(key, value)) {
+            return false;
+        }
+        // a put racing with the promotion keeps its newer value
+        _memory.insert(key, value);
+        return true;
+    }
+
+    Value get(const Key &key) {
+        Value value{};
+        get(key, value);
+        return value;
+    }
+
+    void remove(const Key &key) {
+        _memory.remove(key);
+        _disk.remove(key);
+    }
+
+    bool disk_enabled() const { return _disk.is_open(); }
+
+    Cache &memory() { return _memory; }
+    DiskTier<Key, Value, Hash> &disk() { return _disk; }
+
+private:
+    // the disk tier outlives the memory cache that spills into it
+    DiskTier<Key, Value, Hash> _disk;
+    Cache _memory;
+};
+
+} // namespace MinCache
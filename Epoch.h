@@ -0,0 +1,188 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace MinCache {
+
+//--------------------------------------------------------------------
+// EpochDomain: epoch based reclamation for the lock-free readers of
+// ClockCache. A reader pins the global epoch while it holds pointers
+// into shared structures; memory unlinked by a writer is retired with
+// the epoch of its removal and freed once the epoch has advanced twice,
+// which can only happen after every reader that might still see it has
+// left. One process-wide domain with one record per thread.
+//--------------------------------------------------------------------
+
+class EpochDomain {
+public:
+    static EpochDomain &global() {
+        static EpochDomain domain;
+        return domain;
+    }
+
+    EpochDomain(const EpochDomain &) = delete;
+    EpochDomain &operator=(const EpochDomain &) = delete;
+
+    ~EpochDomain() {
+        for (Retired &retired : _retired) {
+            retired.deleter(retired.pointer);
+        }
+        ThreadRecord *record = _records.load(std::memory_order_acquire);
+        while (record) {
+            ThreadRecord *next = record->next;
+            delete record;
+            record = next;
+        }
+    }
+
+    // pins the current epoch for the lifetime of the guard, guards nest
+    class Guard;
+
+    // frees pointer once no reader can hold it any more; the caller must
+    // have unlinked it before retiring
+    template <typename T> void retire(T *pointer) {
+        retire(pointer, [](void *p) { delete static_cast<T *>(p); });
+    }
+
+    void retire(void *pointer, void (*deleter)(void *)) {
+        std::vector<Retired> freeable;
+        {
+            std::lock_guard<std::mutex> lock(_retiredMutex);
+            _retired.push_back(
+                {pointer, deleter, _epoch.load(std::memory_order_seq_cst)});
+            if (++_retireCount % kCollectInterval != 0) {
+                return;
+            }
+            try_advance();
+            take_freeable(freeable);
+        }
+        for (Retired &retired : freeable) {
+            retired.deleter(retired.pointer);
+        }
+    }
+
+    // number of retired objects not freed yet
+    size_t pending() {
+        std::lock_guard<std::mutex> lock(_retiredMutex);
+        return _retired.size();
+    }
+
+private:
+    static constexpr size_t kCollectInterval = 64;
+
+    struct alignas(64) ThreadRecord {
+        // pinned epoch, 0 while the thread is outside every guard
+        std::atomic<uint64_t> epoch{0};
+        std::atomic<bool> inUse{true};
+        uint32_t depth = 0;
+        ThreadRecord *next = nullptr;
+    };
+
+    struct Retired {
+        void *pointer;
+        void (*deleter)(void *);
+        uint64_t epoch;
+    };
+
+    // hands the record back for reuse when its thread exits
+    struct RecordOwner {
+        ThreadRecord *record = nullptr;
+        ~RecordOwner() {
+            if (record) {
+                record->inUse.store(false, std::memory_order_release);
+            }
+        }
+    };
+
+    EpochDomain() = default;
+
+    ThreadRecord *thread_record() {
+        thread_local RecordOwner owner;
+        if (!owner.record) {
+            owner.record = acquire_record();
+        }
+        return owner.record;
+    }
+
+    // records are never unlinked, a dead thread's record is reused
+    ThreadRecord *acquire_record() {
+        for (ThreadRecord *record = _records.load(std::memory_order_acquire);
+             record; record = record->next) {
+            bool free = false;
+            if (!record->inUse.load(std::memory_order_relaxed) &&
+                record->inUse.compare_exchange_strong(free, true)) {
+                return record;
+            }
+        }
+        ThreadRecord *record = new ThreadRecord;
+        record->next = _records.load(std::memory_order_relaxed);
+        while (!_records.compare_exchange_weak(record->next, record)) {
+        }
+        return record;
+    }
+
+    // the epoch moves on only when every pinned reader has seen it
+    void try_advance() {
+        uint64_t epoch = _epoch.load(std::memory_order_seq_cst);
+        for (ThreadRecord *record = _records.load(std::memory_order_acquire);
+             record; record = record->next) {
+            uint64_t pinned = record->epoch.load(std::memory_order_seq_cst);
+            if (pinned != 0 && pinned != epoch) {
+                return;
+            }
+        }
+        _epoch.compare_exchange_strong(epoch, epoch + 1);
+    }
+
+    void take_freeable(std::vector<Retired> &freeable) {
+        uint64_t epoch = _epoch.load(std::memory_order_seq_cst);
+        auto keep = _retired.begin();
+        for (auto it = _retired.begin(); it != _retired.end(); ++it) {
+            if (it->epoch + 2 <= epoch) {
+                freeable.push_back(*it);
+            } else {
+                *keep++ = *it;
+            }
+        }
+        _retired.erase(keep, _retired.end());
+    }
+
+private:
+    std::atomic<uint64_t> _epoch{1};
+    std::atomic<ThreadRecord *> _records{nullptr};
+    std::mutex _retiredMutex;
+    std::vector<Retired> _retired;
+    uint64_t _retireCount = 0;
+};
+
+class EpochDomain::Guard {
+public:
+    Guard() : _record(EpochDomain::global().thread_record()) {
+        if (_record->depth++ == 0) {
+            // the exchange is a full fence: no shared pointer load below
+            // can be satisfied before the pin is visible
+            _record->epoch.exchange(
+                EpochDomain::global()._epoch.load(std::memory_order_acquire),
+                std::memory_order_seq_cst);
+        }
+    }
+
+    ~Guard() {
+        if (--_record->depth == 0) {
+            _record->epoch.store(0, std::memory_order_release);
+        }
+    }
+
+    Guard(const Guard &) = delete;
+    Guard &operator=(const Guard &) = delete;
+
+private:
+    ThreadRecord *_record;
+};
+
+} // namespace MinCache
@@ -0,0 +1,267 @@
+#pragma once
+
+#include "CacheUtil.h"
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <utility>
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#include <emmintrin.h>
+#define MINCACHE_FLAT_INDEX_SSE2 1
+#endif
+
+namespace MinCache {
+
+//--------------------------------------------------------------------
+// FlatIndex: Swiss-table style open addressing index from a key to the
+// slab slot holding it. Slots store a 32-bit hash fragment and the node
+// index inline, keys stay in the cache's own slab and are only compared
+// when the fragment matches. One control byte per slot (empty, deleted
+// or 7 hash bits) lets a whole group of 16 slots be probed with a few
+// SSE2 instructions, with a portable loop elsewhere.
+//--------------------------------------------------------------------
+
+template <typename Key, typename Hash = std::hash<Key>> class FlatIndex {
+public:
+    static constexpr uint32_t kNotFound = UINT32_MAX;
+    // table bytes per entry at the maximum load factor of 7/8
+    static constexpr size_t kBytesPerEntry = (sizeof(uint64_t) + 1) * 8 / 7;
+
+    explicit FlatIndex(size_t capacity = 0)
+        : _ctrl(nullptr), _slots(nullptr), _groupMask(0), _size(0),
+          _growthLeft(0) {
+        reserve(capacity);
+    }
+
+    FlatIndex(const FlatIndex &) = delete;
+    FlatIndex &operator=(const FlatIndex &) = delete;
+
+    size_t size() const { return _size; }
+    bool empty() const { return _size == 0; }
+
+    // sizes the table so count entries fit without rehashing
+    void reserve(size_t count) {
+        size_t slots = kGroupWidth;
+        while (slots * 7 / 8 < count) {
+            slots <<= 1;
+        }
+        if (!_ctrl || slots > slot_count()) {
+            rehash(slots);
+        }
+    }
+
+    void clear() {
+        std::memset(_ctrl.get(), kEmpty, slot_count());
+        _size = 0;
+        _growthLeft = max_load(slot_count());
+    }
+
+    // keyAt(index) must return the key stored in slab slot index
+    template <typename KeyAt>
+    uint32_t find(const Key &key, const KeyAt &keyAt) const {
+        uint32_t fragment = hash_fragment(key);
+        ProbeSeq seq(fragment, _groupMask);
+        while (true) {
+            const int8_t *group = _ctrl.get() + seq.offset();
+            for (uint32_t match = match_byte(group, h2(fragment)); match;
+                 match &= match - 1) {
+                const Slot &slot =
+                    _slots[seq.offset() + count_trailingZeros(match)];
+                if (slot.fragment == fragment && keyAt(slot.index) == key) {
+                    return slot.index;
+                }
+            }
+            if (match_byte(group, kEmpty)) {
+                return kNotFound;
+            }
+            seq.next();
+        }
+    }
+
+    // the key must not be present yet
+    void insert(const Key &key, uint32_t index) {
+        uint32_t fragment = hash_fragment(key);
+        size_t position = find_freeSlot(fragment);
+        if (_growthLeft == 0 && _ctrl[position] == kEmpty) {
+            // double only when live entries fill the table, otherwise
+            // rehashing in place is enough to reclaim the tombstones
+            size_t slots = slot_count();
+            rehash(_size * 2 >= max_load(slots) ? slots * 2 : slots);
+            position = find_freeSlot(fragment);
+        }
+
+        _growthLeft -= _ctrl[position] == kEmpty ? 1 : 0;
+        set_slot(position, fragment, index);
+        ++_size;
+    }
+
+    // removes the entry of key that maps to index, no key comparison needed
+    bool erase(const Key &key, uint32_t index) {
+        uint32_t fragment = hash_fragment(key);
+        ProbeSeq seq(fragment, _groupMask);
+        while (true) {
+            const int8_t *group = _ctrl.get() + seq.offset();
+            for (uint32_t match = match_byte(group, h2(fragment)); match;
+                 match &= match - 1) {
+                size_t position = seq.offset() + count_trailingZeros(match);
+                if (_slots[position].index == index) {
+                    erase_at(position, group);
+                    return true;
+                }
+            }
+            if (match_byte(group, kEmpty)) {
+                return false;
+            }
+            seq.next();
+        }
+    }
+
+    // calls func(index) for every entry in table order
+    template <typename Func> void for_each(Func &&func) const {
+        for (size_t i = 0; i < slot_count(); ++i) {
+            if (_ctrl[i] >= 0) {
+                func(_slots[i].index);
+            }
+        }
+    }
+
+    size_t memory_usage() const {
+        return slot_count() * (sizeof(Slot) + sizeof(int8_t));
+    }
+
+private:
+    static constexpr size_t kGroupWidth = 16;
+    static constexpr int8_t kEmpty = -128;
+    static constexpr int8_t kDeleted = -2;
+
+    struct Slot {
+        uint32_t fragment;
+        uint32_t index;
+    };
+
+    // triangular probing over groups visits every group once
+    class ProbeSeq {
+    public:
+        ProbeSeq(uint32_t fragment, size_t groupMask)
+            : _group(fragment & groupMask), _mask(groupMask), _step(0) {}
+
+        size_t offset() const { return _group * kGroupWidth; }
+        void next() { _group = (_group + ++_step) & _mask; }
+
+    private:
+        size_t _group;
+        size_t _mask;
+        size_t _step;
+    };
+
+    // the low bits pick the first group, the top 7 bits are the control
+    // byte; both survive a rehash since the fragment is kept in the slot
+    uint32_t hash_fragment(const Key &key) const {
+        uint64_t x = static_cast<uint64_t>(_hasher(key));
+        x ^= x >> 33;
+        x *= 0xff51afd7ed558ccdULL;
+        x ^= x >> 33;
+        x *= 0xc4ceb9fe1a85ec53ULL;
+        x ^= x >> 33;
+        return static_cast<uint32_t>(x);
+    }
+
+    static int8_t h2(uint32_t fragment) {
+        return static_cast<int8_t>(fragment >> 25);
+    }
+
+    static size_t max_load(size_t slots) { return slots * 7 / 8; }
+
+    size_t slot_count() const { return (_groupMask + 1) * kGroupWidth; }
+
+    // bit i is set if group[i] == value
+    static uint32_t match_byte(const int8_t *group, int8_t value) {
+#ifdef MINCACHE_FLAT_INDEX_SSE2
+        __m128i ctrl =
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(group));
+        return static_cast<uint32_t>(
+            _mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(value))));
+#else
+        uint32_t mask = 0;
+        for (size_t i = 0; i < kGroupWidth; ++i) {
+            mask |= static_cast<uint32_t>(group[i] == value) << i;
+        }
+        return mask;
+#endif
+    }
+
+    // bit i is set if group[i] is empty or deleted
+    static uint32_t match_free(const int8_t *group) {
+#ifdef MINCACHE_FLAT_INDEX_SSE2
+        return static_cast<uint32_t>(_mm_movemask_epi8(
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(group))));
+#else
+        uint32_t mask = 0;
+        for (size_t i = 0; i < kGroupWidth; ++i) {
+            mask |= static_cast<uint32_t>(group[i] < 0) << i;
+        }
+        return mask;
+#endif
+    }
+
+    size_t find_freeSlot(uint32_t fragment) const {
+        ProbeSeq seq(fragment, _groupMask);
+        while (true) {
+            uint32_t match = match_free(_ctrl.get() + seq.offset());
+            if (match) {
+                return seq.offset() + count_trailingZeros(match);
+            }
+            seq.next();
+        }
+    }
+
+    void set_slot(size_t position, uint32_t fragment, uint32_t index) {
+        _ctrl[position] = h2(fragment);
+        _slots[position] = {fragment, index};
+    }
+
+    // a group that still has an empty slot never sent a probe onwards,
+    // so the slot can become empty again instead of a tombstone
+    void erase_at(size_t position, const int8_t *group) {
+        if (match_byte(group, kEmpty)) {
+            _ctrl[position] = kEmpty;
+            ++_growthLeft;
+        } else {
+            _ctrl[position] = kDeleted;
+        }
+        --_size;
+    }
+
+    void rehash(size_t slots) {
+        std::unique_ptr<int8_t[]> oldCtrl = std::move(_ctrl);
+        std::unique_ptr<Slot[]> oldSlots = std::move(_slots);
+        size_t oldCount = oldCtrl ? slot_count() : 0;
+
+        _ctrl.reset(new int8_t[slots]);
+        _slots.reset(new Slot[slots]);
+        _groupMask = slots / kGroupWidth - 1;
+        std::memset(_ctrl.get(), kEmpty, slots);
+        _growthLeft = max_load(slots) - _size;
+
+        for (size_t i = 0; i < oldCount; ++i) {
+            if (oldCtrl[i] >= 0) {
+                const Slot &slot = oldSlots[i];
+                set_slot(find_freeSlot(slot.fragment), slot.fragment,
+                         slot.index);
+            }
+        }
+    }
+
+private:
+    std::unique_ptr<int8_t[]> _ctrl;
+    std::unique_ptr<Slot[]> _slots;
+    size_t _groupMask;
+    size_t _size;
+    size_t _growthLeft;
+    Hash _hasher;
+};
+
+} // namespace MinCache
@@ -0,0 +1,309 @@
+#pragma once
+
+#include "CacheUtil.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+namespace MinCache {
+
+//--------------------------------------------------------------------
+// HotKeyReplicas: finds the few keys that alone take more than a
+// slice's fair share of the reads of a sharded cache and serves them
+// from copies in several slices, so one slice lock does not serialise
+// every thread. Reads are sampled into a small space-saving counter
+// table; every window the winners are published in a handful of slots
+// that the read and write paths check by hash.
+//
+// Replicas are filled from the home slice on a replica miss and writers
+// of a hot key drop them. A slot's writer count and generation let a
+// reader detect that a write raced with its fill and undo it, so no
+// replica outlives a write. Replicas are stored with a short ttl because
+// they do not know the expiry of the home entry; the ttl also bounds a
+// stale copy of a key that merely shares the full hash of a hot key.
+//--------------------------------------------------------------------
+
+template <typename Key> class HotKeyReplicas {
+public:
+    static constexpr int kMaxHotKeys = 4;
+    static constexpr std::chrono::milliseconds kReplicaTtl{1000};
+
+    bool enabled() const { return _replicas > 1; }
+
+    // every hot key is kept in up to replicas slices (its home included)
+    void enable(size_t replicas, size_t sliceNum) {
+        std::lock_guard<std::mutex> lock(_trackerMutex);
+        _replicas = std::min(replicas, sliceNum);
+        _stride = _replicas > 1 ? sliceNum / _replicas : 0;
+        _sliceMask = sliceNum - 1;
+    }
+
+    // samples the read, returns the hot slot of hash or -1; slices(i)
+    // must return slice i
+    template <typename Slices>
+    int on_read(const Key &key, size_t hash, Slices &&slices) {
+        thread_local uint32_t reads = 0;
+        if ((++reads & (kSampleInterval - 1)) == 0) {
+            sample(key, hash, slices);
+        }
+        return find(hash);
+    }
+
+    int find(size_t hash) const {
+        if (_hotCount.load(std::memory_order_acquire) == 0 || hash == 0) {
+            return -1;
+        }
+        for (int i = 0; i < kMaxHotKeys; ++i) {
+            if (_slots[i].hash.load(std::memory_order_acquire) == hash) {
+                return i;
+            }
+        }
+        return -1;
+    }
+
+    // reads a hot key from the replica assigned to this thread
+    template <typename Slices, typename Value>
+    bool get(int slot, const Key &key, size_t home, Slices &&slices,
+             Value &value) {
+        size_t replica = thread_replica();
+        if (replica == 0) {
+            return slices(home).get(key, value);
+        }
+        auto &copy = slices(replica_slice(home, replica));
+        if (copy.get(key, value)) {
+            return true;
+        }
+
+        HotSlot &hot = _slots[slot];
+        uint64_t generation = hot.generation.load(std::memory_order_acquire);
+        bool quiet = hot.writers.load(std::memory_order_acquire) == 0;
+        if (!slices(home).get(key, value)) {
+            return false;
+        }
+        if (quiet) {
+            copy.put(key, value, kReplicaTtl);
+            if (hot.generation.load(std::memory_order_acquire) != generation ||
+                hot.writers.load(std::memory_order_acquire) != 0) {
+                copy.remove(key);
+            }
+        }
+        return true;
+    }
+
+    // applies write(homeSlice) and drops the replicas if key is hot; the
+    // second check covers a key that turned hot during the write
+    template <typename Slices, typename Write>
+    void write(const Key &key, size_t hash, size_t home, Slices &&slices,
+               Write &&write) {
+        int slot = find(hash);
+        if (slot < 0) {
+            write(slices(home));
+            slot = find(hash);
+            if (slot >= 0) {
+                drop_replicas(slot, key, home, slices);
+            }
+            return;
+        }
+
+        begin_write(slot);
+        write(slices(home));
+        remove_replicas(key, home, slices);
+        end_write(slot);
+    }
+
+    // batch writers announce their hot keys before writing the home
+    // slices and drop the replicas afterwards
+    int begin_batchWrite(size_t hash) {
+        int slot = find(hash);
+        if (slot >= 0) {
+            begin_write(slot);
+        }
+        return slot;
+    }
+
+    template <typename Slices>
+    void end_batchWrite(int slot, const Key &key, size_t hash, size_t home,
+                        Slices &&slices) {
+        if (slot >= 0) {
+            remove_replicas(key, home, slices);
+            end_write(slot);
+        } else if ((slot = find(hash)) >= 0) {
+            drop_replicas(slot, key, home, slices);
+        }
+    }
+
+    // hashes of the keys currently replicated
+    std::vector<size_t> hot_hashes() const {
+        std::vector<size_t> hashes;
+        for (const HotSlot &hot : _slots) {
+            size_t hash = hot.hash.load(std::memory_order_acquire);
+            if (hash != 0) {
+                hashes.push_back(hash);
+            }
+        }
+        return hashes;
+    }
+
+private:
+    static constexpr uint32_t kSampleInterval = 16;
+    static constexpr uint64_t kWindowSamples = 1024;
+    static constexpr size_t kCandidates = 16;
+
+    struct alignas(64) HotSlot {
+        std::atomic<size_t> hash{0};
+        std::atomic<uint64_t> generation{0};
+        std::atomic<uint32_t> writers{0};
+    };
+
+    struct Candidate {
+        Key key;
+        size_t hash;
+        uint64_t count;
+    };
+
+    // threads are spread over the replicas round robin by first use
+    size_t thread_replica() const {
+        static std::atomic<size_t> nextThread{0};
+        thread_local size_t thread =
+            nextThread.fetch_add(1, std::memory_order_relaxed);
+        return thread % _replicas;
+    }
+
+    size_t replica_slice(size_t home, size_t replica) const {
+        return (home + replica * _stride) & _sliceMask;
+    }
+
+    void begin_write(int slot) {
+        _slots[slot].writers.fetch_add(1, std::memory_order_acq_rel);
+        _slots[slot].generation.fetch_add(1, std::memory_order_acq_rel);
+    }
+
+    void end_write(int slot) {
+        _slots[slot].writers.fetch_sub(1, std::memory_order_acq_rel);
+    }
+
+    template <typename Slices>
+    void remove_replicas(const Key &key, size_t home, Slices &slices) {
+        for (size_t replica = 1; replica < _replicas; ++replica) {
+            slices(replica_slice(home, replica)).remove(key);
+        }
+    }
+
+    template <typename Slices>
+    void drop_replicas(int slot, const Key &key, size_t home, Slices &slices) {
+        begin_write(slot);
+        remove_replicas(key, home, slices);
+        end_write(slot);
+    }
+
+    // space-saving: an unseen key replaces the smallest counter and
+    // inherits its count, so a heavy hitter is never undercounted
+    template <typename Slices>
+    void sample(const Key &key, size_t hash, Slices &slices) {
+        std::unique_lock<std::mutex> lock(_trackerMutex, std::try_to_lock);
+        if (!lock.owns_lock()) {
+            return;
+        }
+
+        auto it = std::find_if(
+            _candidates.begin(), _candidates.end(), [&](const Candidate &c) {
+                return c.hash == hash && c.key == key;
+            });
+        if (it != _candidates.end()) {
+            ++it->count;
+        } else if (_candidates.size() < kCandidates) {
+            _candidates.push_back({key, hash, 1});
+        } else {
+            auto smallest = std::min_element(
+                _candidates.begin(), _candidates.end(),
+                [](const Candidate &a, const Candidate &b) {
+                    return a.count < b.count;
+                });
+            *smallest = {key, hash, smallest->count + 1};
+        }
+
+        if (++_windowSamples == kWindowSamples) {
+            publish(slices);
+            _candidates.clear();
+            _windowSamples = 0;
+        }
+    }
+
+    // a key is hot once it alone draws a slice's fair share of the reads
+    template <typename Slices> void publish(Slices &slices) {
+        std::sort(_candidates.begin(), _candidates.end(),
+                  [](const Candidate &a, const Candidate &b) {
+                      return a.count > b.count;
+                  });
+        size_t sliceNum = _sliceMask + 1;
+        size_t hotNum = 0;
+        while (hotNum < _candidates.size() && hotNum < kMaxHotKeys &&
+               _candidates[hotNum].hash != 0 &&
+               _candidates[hotNum].count * sliceNum >= kWindowSamples) {
+            ++hotNum;
+        }
+
+        auto isHot = [&](size_t hash, const Key &key) {
+            for (size_t i = 0; i < hotNum; ++i) {
+                if (_candidates[i].hash == hash && _candidates[i].key == key) {
+                    return true;
+                }
+            }
+            return false;
+        };
+
+        // demote first so the freed slots can take the new keys; readers
+        // stop routing to the slot before its replicas are dropped
+        for (int i = 0; i < kMaxHotKeys; ++i) {
+            size_t hash = _slots[i].hash.load(std::memory_order_relaxed);
+            if (hash != 0 && !isHot(hash, _hotKeys[i])) {
+                begin_write(i);
+                _slots[i].hash.store(0, std::memory_order_release);
+                _hotCount.fetch_sub(1, std::memory_order_acq_rel);
+                size_t home = slice_of(hash, _sliceMask);
+                remove_replicas(_hotKeys[i], home, slices);
+                end_write(i);
+                _hotKeys[i] = Key();
+            }
+        }
+
+        for (size_t c = 0; c < hotNum; ++c) {
+            const Candidate &candidate = _candidates[c];
+            int freeSlot = -1;
+            bool present = false;
+            for (int i = 0; i < kMaxHotKeys; ++i) {
+                size_t hash = _slots[i].hash.load(std::memory_order_relaxed);
+                if (hash == candidate.hash) {
+                    present = true;
+                } else if (hash == 0 && freeSlot < 0) {
+                    freeSlot = i;
+                }
+            }
+            if (!present && freeSlot >= 0) {
+                _hotKeys[freeSlot] = candidate.key;
+                _slots[freeSlot].hash.store(candidate.hash,
+                                            std::memory_order_release);
+                _hotCount.fetch_add(1, std::memory_order_acq_rel);
+            }
+        }
+    }
+
+private:
+    HotSlot _slots[kMaxHotKeys];
+    std::atomic<int> _hotCount{0};
+    size_t _replicas = 0;
+    size_t _stride = 0;
+    size_t _sliceMask = 0;
+
+    // detection state and the keys of the live slots
+    std::mutex _trackerMutex;
+    std::vector<Candidate> _candidates;
+    uint64_t _windowSamples = 0;
+    Key _hotKeys[kMaxHotKeys];
+};
+
+} // namespace MinCache
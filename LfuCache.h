@@ -1,14 +1,27 @@
-#pragma
+#pragma once
 
+#include "CacheStats.h"
+#include "CacheUtil.h"
+#include "FlatIndex.h"
+#include "HotKeys.h"
+#include "RemovalListener.h"
+#include "SliceBalancer.h"
+#include "Snapshot.h"
 #include "CachePolicy.h"
+#include "TimerWheel.h"
 #include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cmath>
 #include <cstddef>
 #include <cstdint>
+#include <functional>
+#include <future>
 #include <memory>
 #include <mutex>
+#include <string>
 #include <thread>
-#include <unordered_map>
+#include <utility>
 #include <vector>
 
 namespace MinCache {
@@ -18,60 +31,36 @@ template <typename Key, typename Value> class LfuCache; // forward declaration
 // FreqList class: to store nodes with the same access frequency
 //--------------------------------------------------------------joel
 
+// buckets are kept in a doubly linked list ordered by ascending freq, so
+// the minimum frequency is always the first bucket after the dummy one
 template <typename Key, typename Value> class FreqList {
 private:
-    struct Node {
-        int freq;
-        Key key;
-        Value value;
-        std::shared_ptr<Node> pre;
-        std::shared_ptr<Node> next;
-
-        Node() : freq(1), pre(nullptr), next(nullptr) {}
-
-        Node(Key key, Value value)
-            : freq(1), key(key), value(value), pre(nullptr), next(nullptr) {}
-    };
-
-    using NodePtr = std::shared_ptr<Node>;
-    int _freq;
-    NodePtr _head;
-    NodePtr _tail;
+    int64_t _freq;
+    uint32_t _head; // oldest node, evicted first
+    uint32_t _tail;
+    uint32_t _prev;
+    uint32_t _next;
 
 public:
-    explicit FreqList(int n) : _freq(n) {
-        _head = std::make_shared<Node>();
-        _tail = std::make_shared<Node>();
-        _head->next = _tail;
-        _tail->pre = _head;
-    }
-
-    bool is_empty() const { return _head->next == _tail; }
-
-    void add_node(NodePtr node) {
-        if (!node || !_head || !_tail)
-            return;
-
-        node->pre = _tail->pre;
-        node->next = _tail;
-        _tail->pre->next = node;
-        _tail->pre = node;
-    }
-
-    void remove_node(NodePtr node) {
-        if (!node || !_head || !_tail)
-            return;
-        if (!node->pre || !node->next)
-            return;
+    FreqList() : _freq(0), _head(0), _tail(0), _prev(0), _next(0) {}
 
-        node->pre->next = node->next;
-        node->next->pre = node->pre;
+    friend class LfuCache<Key, Value>;
+};
 
-        node->pre = nullptr;
-        node->next = nullptr;
-    }
+template <typename Key, typename Value> class LfuNode {
+private:
+    int64_t _freq;
+    Key _key;
+    Value _value;
+    size_t _weight;
+    uint32_t _pre;
+    uint32_t _next;
+    uint32_t _bucket;
 
-    NodePtr get_firstNode() const { return _head->next; }
+public:
+    LfuNode()
+        : _freq(0), _key(), _value(), _weight(0), _pre(0), _next(0),
+          _bucket(0) {}
 
     friend class LfuCache<Key, Value>;
 };
@@ -83,245 +72,1253 @@ public:
 template <typename Key, typename Value>
 class LfuCache : public CachePolicy<Key, Value> {
 public:
-    using Node = typename FreqList<Key, Value>::Node;
-    using NodePtr = std::shared_ptr<Node>;
-    using NodeMap = std::unordered_map<Key, NodePtr>;
+    using Node = LfuNode<Key, Value>;
+    using Bucket = FreqList<Key, Value>;
+    using NodeIndex = uint32_t;
+    using NodeMap = FlatIndex<Key>;
+    using Weigher = std::function<size_t(const Key &, const Value &)>;
+    using EvictionSink = std::function<void(Key &&, Value &&)>;
+    using ReplicaFilter = std::function<bool(const Key &)>;
+
+    // bytes every entry costs on top of what the weigher reports: its slab
+    // node and its share of the index table
+    static constexpr size_t kEntryOverhead =
+        sizeof(Node) + NodeMap::kBytesPerEntry;
 
     LfuCache(int capacity, int maxAverageNum = 10)
-        : _capacity(capacity), _minFreq(INT8_MAX),
-          _maxAverageNum(maxAverageNum), _curAverAgeNum(0), _curTotalNum(0) {}
+        : _capacity(capacity), _maxAverageNum(maxAverageNum), _freqBase(0),
+          _curTotalNum(0) {
+        initialize();
+    }
 
     ~LfuCache() override = default;
 
-    void put(Key key, Value value) override {
-        if (_capacity <= 0) {
-            return;
-        }
+    void put(const Key &key, const Value &value) override {
+        put_internal(key, value, kDefaultTtl);
+    }
+
+    void put(Key &&key, Value &&value) override {
+        put_internal(std::move(key), std::move(value), kDefaultTtl);
+    }
+
+    // the entry expires ttl after this put, zero means never
+    void put(const Key &key, const Value &value, std::chrono::milliseconds ttl) {
+        put_internal(key, value, ttl);
+    }
+
+    void put(Key &&key, Value &&value, std::chrono::milliseconds ttl) {
+        put_internal(std::move(key), std::move(value), ttl);
+    }
+
+    // builds the value from args, moving it into the slab slot
+    template <typename... Args> void emplace(const Key &key, Args &&...args) {
+        put_internal(key, Value(std::forward<Args>(args)...), kDefaultTtl);
+    }
 
+    // ttl applied by puts that do not pass one, zero disables expiration
+    void set_defaultTtl(std::chrono::milliseconds ttl) {
         std::lock_guard<std::mutex> lock(_mutex);
-        auto it = _nodeMap.find(key);
-        if (it != _nodeMap.end()) {
-            it->second->value = value;
+        _defaultTtl = ttl;
+    }
 
-            get_internal(it->second, value);
-            return;
-        }
+    // switches from an entry count to a byte budget: every entry weighs
+    // kEntryOverhead plus weigher(key, value), and the least frequently
+    // used entries are evicted until the total fits maxWeight
+    void set_weighted(size_t maxWeight, Weigher weigher = nullptr);
 
-        put_internal(key, value);
+    // sum of entry weights, only tracked in weighted mode
+    size_t weighted_size() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _totalWeight;
     }
 
-    bool get(Key key, Value &value) override {
+    // bytes held by the slabs, the map and, in weighted mode, the payload
+    // reported by the weigher
+    size_t memory_usage() {
         std::lock_guard<std::mutex> lock(_mutex);
-        auto it = _nodeMap.find(key);
-        if (it != _nodeMap.end()) {
-            get_internal(it->second, value);
-            return true;
-        }
+        size_t payload =
+            _weighted ? _totalWeight - _nodeMap.size() * kEntryOverhead : 0;
+        return sizeof(*this) + _nodes.capacity() * sizeof(Node) +
+               _buckets.capacity() * sizeof(Bucket) +
+               _nodeMap.memory_usage() + payload;
+    }
 
-        return false;
+    bool get(const Key &key, Value &value) override {
+        return visit(key, [&value](const Value &cached) { value = cached; });
     }
 
-    Value get(Key key) override {
-        Value value;
+    Value get(const Key &key) override {
+        Value value{};
         get(key, value);
         return value;
     }
 
+    // calls func(const Value &) on a hit while the lock is held instead of
+    // copying the value out; func must not call back into the cache
+    template <typename Func> bool visit(const Key &key, Func &&func) {
+        auto lock = _stats.lock(_mutex);
+        uint64_t now = expire_entries();
+        NodeIndex index = find_node(key);
+        if (index == kNullIndex) {
+            _stats.record_miss();
+            check_ghost(key);
+            return false;
+        }
+        if (is_expired(index, now)) {
+            _stats.record_expiration();
+            _stats.record_miss();
+            erase_node(index, RemovalCause::kExpired);
+            return false;
+        }
+
+        _stats.record_hit();
+        touch(index);
+        func(static_cast<const Value &>(_nodes[index]._value));
+        return true;
+    }
+
+    void remove(const Key &key) {
+        auto lock = _stats.lock(_mutex);
+        expire_entries();
+        NodeIndex index = find_node(key);
+        if (index != kNullIndex) {
+            erase_node(index, RemovalCause::kExplicit);
+        }
+    }
+
+    // batch variants used by HashLfuCache: handle keys[order[i]] for
+    // i < count under a single lock acquisition
+    size_t get_batch(const Key *keys, const uint32_t *order, size_t count,
+                     Value *values, bool *found);
+    void put_batch(const Key *keys, const Value *values, const uint32_t *order,
+                   size_t count);
+
     void purge() {
+        std::lock_guard<std::mutex> lock(_mutex);
         _nodeMap.clear();
-        _freqToFreqList.clear();
+        _nodes.clear();
+        _buckets.clear();
+        _freqBase = 0;
+        _curTotalNum = 0;
+        _totalWeight = 0;
+        _timerWheel = TimerWheel();
+        initialize();
+    }
+
+    CacheStatsSnapshot stats() const { return _stats.snapshot(); }
+
+    // entry capacity, shrinking evicts the least frequently used entries
+    // right away; ignored in weighted mode
+    void set_capacity(int capacity);
+
+    int capacity() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _capacity;
+    }
+
+    size_t size() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _nodeMap.size();
+    }
+
+    // remembers the hashes of the last capacity evicted keys so misses on
+    // them count as ghost hits; zero turns tracking off
+    void set_ghostCapacity(size_t capacity) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _ghost.resize(capacity);
+    }
+
+    // evictions and ghost hits since the previous call
+    SlicePressure take_pressure();
+
+    // calls func(key, value, freq, ttl) on every live entry from the
+    // least to the most frequently used while the lock is held; freq is
+    // relative to the aging base and ttl is what is left of the entry's
+    // lifetime, zero if it never expires
+    template <typename Func> void for_each_entry(Func &&func);
+
+    // adds the entry unless the key is cached already, in which case the
+    // cached value wins; returns whether it was added
+    template <typename K, typename V>
+    bool insert(K &&key, V &&value, std::chrono::milliseconds ttl = kDefaultTtl);
+
+    // insert with a frequency taken from for_each_entry; used by snapshot
+    // loading, which restores entries in ascending frequency
+    template <typename K, typename V>
+    void restore(K &&key, V &&value, int64_t freq,
+                 std::chrono::milliseconds ttl);
+
+    // sink receives every entry evicted to make room, moved out of its
+    // slot while the lock is held; it must not call back into the cache
+    void set_evictionSink(EvictionSink sink) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _evictionSink = std::move(sink);
+    }
+
+    // removals are moved into queue under the lock, see
+    // RemovalDispatcher; null turns reporting off
+    void set_removalQueue(RemovalQueue<Key, Value> *queue) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _removalQueue = queue;
+    }
+
+    // filter tells the keys this slice only holds as hot-key replicas of
+    // another slice's entry; their removals are neither passed to the
+    // sink nor queued
+    void set_replicaFilter(ReplicaFilter filter) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _replicaFilter = std::move(filter);
     }
 
 private:
-    void put_internal(Key key, Value value);
-    void get_internal(NodePtr node, Value &value);
-    void kick_out();
-    void remove_from_freqList(NodePtr node);
-    void add_to_freqList(NodePtr node);
+    // slot 0 of both slabs is a dummy, free slots chain through _next
+    static constexpr uint32_t kDummy = 0;
+    static constexpr NodeIndex kNullIndex = NodeMap::kNotFound;
+    // expired entries reclaimed per locked operation
+    static constexpr size_t kExpireBatch = 16;
+
+    void initialize();
+    void check_ghost(const Key &key) {
+        if (_ghost.enabled() && _ghost.contains(std::hash<Key>()(key))) {
+            ++_ghostHits;
+        }
+    }
+    NodeIndex find_node(const Key &key) const {
+        return _nodeMap.find(key, [this](NodeIndex index) -> const Key & {
+            return _nodes[index]._key;
+        });
+    }
+    template <typename K, typename V>
+    void put_internal(K &&key, V &&value, std::chrono::milliseconds ttl);
+    template <typename K, typename V> NodeIndex add_newNode(K &&key, V &&value);
+    template <typename K, typename V>
+    NodeIndex insert_locked(K &&key, V &&value, std::chrono::milliseconds ttl);
+    uint64_t expire_entries();
+    bool is_expired(NodeIndex index, uint64_t now) const {
+        return _expiryEnabled && _timerWheel.is_expired(index, now);
+    }
+    void set_expiry(NodeIndex index, std::chrono::milliseconds ttl);
+    void erase_node(NodeIndex index, RemovalCause cause);
+    void release_node(NodeIndex index, RemovalCause cause);
+    bool is_replica(const Key &key) const {
+        return _replicaFilter && _replicaFilter(key);
+    }
+    void free_node(NodeIndex index);
+    size_t entry_weight(const Key &key, const Value &value) const {
+        return kEntryOverhead + (_weigher ? _weigher(key, value) : 0);
+    }
+    template <typename V> bool update_existing_node(NodeIndex index, V &&value);
+    void get_internal(NodeIndex index, Value &value);
+    void touch(NodeIndex index);
+    void set_freq(NodeIndex index, int64_t freq);
+    NodeIndex kick_out();
+    NodeIndex allocate_node();
+    void remove_from_freqList(NodeIndex index);
+    void add_to_freqList(uint32_t bucket, NodeIndex index);
+    uint32_t add_freqList(int64_t freq, uint32_t prev);
     void add_freqNum();
-    void decrease_freqNum(int num);
+    void decrease_freqNum(int64_t num);
     void handle_over_MaxAverageNum();
-    void update_MinFreq();
 
 private:
     int _capacity;
-    int _minFreq;
     int _maxAverageNum;
-    int _curAverAgeNum;
-    int _curTotalNum;
+    // aging never rewrites nodes: it raises the base that new nodes start
+    // from, so untouched nodes fall behind by maxAverageNum / 2 per epoch
+    int64_t _freqBase;
+    int64_t _curTotalNum;
     std::mutex _mutex;
+    CacheStats _stats;
+    // expiry bookkeeping is skipped until the first entry gets a ttl
+    bool _expiryEnabled = false;
+    std::chrono::milliseconds _defaultTtl{0};
+    TimerWheel _timerWheel;
+    // weighted mode replaces _capacity by _maxWeight
+    bool _weighted = false;
+    size_t _maxWeight = 0;
+    size_t _totalWeight = 0;
+    Weigher _weigher;
+    // pressure reported to HashLfuCache rebalancing
+    GhostFilter _ghost;
+    uint64_t _evictionCount = 0;
+    uint64_t _ghostHits = 0;
+    EvictionSink _evictionSink;
+    RemovalQueue<Key, Value> *_removalQueue = nullptr;
+    ReplicaFilter _replicaFilter;
 
     NodeMap _nodeMap;
-    std::unordered_map<int, FreqList<Key, Value> *> _freqToFreqList;
+    std::vector<Node> _nodes;
+    std::vector<Bucket> _buckets;
+    uint32_t _freeNodes;
+    uint32_t _freeBuckets;
 };
 
-template <typename Key, typename Value> class HashLfuCache {
+template <typename Key, typename Value, typename Hasher = MixedHash<Key>>
+class HashLfuCache {
 public:
-    HashLfuCache(size_t cacpcity, int sliceNum, int maxAverageNum = 10)
-        : _sliceNum(sliceNum > 0 ? sliceNum
-                                 : std::thread::hardware_concurrency()),
-          _capacity(cacpcity) {
+    HashLfuCache(size_t capacity, int sliceNum, int maxAverageNum = 10)
+        : _capacity(capacity),
+          _sliceNum(static_cast<int>(round_upPowerOfTwo(
+              sliceNum > 0 ? sliceNum : std::thread::hardware_concurrency()))),
+          _sliceMask(static_cast<size_t>(_sliceNum) - 1) {
         size_t sliceSize =
             std::ceil(_capacity / static_cast<double>(_sliceNum));
         for (int i = 0; i < _sliceNum; ++i) {
-            _lfuSliceCache.emplace(
-                new LfuCache<Key, Value>(sliceNum, maxAverageNum));
+            _lfuSliceCache.emplace_back(
+                std::make_unique<LfuCache<Key, Value>>(sliceSize,
+                                                       maxAverageNum));
         }
     }
 
-    void put(Key key, Value value) {
-        size_t sliceIndex = Hash(key) % _sliceNum;
-        return _lfuSliceCache[sliceIndex]->put(key, value);
+    void put(const Key &key, const Value &value) {
+        maybe_rebalance();
+        write_key(key, [&](LfuCache<Key, Value> &slice) { slice.put(key, value); });
     }
 
-    void get(Key key, Value &value) {
-        size_t sliceIndex = Hash(key) % _sliceNum;
+    void put(Key &&key, Value &&value) {
+        maybe_rebalance();
+        if (_hotKeys.enabled()) {
+            write_key(key, [&](LfuCache<Key, Value> &slice) { slice.put(key, value); });
+            return;
+        }
+        size_t sliceIndex = slice_index(key);
+        wait_forRoom(sliceIndex);
+        _lfuSliceCache[sliceIndex]->put(std::move(key), std::move(value));
+    }
+
+    void put(const Key &key, const Value &value, std::chrono::milliseconds ttl) {
+        maybe_rebalance();
+        write_key(key, [&](LfuCache<Key, Value> &slice) { slice.put(key, value, ttl); });
+    }
+
+    void put(Key &&key, Value &&value, std::chrono::milliseconds ttl) {
+        maybe_rebalance();
+        if (_hotKeys.enabled()) {
+            write_key(key, [&](LfuCache<Key, Value> &slice) { slice.put(key, value, ttl); });
+            return;
+        }
+        size_t sliceIndex = slice_index(key);
+        wait_forRoom(sliceIndex);
+        _lfuSliceCache[sliceIndex]->put(std::move(key), std::move(value), ttl);
+    }
+
+    template <typename... Args> void emplace(const Key &key, Args &&...args) {
+        maybe_rebalance();
+        write_key(key, [&](LfuCache<Key, Value> &slice) {
+            slice.emplace(key, std::forward<Args>(args)...);
+        });
+    }
+
+    // the byte budget is split evenly between the slices and capacity
+    // rebalancing stops
+    void set_weighted(size_t maxWeight,
+                      typename LfuCache<Key, Value>::Weigher weigher = nullptr) {
+        std::lock_guard<std::mutex> lock(_balanceMutex);
+        _weighted = true;
+        size_t sliceWeight = maxWeight / _sliceNum;
+        for (auto &lfuSliceCache : _lfuSliceCache) {
+            lfuSliceCache->set_weighted(sliceWeight, weigher);
+        }
+    }
+
+    size_t weighted_size() {
+        size_t total = 0;
+        for (auto &lfuSliceCache : _lfuSliceCache) {
+            total += lfuSliceCache->weighted_size();
+        }
+        return total;
+    }
+
+    size_t memory_usage() {
+        size_t total = sizeof(*this);
+        for (auto &lfuSliceCache : _lfuSliceCache) {
+            total += lfuSliceCache->memory_usage();
+        }
+        return total;
+    }
+
+    void set_defaultTtl(std::chrono::milliseconds ttl) {
+        for (auto &lfuSliceCache : _lfuSliceCache) {
+            lfuSliceCache->set_defaultTtl(ttl);
+        }
+    }
+
+    void remove(const Key &key) {
+        write_key(key, [&](LfuCache<Key, Value> &slice) { slice.remove(key); });
+    }
+
+    // adds the entry unless the key is cached already, in which case the
+    // cached value wins; returns whether it was added
+    bool insert(const Key &key, const Value &value) {
+        maybe_rebalance();
+        bool added = false;
+        write_key(key, [&](LfuCache<Key, Value> &slice) {
+            added = slice.insert(key, value);
+        });
+        return added;
+    }
+
+    // every slice hands the entries it evicts to sink, see
+    // LfuCache::set_evictionSink
+    void set_evictionSink(typename LfuCache<Key, Value>::EvictionSink sink) {
+        for (auto &lfuSliceCache : _lfuSliceCache) {
+            lfuSliceCache->set_evictionSink(sink);
+        }
+    }
+
+    // listener gets every entry that leaves the cache, with its cause,
+    // in batches on a dispatcher thread; hot-key replica copies do not.
+    // Slices only move the entry into a queue under their lock.
+    // capacity bounds what is queued over all slices, overflow says
+    // what writers do when their slice's share is full; reads never wait
+    // and under kBlock drop past twice the share. Set it before
+    // the cache is shared; nullptr stops reporting
+    void set_removalListener(
+        typename RemovalDispatcher<Key, Value>::Listener listener,
+        size_t capacity = kDefaultRemovalCapacity,
+        RemovalOverflow overflow = RemovalOverflow::kBlock) {
+        for (auto &slice : _lfuSliceCache) {
+            slice->set_removalQueue(nullptr);
+        }
+        _removals.reset();
+        if (!listener) {
+            return;
+        }
+        _removals = std::make_unique<RemovalDispatcher<Key, Value>>(
+            _lfuSliceCache.size(), capacity, overflow, std::move(listener));
+        for (size_t i = 0; i < _lfuSliceCache.size(); ++i) {
+            _lfuSliceCache[i]->set_removalQueue(&_removals->queue(i));
+        }
+    }
+
+    // removals lost to a full queue, see RemovalOverflow
+    uint64_t dropped_removals() {
+        return _removals ? _removals->dropped() : 0;
+    }
+
+    bool get(const Key &key, Value &value) {
+        maybe_rebalance();
+        size_t hash = _hasher(key);
+        size_t sliceIndex = slice_of(hash, _sliceMask);
+        if (_hotKeys.enabled()) {
+            int slot = _hotKeys.on_read(key, hash, slice_accessor());
+            if (slot >= 0) {
+                return _hotKeys.get(slot, key, sliceIndex, slice_accessor(),
+                                    value);
+            }
+        }
         return _lfuSliceCache[sliceIndex]->get(key, value);
     }
 
-    void get(Key key) {
-        Value value;
+    // hot keys are copied out of their replica before func sees them
+    template <typename Func> bool visit(const Key &key, Func &&func) {
+        maybe_rebalance();
+        size_t hash = _hasher(key);
+        size_t sliceIndex = slice_of(hash, _sliceMask);
+        if (_hotKeys.enabled()) {
+            int slot = _hotKeys.on_read(key, hash, slice_accessor());
+            if (slot >= 0) {
+                Value value{};
+                if (!_hotKeys.get(slot, key, sliceIndex, slice_accessor(),
+                                  value)) {
+                    return false;
+                }
+                func(static_cast<const Value &>(value));
+                return true;
+            }
+        }
+        return _lfuSliceCache[sliceIndex]->visit(key, std::forward<Func>(func));
+    }
+
+    Value get(const Key &key) {
+        Value value{};
         get(key, value);
         return value;
     }
 
+    // totals over all slices; every slice is read without locking
+    CacheStatsSnapshot stats() const {
+        CacheStatsSnapshot total;
+        for (const auto &lfuSliceCache : _lfuSliceCache) {
+            total += lfuSliceCache->stats();
+        }
+        return total;
+    }
+
+    CacheStatsSnapshot slice_stats(size_t sliceIndex) const {
+        return _lfuSliceCache[sliceIndex]->stats();
+    }
+
+    // looks up count keys taking every slice lock at most once, values[i]
+    // and found[i] are filled for keys[i], returns the number of hits
+    size_t multi_get(const Key *keys, size_t count, Value *values,
+                     bool *found) {
+        maybe_rebalance();
+        std::vector<uint32_t> order, offsets;
+        group_keys(keys, count, order, offsets);
+        size_t hits = 0;
+        for (int i = 0; i < _sliceNum; ++i) {
+            if (offsets[i + 1] > offsets[i]) {
+                hits += _lfuSliceCache[i]->get_batch(
+                    keys, order.data() + offsets[i],
+                    offsets[i + 1] - offsets[i], values, found);
+            }
+        }
+        return hits;
+    }
+
+    // hot keys among them are written to their home slice only, their
+    // replicas are dropped once the batch is in
+    void multi_put(const Key *keys, const Value *values, size_t count) {
+        maybe_rebalance();
+        std::vector<uint32_t> order, offsets;
+        group_keys(keys, count, order, offsets);
+        std::vector<int> hotSlots;
+        if (_hotKeys.enabled()) {
+            hotSlots.resize(count);
+            for (size_t i = 0; i < count; ++i) {
+                hotSlots[i] = _hotKeys.begin_batchWrite(_hasher(keys[i]));
+            }
+        }
+        for (int i = 0; i < _sliceNum; ++i) {
+            if (offsets[i + 1] > offsets[i]) {
+                wait_forRoom(i);
+                _lfuSliceCache[i]->put_batch(keys, values,
+                                             order.data() + offsets[i],
+                                             offsets[i + 1] - offsets[i]);
+            }
+        }
+        for (size_t i = 0; i < hotSlots.size(); ++i) {
+            size_t hash = _hasher(keys[i]);
+            _hotKeys.end_batchWrite(hotSlots[i], keys[i], hash,
+                                    slice_of(hash, _sliceMask),
+                                    slice_accessor());
+        }
+    }
+
     void purge() {
         for (auto &lfuSliceCache : _lfuSliceCache) {
             lfuSliceCache->purge();
         }
     }
 
+    // serves each key that alone draws more than a slice's share of the
+    // reads from up to replicas slices; call before the cache is shared
+    void enable_hotKeyReplication(size_t replicas = kHotKeyReplicas) {
+        _hotKeys.enable(replicas, static_cast<size_t>(_sliceNum));
+        for (size_t i = 0; i < _lfuSliceCache.size(); ++i) {
+            _lfuSliceCache[i]->set_replicaFilter(
+                [this, i](const Key &key) { return slice_index(key) != i; });
+        }
+    }
+
+    // hashes of the keys currently replicated
+    std::vector<size_t> hot_keyHashes() const { return _hotKeys.hot_hashes(); }
+
+    // every interval operations of a thread, capacity moves from slices
+    // that gain little from it to slices whose misses keep hitting keys
+    // they evicted recently; call before the cache is shared
+    void enable_rebalancing(size_t interval = kRebalanceInterval) {
+        std::lock_guard<std::mutex> lock(_balanceMutex);
+        for (auto &lfuSliceCache : _lfuSliceCache) {
+            lfuSliceCache->set_ghostCapacity(lfuSliceCache->capacity());
+        }
+        _rebalanceInterval = interval;
+    }
+
+    // one rebalancing round, see enable_rebalancing
+    void rebalance() {
+        std::lock_guard<std::mutex> lock(_balanceMutex);
+        rebalance_locked();
+    }
+
+    // changes the total entry capacity at runtime, every slice keeps its
+    // share of it
+    void set_capacity(size_t capacity) {
+        std::lock_guard<std::mutex> lock(_balanceMutex);
+        std::vector<size_t> current;
+        for (auto &lfuSliceCache : _lfuSliceCache) {
+            current.push_back(lfuSliceCache->capacity());
+        }
+        std::vector<size_t> capacities = scale_capacities(current, capacity);
+        for (int i = 0; i < _sliceNum; ++i) {
+            _lfuSliceCache[i]->set_capacity(static_cast<int>(capacities[i]));
+        }
+        _capacity = capacity;
+    }
+
+    size_t capacity() {
+        std::lock_guard<std::mutex> lock(_balanceMutex);
+        return _capacity;
+    }
+
+    size_t slice_capacity(size_t sliceIndex) {
+        return _lfuSliceCache[sliceIndex]->capacity();
+    }
+
+    // writes every slice to path, least frequently used entries first;
+    // a slice is locked only while its entries are copied into a buffer
+    // and path is replaced only once the whole file is on disk
+    bool save_snapshot(const std::string &path) {
+        SnapshotWriter writer;
+        if (!writer.open(path, SnapshotKind::kLfu, _lfuSliceCache.size())) {
+            return false;
+        }
+        std::string bytes;
+        for (auto &lfuSliceCache : _lfuSliceCache) {
+            bytes.clear();
+            uint64_t entries = 0;
+            lfuSliceCache->for_each_entry([&](const Key &key, const Value &value,
+                                              int64_t freq,
+                                              std::chrono::milliseconds ttl) {
+                SnapshotCodec<Key>::encode(key, bytes);
+                SnapshotCodec<Value>::encode(value, bytes);
+                put_signedVarint(bytes, freq);
+                put_varint(bytes, static_cast<uint64_t>(ttl.count()));
+                ++entries;
+            });
+            if (!writer.write_slice(bytes, entries)) {
+                return false;
+            }
+        }
+        return writer.commit();
+    }
+
+    // save_snapshot on a background thread; the cache must outlive it
+    std::future<bool> save_snapshotAsync(const std::string &path) {
+        return std::async(std::launch::async,
+                          [this, path] { return save_snapshot(path); });
+    }
+
+    // adds the entries of a snapshot, decoding its slices on up to threads
+    // threads (zero: one per hardware thread); keys already cached keep
+    // their value and entries beyond capacity evict the least
+    // frequent ones. Returns false if the file is unusable or a slice is damaged,
+    // the intact slices are loaded either way
+    bool load_snapshot(const std::string &path, size_t threads = 0) {
+        SnapshotReader reader;
+        if (!reader.open(path, SnapshotKind::kLfu)) {
+            return false;
+        }
+        std::atomic<bool> intact{true};
+        parallel_for(reader.slice_count(), threads, [&](size_t i) {
+            SnapshotSliceView view;
+            if (!reader.slice(i, view)) {
+                intact = false;
+                return;
+            }
+            const char *p = view.data;
+            const char *end = view.data + view.bytes;
+            for (uint64_t n = 0; n < view.entries; ++n) {
+                Key key{};
+                Value value{};
+                int64_t freq;
+                uint64_t ttl;
+                if (!SnapshotCodec<Key>::decode(p, end, key) ||
+                    !SnapshotCodec<Value>::decode(p, end, value) ||
+                    !get_signedVarint(p, end, freq) ||
+                    !get_varint(p, end, ttl)) {
+                    intact = false;
+                    return;
+                }
+                _lfuSliceCache[slice_index(key)]->restore(
+                    std::move(key), std::move(value), freq,
+                    std::chrono::milliseconds(ttl));
+            }
+        });
+        return intact;
+    }
+
 private:
-    size_t Hash(Key key) {
-        std::hash<Key> hashFunc;
-        return hashFunc(key);
+    static constexpr size_t kRebalanceInterval = 1 << 16;
+    static constexpr size_t kHotKeyReplicas = 4;
+
+    void maybe_rebalance() {
+        if (_rebalanceInterval == 0) {
+            return;
+        }
+        thread_local size_t operations = 0;
+        if (++operations % _rebalanceInterval == 0 && _balanceMutex.try_lock()) {
+            std::lock_guard<std::mutex> lock(_balanceMutex, std::adopt_lock);
+            rebalance_locked();
+        }
+    }
+
+    void rebalance_locked() {
+        if (_weighted) {
+            return;
+        }
+
+        std::vector<SlicePressure> pressures;
+        for (auto &lfuSliceCache : _lfuSliceCache) {
+            pressures.push_back(lfuSliceCache->take_pressure());
+        }
+        // no slice shrinks below a quarter of an even split
+        size_t minCapacity = std::max<size_t>(_capacity / _sliceNum / 4, 1);
+        std::vector<size_t> capacities =
+            rebalance_capacities(pressures, minCapacity);
+        for (int i = 0; i < _sliceNum; ++i) {
+            if (capacities[i] != pressures[i].capacity) {
+                _lfuSliceCache[i]->set_capacity(static_cast<int>(capacities[i]));
+            }
+        }
+    }
+
+    size_t slice_index(const Key &key) const {
+        return slice_of(_hasher(key), _sliceMask);
+    }
+
+    auto slice_accessor() {
+        return [this](size_t sliceIndex) -> LfuCache<Key, Value> & {
+            return *_lfuSliceCache[sliceIndex];
+        };
+    }
+
+    // applies write to the home slice of key, keeping hot-key replicas
+    // consistent when replication is on
+    template <typename Write> void write_key(const Key &key, Write &&write) {
+        size_t hash = _hasher(key);
+        size_t sliceIndex = slice_of(hash, _sliceMask);
+        wait_forRoom(sliceIndex);
+        if (!_hotKeys.enabled()) {
+            write(*_lfuSliceCache[sliceIndex]);
+            return;
+        }
+        _hotKeys.write(key, hash, sliceIndex, slice_accessor(),
+                       std::forward<Write>(write));
+    }
+
+    // holds a writer back while the removal queue of its slice is full,
+    // see RemovalOverflow::kBlock
+    void wait_forRoom(size_t sliceIndex) {
+        if (_removals) {
+            _removals->queue(sliceIndex).wait_forRoom();
+        }
+    }
+
+    void group_keys(const Key *keys, size_t count, std::vector<uint32_t> &order,
+                    std::vector<uint32_t> &offsets) {
+        std::vector<uint32_t> slices(count);
+        for (size_t i = 0; i < count; ++i) {
+            slices[i] = static_cast<uint32_t>(slice_index(keys[i]));
+        }
+        group_bySlice(slices, _sliceNum, order, offsets);
     }
 
 private:
     size_t _capacity;
     int _sliceNum;
+    size_t _sliceMask;
+    Hasher _hasher;
+    HotKeyReplicas<Key> _hotKeys;
+    // guards _capacity, _weighted and the slice capacities as a whole
+    std::mutex _balanceMutex;
+    bool _weighted = false;
+    size_t _rebalanceInterval = 0;
     std::vector<std::unique_ptr<LfuCache<Key, Value>>> _lfuSliceCache;
+    // destroyed before the slices, so queued removals are delivered
+    // while the listener can still use the cache
+    std::unique_ptr<RemovalDispatcher<Key, Value>> _removals;
 };
 
+template <typename Key, typename Value> void LfuCache<Key, Value>::initialize() {
+    size_t slots = _capacity > 0 ? static_cast<size_t>(_capacity) : 0;
+    _nodes.reserve(slots + 1);
+    _nodes.emplace_back();
+    _buckets.emplace_back();
+    _freeNodes = kDummy;
+    _freeBuckets = kDummy;
+    _nodeMap.reserve(slots);
+}
+
 template <typename Key, typename Value>
-void LfuCache<Key, Value>::get_internal(NodePtr node, Value &value) {
-    value = node->value;
-    remove_from_freqList(node);
-    node->freq++;
-    add_to_freqList(node);
-    if (node->freq - 1 == _minFreq &&
-        _freqToFreqList[node->freq - 1]->is_empty())
-        _minFreq++;
+void LfuCache<Key, Value>::get_internal(NodeIndex index, Value &value) {
+    value = _nodes[index]._value;
+    touch(index);
+}
 
-    add_freqNum();
+template <typename Key, typename Value>
+size_t LfuCache<Key, Value>::get_batch(const Key *keys, const uint32_t *order,
+                                       size_t count, Value *values,
+                                       bool *found) {
+    std::vector<NodeIndex> indices(count);
+    auto lock = _stats.lock(_mutex);
+    uint64_t now = expire_entries();
+
+    // probe every key first and prefetch the nodes before touching them
+    for (size_t i = 0; i < count; ++i) {
+        indices[i] = find_node(keys[order[i]]);
+        if (indices[i] != kNullIndex && is_expired(indices[i], now)) {
+            _stats.record_expiration();
+            erase_node(indices[i], RemovalCause::kExpired);
+            indices[i] = kNullIndex;
+        }
+        if (indices[i] != kNullIndex) {
+            prefetch_read(&_nodes[indices[i]]);
+        }
+    }
+
+    size_t hits = 0;
+    for (size_t i = 0; i < count; ++i) {
+        found[order[i]] = indices[i] != kNullIndex;
+        if (found[order[i]]) {
+            _stats.record_hit();
+            get_internal(indices[i], values[order[i]]);
+            ++hits;
+        } else {
+            _stats.record_miss();
+            check_ghost(keys[order[i]]);
+        }
+    }
+    return hits;
+}
+
+template <typename Key, typename Value>
+void LfuCache<Key, Value>::put_batch(const Key *keys, const Value *values,
+                                     const uint32_t *order, size_t count) {
+    auto lock = _stats.lock(_mutex);
+    expire_entries();
+    for (size_t i = 0; i < count; ++i) {
+        const Key &key = keys[order[i]];
+        NodeIndex index = find_node(key);
+        if (index != kNullIndex) {
+            if (update_existing_node(index, values[order[i]])) {
+                set_expiry(index, kDefaultTtl);
+            }
+        } else if (NodeIndex index = add_newNode(key, values[order[i]]);
+                   index != kDummy) {
+            set_expiry(index, kDefaultTtl);
+        }
+    }
 }
 
+// move the node to the bucket of freq + 1, which is either the next bucket
+// or a new one created right after the current
 template <typename Key, typename Value>
-void LfuCache<Key, Value>::put_internal(Key key, Value value) {
-    if (_nodeMap.size() == _capacity) {
-        kick_out();
+void LfuCache<Key, Value>::touch(NodeIndex index) {
+    Node &node = _nodes[index];
+    uint32_t bucket = node._bucket;
+    uint32_t next = _buckets[bucket]._next;
+    if (next == kDummy || _buckets[next]._freq != node._freq + 1) {
+        next = add_freqList(node._freq + 1, bucket);
     }
 
-    NodePtr node = std::make_shared<Node>(key, value);
-    _nodeMap[key] = node;
-    add_to_freqList(node);
+    remove_from_freqList(index);
+    node._freq++;
+    add_to_freqList(next, index);
     add_freqNum();
-    _minFreq = std::min(_minFreq, 1);
 }
 
-template <typename Key, typename Value> void LfuCache<Key, Value>::kick_out() {
-    NodePtr node = _freqToFreqList[_minFreq]->get_firstNode();
-    remove_from_freqList(node);
-    _nodeMap.erase(node->key);
-    decrease_freqNum(node->freq);
+// move the node to the bucket of freq; the search starts from the highest
+// bucket since restored nodes arrive in ascending frequency
+template <typename Key, typename Value>
+void LfuCache<Key, Value>::set_freq(NodeIndex index, int64_t freq) {
+    Node &node = _nodes[index];
+    if (node._freq == freq) {
+        return;
+    }
+
+    remove_from_freqList(index);
+    uint32_t prev = _buckets[kDummy]._prev;
+    while (prev != kDummy && _buckets[prev]._freq > freq) {
+        prev = _buckets[prev]._prev;
+    }
+    uint32_t bucket = prev != kDummy && _buckets[prev]._freq == freq
+                          ? prev
+                          : add_freqList(freq, prev);
+    _curTotalNum += freq - node._freq;
+    node._freq = freq;
+    add_to_freqList(bucket, index);
 }
 
 template <typename Key, typename Value>
-void LfuCache<Key, Value>::remove_from_freqList(NodePtr node) {
-    if (!node) {
+template <typename K, typename V>
+void LfuCache<Key, Value>::put_internal(K &&key, V &&value,
+                                        std::chrono::milliseconds ttl) {
+    auto lock = _stats.lock(_mutex);
+    expire_entries();
+    NodeIndex index = find_node(key);
+    if (index != kNullIndex) {
+        if (update_existing_node(index, std::forward<V>(value))) {
+            set_expiry(index, ttl);
+        }
         return;
     }
 
-    auto freq = node->freq;
-    _freqToFreqList[freq]->remove_node(node);
+    index = add_newNode(std::forward<K>(key), std::forward<V>(value));
+    if (index != kDummy) {
+        set_expiry(index, ttl);
+    }
 }
 
 template <typename Key, typename Value>
-void LfuCache<Key, Value>::add_to_freqList(NodePtr node) {
-    if (!node) {
-        return;
+void LfuCache<Key, Value>::set_weighted(size_t maxWeight, Weigher weigher) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _weighted = true;
+    _maxWeight = maxWeight;
+    _weigher = std::move(weigher);
+
+    _totalWeight = 0;
+    _nodeMap.for_each([this](NodeIndex index) {
+        Node &node = _nodes[index];
+        node._weight = entry_weight(node._key, node._value);
+        _totalWeight += node._weight;
+    });
+    while (_totalWeight > _maxWeight) {
+        free_node(kick_out());
     }
+}
 
-    auto freq = node->freq;
-    if (_freqToFreqList.find(node->freq) == _freqToFreqList.end()) {
-        _freqToFreqList[node->freq] = new FreqList<Key, Value>(node->freq);
+template <typename Key, typename Value>
+void LfuCache<Key, Value>::set_capacity(int capacity) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _capacity = capacity;
+    while (!_weighted && _nodeMap.size() > static_cast<size_t>(std::max(capacity, 0))) {
+        free_node(kick_out());
     }
+}
 
-    _freqToFreqList[freq]->add_node(node);
+template <typename Key, typename Value>
+SlicePressure LfuCache<Key, Value>::take_pressure() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    SlicePressure pressure;
+    pressure.evictions = _evictionCount;
+    pressure.ghostHits = _ghostHits;
+    pressure.size = _nodeMap.size();
+    pressure.capacity = static_cast<size_t>(std::max(_capacity, 0));
+    _evictionCount = 0;
+    _ghostHits = 0;
+    return pressure;
 }
 
 template <typename Key, typename Value>
-void LfuCache<Key, Value>::add_freqNum() {
-    _curTotalNum++;
+template <typename Func>
+void LfuCache<Key, Value>::for_each_entry(Func &&func) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    uint64_t now = _expiryEnabled ? _timerWheel.now_tick() : 0;
+    for (uint32_t bucket = _buckets[kDummy]._next; bucket != kDummy;
+         bucket = _buckets[bucket]._next) {
+        for (NodeIndex index = _buckets[bucket]._head; index != kDummy;
+             index = _nodes[index]._next) {
+            std::chrono::milliseconds ttl{0};
+            if (_expiryEnabled && _timerWheel.is_scheduled(index)) {
+                uint64_t expireTick = _timerWheel.expire_tick(index);
+                if (expireTick <= now) {
+                    continue;
+                }
+                ttl = std::chrono::milliseconds(expireTick - now);
+            }
+            const Node &node = _nodes[index];
+            func(node._key, node._value, node._freq - _freqBase, ttl);
+        }
+    }
+}
 
-    if (_nodeMap.empty()) {
-        _curAverAgeNum = 0;
+template <typename Key, typename Value>
+template <typename K, typename V>
+bool LfuCache<Key, Value>::insert(K &&key, V &&value,
+                                  std::chrono::milliseconds ttl) {
+    auto lock = _stats.lock(_mutex);
+    return insert_locked(std::forward<K>(key), std::forward<V>(value), ttl) !=
+           kDummy;
+}
 
-    } else {
-        _curAverAgeNum = _curTotalNum / _nodeMap.size();
+template <typename Key, typename Value>
+template <typename K, typename V>
+void LfuCache<Key, Value>::restore(K &&key, V &&value, int64_t freq,
+                                   std::chrono::milliseconds ttl) {
+    auto lock = _stats.lock(_mutex);
+    NodeIndex index =
+        insert_locked(std::forward<K>(key), std::forward<V>(value), ttl);
+    if (index != kDummy) {
+        set_freq(index, _freqBase + freq);
     }
+}
 
-    if (_curAverAgeNum > _maxAverageNum) {
-        handle_over_MaxAverageNum();
+// the new node's index, or kDummy if the key was cached already or the
+// entry did not fit
+template <typename Key, typename Value>
+template <typename K, typename V>
+typename LfuCache<Key, Value>::NodeIndex
+LfuCache<Key, Value>::insert_locked(K &&key, V &&value,
+                                    std::chrono::milliseconds ttl) {
+    expire_entries();
+    if (find_node(key) != kNullIndex) {
+        return kDummy;
+    }
+    NodeIndex index = add_newNode(std::forward<K>(key), std::forward<V>(value));
+    if (index != kDummy) {
+        set_expiry(index, ttl);
     }
+    return index;
 }
 
+// returns false if the entry did not survive the update: its new value
+// alone exceeds the budget, or it was the victim of making room for it
 template <typename Key, typename Value>
-void LfuCache<Key, Value>::decrease_freqNum(int num) {
-    _curTotalNum -= num;
-    if (_nodeMap.empty()) {
-        _curTotalNum = 0;
+template <typename V>
+bool LfuCache<Key, Value>::update_existing_node(NodeIndex index, V &&value) {
+    if (_weighted) {
+        size_t weight = entry_weight(_nodes[index]._key, value);
+        if (weight > _maxWeight) {
+            erase_node(index, RemovalCause::kReplaced);
+            return false;
+        }
+        _totalWeight += weight - _nodes[index]._weight;
+        _nodes[index]._weight = weight;
+    }
+
+    _stats.record_update();
+    if (_removalQueue && !is_replica(_nodes[index]._key)) {
+        _removalQueue->push(Key(_nodes[index]._key),
+                            std::move(_nodes[index]._value),
+                            RemovalCause::kReplaced);
+    }
+    _nodes[index]._value = std::forward<V>(value);
+    touch(index);
+    bool present = true;
+    while (_weighted && _totalWeight > _maxWeight) {
+        NodeIndex victim = kick_out();
+        present = present && victim != index;
+        free_node(victim);
+    }
+    return present;
+}
+
+// reclaims up to kExpireBatch expired entries, returns the current tick
+template <typename Key, typename Value>
+uint64_t LfuCache<Key, Value>::expire_entries() {
+    if (!_expiryEnabled) {
+        return 0;
+    }
+
+    uint64_t now = _timerWheel.now_tick();
+    _timerWheel.advance(now, kExpireBatch, [this](NodeIndex index) {
+        _stats.record_expiration();
+        erase_node(index, RemovalCause::kExpired);
+    });
+    return now;
+}
+
+template <typename Key, typename Value>
+void LfuCache<Key, Value>::set_expiry(NodeIndex index,
+                                      std::chrono::milliseconds ttl) {
+    if (ttl == kDefaultTtl) {
+        ttl = _defaultTtl;
+    }
+    if (ttl.count() > 0) {
+        _expiryEnabled = true;
+        _timerWheel.schedule(index, _timerWheel.tick_after(ttl));
     } else {
-        _curAverAgeNum = _curTotalNum / _nodeMap.size();
+        _timerWheel.cancel(index);
     }
 }
 
 template <typename Key, typename Value>
-void LfuCache<Key, Value>::handle_over_MaxAverageNum() {
-    if (_nodeMap.empty()) {
+void LfuCache<Key, Value>::erase_node(NodeIndex index, RemovalCause cause) {
+    remove_from_freqList(index);
+    _nodeMap.erase(_nodes[index]._key, index);
+    decrease_freqNum(_nodes[index]._freq);
+    _timerWheel.cancel(index);
+    _totalWeight -= _nodes[index]._weight;
+    release_node(index, cause);
+    free_node(index);
+}
+
+// hands a node that leaves the cache to the removal queue and, if it was
+// evicted, to the eviction sink; both take its key and value by move.
+// Hot-key replicas go unreported, their home entry is still cached
+template <typename Key, typename Value>
+void LfuCache<Key, Value>::release_node(NodeIndex index, RemovalCause cause) {
+    Node &node = _nodes[index];
+    if ((!_removalQueue && !_evictionSink) || is_replica(node._key)) {
         return;
     }
+    bool sink = cause == RemovalCause::kEvicted && _evictionSink;
+    if (_removalQueue) {
+        if (sink) {
+            _removalQueue->push(Key(node._key), Value(node._value), cause);
+        } else {
+            _removalQueue->push(std::move(node._key), std::move(node._value),
+                                cause);
+        }
+    }
+    if (sink) {
+        _evictionSink(std::move(node._key), std::move(node._value));
+    }
+}
 
-    for (auto it = _nodeMap.begin(); it != _nodeMap.end(); it++) {
-        if (!it->second)
-            continue;
-        NodePtr node = it->second;
+template <typename Key, typename Value>
+void LfuCache<Key, Value>::free_node(NodeIndex index) {
+    Node &node = _nodes[index];
+    node._key = Key();
+    node._value = Value();
+    node._next = _freeNodes;
+    _freeNodes = index;
+}
 
-        remove_from_freqList(node);
+template <typename Key, typename Value>
+template <typename K, typename V>
+typename LfuCache<Key, Value>::NodeIndex
+LfuCache<Key, Value>::add_newNode(K &&key, V &&value) {
+    NodeIndex index;
+    size_t weight = 0;
+    if (_weighted) {
+        weight = entry_weight(key, value);
+        if (weight > _maxWeight) {
+            return kDummy;
+        }
+        while (_totalWeight + weight > _maxWeight) {
+            free_node(kick_out());
+        }
+        index = allocate_node();
+    } else if (_capacity <= 0) {
+        return kDummy;
+    } else {
+        index = _nodeMap.size() >= static_cast<size_t>(_capacity)
+                    ? kick_out()
+                    : allocate_node();
+    }
 
-        node->freq -= _maxAverageNum / 2;
-        if (node->freq < 1)
-            node->freq = 1;
+    // new nodes start at the aging base, or share the lowest bucket when
+    // untouched nodes have already fallen below it
+    int64_t freq = _freqBase + 1;
+    uint32_t bucket = _buckets[kDummy]._next;
+    if (bucket != kDummy && _buckets[bucket]._freq <= freq) {
+        freq = _buckets[bucket]._freq;
+    } else {
+        bucket = add_freqList(freq, kDummy);
+    }
 
-        add_to_freqList(node);
+    Node &node = _nodes[index];
+    node._key = std::forward<K>(key);
+    node._value = std::forward<V>(value);
+    node._freq = freq;
+    node._weight = weight;
+    _totalWeight += weight;
+    _nodeMap.insert(node._key, index);
+    add_to_freqList(bucket, index);
+    _curTotalNum += freq - 1;
+    add_freqNum();
+    _stats.record_insert();
+    return index;
+}
+
+template <typename Key, typename Value>
+typename LfuCache<Key, Value>::NodeIndex LfuCache<Key, Value>::kick_out() {
+    NodeIndex index = _buckets[_buckets[kDummy]._next]._head;
+    _stats.record_eviction();
+    ++_evictionCount;
+    if (_ghost.enabled()) {
+        _ghost.add(std::hash<Key>()(_nodes[index]._key));
+    }
+    remove_from_freqList(index);
+    _nodeMap.erase(_nodes[index]._key, index);
+    decrease_freqNum(_nodes[index]._freq);
+    _timerWheel.cancel(index);
+    _totalWeight -= _nodes[index]._weight;
+    release_node(index, RemovalCause::kEvicted);
+    return index;
+}
+
+template <typename Key, typename Value>
+typename LfuCache<Key, Value>::NodeIndex LfuCache<Key, Value>::allocate_node() {
+    if (_freeNodes != kDummy) {
+        NodeIndex index = _freeNodes;
+        _freeNodes = _nodes[index]._next;
+        return index;
     }
 
-    update_MinFreq();
+    _nodes.emplace_back();
+    return static_cast<NodeIndex>(_nodes.size() - 1);
 }
 
+// unlink the node from its bucket, an emptied bucket goes to the free list
 template <typename Key, typename Value>
-void LfuCache<Key, Value>::update_MinFreq() {
-    _minFreq = INT8_MAX;
+void LfuCache<Key, Value>::remove_from_freqList(NodeIndex index) {
+    Node &node = _nodes[index];
+    Bucket &bucket = _buckets[node._bucket];
+    if (node._pre == kDummy) {
+        bucket._head = node._next;
+    } else {
+        _nodes[node._pre]._next = node._next;
+    }
+    if (node._next == kDummy) {
+        bucket._tail = node._pre;
+    } else {
+        _nodes[node._next]._pre = node._pre;
+    }
 
-    for (const auto &pair : _freqToFreqList) {
-        if (pair.second && !pair.second->is_empty()) {
-            _minFreq = std::min(_minFreq, pair.first);
-        }
+    if (bucket._head == kDummy) {
+        _buckets[bucket._prev]._next = bucket._next;
+        _buckets[bucket._next]._prev = bucket._prev;
+        bucket._next = _freeBuckets;
+        _freeBuckets = node._bucket;
+    }
+}
+
+template <typename Key, typename Value>
+void LfuCache<Key, Value>::add_to_freqList(uint32_t bucket, NodeIndex index) {
+    Node &node = _nodes[index];
+    Bucket &list = _buckets[bucket];
+    node._bucket = bucket;
+    node._pre = list._tail;
+    node._next = kDummy;
+    if (list._tail == kDummy) {
+        list._head = index;
+    } else {
+        _nodes[list._tail]._next = index;
     }
+    list._tail = index;
+}
 
-    if (_minFreq == INT8_MAX) {
-        _minFreq = 1;
+// create an empty bucket for freq and link it after prev
+template <typename Key, typename Value>
+uint32_t LfuCache<Key, Value>::add_freqList(int64_t freq, uint32_t prev) {
+    uint32_t bucket;
+    if (_freeBuckets != kDummy) {
+        bucket = _freeBuckets;
+        _freeBuckets = _buckets[bucket]._next;
+    } else {
+        _buckets.emplace_back();
+        bucket = static_cast<uint32_t>(_buckets.size() - 1);
     }
+
+    Bucket &list = _buckets[bucket];
+    list._freq = freq;
+    list._head = kDummy;
+    list._tail = kDummy;
+    list._prev = prev;
+    list._next = _buckets[prev]._next;
+    _buckets[list._next]._prev = bucket;
+    _buckets[prev]._next = bucket;
+    return bucket;
+}
+
+template <typename Key, typename Value>
+void LfuCache<Key, Value>::add_freqNum() {
+    _curTotalNum++;
+
+    if (!_nodeMap.empty() &&
+        _curTotalNum / static_cast<int64_t>(_nodeMap.size()) - _freqBase >
+            _maxAverageNum) {
+        handle_over_MaxAverageNum();
+    }
+}
+
+template <typename Key, typename Value>
+void LfuCache<Key, Value>::decrease_freqNum(int64_t num) {
+    _curTotalNum -= num;
+    if (_nodeMap.empty()) {
+        _curTotalNum = 0;
+    }
+}
+
+// O(1) aging: every node is now worth maxAverageNum / 2 accesses less
+// relative to the new base, nothing is rebucketed
+template <typename Key, typename Value>
+void LfuCache<Key, Value>::handle_over_MaxAverageNum() {
+    _freqBase += std::max(_maxAverageNum / 2, 1);
 }
 
 } // namespace MinCache
@@ -0,0 +1,269 @@
+#pragma once
+
+#include "LfuCache.h"
+#include "LruCache.h"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+namespace MinCache {
+
+//--------------------------------------------------------------------
+// LoadingCache: get_or_load on top of HashLruCache / HashLfuCache.
+// Concurrent misses on one key share a single loader call, and hot
+// entries can be reloaded ahead of time by a small worker pool. A load
+// or refresh only stores its result if no put or invalidate of the key
+// came in while it ran.
+//--------------------------------------------------------------------
+
+template <typename Key, typename Value,
+          template <typename...> class Cache = HashLruCache>
+class LoadingCache {
+public:
+    using Loader = std::function<Value(const Key &)>;
+    using Clock = std::chrono::steady_clock;
+
+    struct Entry {
+        Value value{};
+        Clock::time_point loadedAt{};
+    };
+
+    // arguments are forwarded to the underlying cache
+    template <typename... Args>
+    explicit LoadingCache(Args &&...args)
+        : _cache(std::forward<Args>(args)...), _stop(false) {}
+
+    ~LoadingCache() {
+        {
+            std::lock_guard<std::mutex> lock(_refreshMutex);
+            _stop = true;
+        }
+        _refreshCond.notify_all();
+        for (std::thread &worker : _workers) {
+            worker.join();
+        }
+    }
+
+    LoadingCache(const LoadingCache &) = delete;
+    LoadingCache &operator=(const LoadingCache &) = delete;
+
+    // returns the cached value, or loads it; callers missing the same key
+    // at the same time wait for one loader call and share its result or
+    // its exception
+    Value get_or_load(const Key &key, const Loader &loader) {
+        Value value{};
+        if (lookup(key, value)) {
+            return value;
+        }
+
+        std::promise<Value> promise;
+        std::shared_future<Value> future;
+        {
+            FlightStripe &stripe = stripe_of(key);
+            std::lock_guard<std::mutex> lock(stripe.mutex);
+            auto it = stripe.inFlight.find(key);
+            if (it != stripe.inFlight.end()) {
+                future = it->second.future;
+            } else {
+                stripe.inFlight.emplace(key,
+                                        Flight{promise.get_future().share()});
+            }
+        }
+        if (future.valid()) {
+            return future.get();
+        }
+
+        // a load that finished between the miss and registering this one
+        // has already filled the cache
+        if (lookup(key, value)) {
+            finish_flight(key);
+            promise.set_value(value);
+            return value;
+        }
+
+        try {
+            value = loader(key);
+        } catch (...) {
+            finish_flight(key);
+            promise.set_exception(std::current_exception());
+            throw;
+        }
+        finish_flight(key, &value);
+        promise.set_value(value);
+        return value;
+    }
+
+    // hits on entries loaded more than refreshAfter ago queue a background
+    // reload with loader; readers keep getting the old value meanwhile.
+    // Must be called before the cache is shared between threads.
+    void enable_refresh(std::chrono::milliseconds refreshAfter, Loader loader,
+                        size_t workerNum = 2) {
+        std::lock_guard<std::mutex> lock(_refreshMutex);
+        if (!_workers.empty()) {
+            return;
+        }
+
+        _refreshAfter = refreshAfter;
+        _refreshLoader = std::move(loader);
+        for (size_t i = 0; i < std::max<size_t>(workerNum, 1); ++i) {
+            _workers.emplace_back([this] { refresh_loop(); });
+        }
+    }
+
+    void put(const Key &key, const Value &value) {
+        FlightStripe &stripe = stripe_of(key);
+        std::lock_guard<std::mutex> lock(stripe.mutex);
+        mark_stale(stripe, key);
+        _cache.put(key, Entry{value, Clock::now()});
+    }
+
+    void invalidate(const Key &key) {
+        FlightStripe &stripe = stripe_of(key);
+        std::lock_guard<std::mutex> lock(stripe.mutex);
+        mark_stale(stripe, key);
+        _cache.remove(key);
+    }
+
+    Cache<Key, Entry> &cache() { return _cache; }
+
+private:
+    // drop pending refreshes rather than grow the queue without bound
+    static constexpr size_t kMaxPendingRefresh = 1024;
+    static constexpr size_t kFlightStripes = 64;
+
+    struct Flight {
+        std::shared_future<Value> future;
+        // set by put and invalidate, the load's result is then dropped
+        bool stale = false;
+    };
+
+    struct Refresh {
+        Key key;
+        // the refreshed value only replaces this version of the entry
+        Clock::time_point loadedAt;
+    };
+
+    // loads in flight and the writes that may overtake them, striped by
+    // key so writers of different keys do not serialise
+    struct alignas(64) FlightStripe {
+        std::mutex mutex;
+        std::unordered_map<Key, Flight> inFlight;
+    };
+
+    FlightStripe &stripe_of(const Key &key) {
+        return _flights[slice_of(MixedHash<Key>()(key), kFlightStripes - 1)];
+    }
+
+    bool lookup(const Key &key, Value &value) {
+        Clock::time_point loadedAt;
+        bool found = _cache.visit(key, [&](const Entry &entry) {
+            value = entry.value;
+            loadedAt = entry.loadedAt;
+        });
+        if (found && _refreshLoader &&
+            Clock::now() - loadedAt >= _refreshAfter) {
+            schedule_refresh(key, loadedAt);
+        }
+        return found;
+    }
+
+    // caller holds stripe.mutex
+    void mark_stale(FlightStripe &stripe, const Key &key) {
+        auto it = stripe.inFlight.find(key);
+        if (it != stripe.inFlight.end()) {
+            it->second.stale = true;
+        }
+    }
+
+    // stores value, if given, unless the flight went stale meanwhile
+    void finish_flight(const Key &key, const Value *value = nullptr) {
+        FlightStripe &stripe = stripe_of(key);
+        std::lock_guard<std::mutex> lock(stripe.mutex);
+        auto it = stripe.inFlight.find(key);
+        if (value && !it->second.stale) {
+            _cache.put(key, Entry{*value, Clock::now()});
+        }
+        stripe.inFlight.erase(it);
+    }
+
+    void schedule_refresh(const Key &key, Clock::time_point loadedAt) {
+        {
+            std::lock_guard<std::mutex> lock(_refreshMutex);
+            if (_refreshQueue.size() >= kMaxPendingRefresh ||
+                !_refreshing.insert(key).second) {
+                return;
+            }
+            _refreshQueue.push_back(Refresh{key, loadedAt});
+        }
+        _refreshCond.notify_one();
+    }
+
+    // a refresh racing with put or invalidate loses: the entry must still
+    // be the one whose age queued it. put and invalidate hold the key's
+    // stripe around their write, so the check and store are atomic with
+    // respect to them
+    void store_refresh(const Refresh &refresh, const Value &value) {
+        std::lock_guard<std::mutex> lock(stripe_of(refresh.key).mutex);
+        bool current = false;
+        _cache.visit(refresh.key, [&](const Entry &entry) {
+            current = entry.loadedAt == refresh.loadedAt;
+        });
+        if (current) {
+            _cache.put(refresh.key, Entry{value, Clock::now()});
+        }
+    }
+
+    void refresh_loop() {
+        while (true) {
+            Refresh refresh;
+            {
+                std::unique_lock<std::mutex> lock(_refreshMutex);
+                _refreshCond.wait(
+                    lock, [this] { return _stop || !_refreshQueue.empty(); });
+                if (_stop) {
+                    return;
+                }
+                refresh = std::move(_refreshQueue.front());
+                _refreshQueue.pop_front();
+            }
+
+            // a failed refresh keeps serving the old value
+            try {
+                store_refresh(refresh, _refreshLoader(refresh.key));
+            } catch (...) {
+            }
+
+            std::lock_guard<std::mutex> lock(_refreshMutex);
+            _refreshing.erase(refresh.key);
+        }
+    }
+
+private:
+    Cache<Key, Entry> _cache;
+
+    // also held by put and invalidate, see Flight::stale
+    FlightStripe _flights[kFlightStripes];
+
+    // refresh settings are written once, before any concurrent use
+    std::chrono::milliseconds _refreshAfter{0};
+    Loader _refreshLoader;
+    std::mutex _refreshMutex;
+    std::condition_variable _refreshCond;
+    std::deque<Refresh> _refreshQueue;
+    std::unordered_set<Key> _refreshing;
+    std::vector<std::thread> _workers;
+    bool _stop;
+};
+
+} // namespace MinCache
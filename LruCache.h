@@ -1,13 +1,30 @@
-#pragma
+#pragma once
 
+#include "CacheStats.h"
+#include "CacheUtil.h"
+#include "FlatIndex.h"
+#include "HotKeys.h"
+#include "MissRatioCurve.h"
 #include "CachePolicy.h"
+#include "ReadBuffer.h"
+#include "RemovalListener.h"
+#include "SliceBalancer.h"
+#include "Snapshot.h"
+#include "TimerWheel.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cmath>
 #include <cstddef>
+#include <cstdint>
 #include <functional>
+#include <future>
 #include <memory>
 #include <mutex>
+#include <shared_mutex>
+#include <string>
 #include <thread>
-#include <unordered_map>
+#include <utility>
 #include <vector>
 
 namespace MinCache {
@@ -15,21 +32,26 @@ namespace MinCache {
 template <typename Key, typename Value> class LruCache; // forward declaration
 template <typename Key, typename Value>
 
+// nodes live in the LruCache slab and are linked by slot index
 class LruNode {
 private:
     Key _key;
     Value _value;
     size_t _accessCount;
-    std::shared_ptr<LruNode<Key, Value>> _prev;
-    std::shared_ptr<LruNode<Key, Value>> _next;
+    size_t _weight;
+    uint32_t _prev;
+    uint32_t _next;
 
 public:
+    LruNode()
+        : _key(), _value(), _accessCount(0), _weight(0), _prev(0), _next(0) {}
+
     LruNode(Key key, Value value)
-        : _key(key), _value(value), _accessCount(1), _prev(nullptr),
-          _next(nullptr) {}
+        : _key(key), _value(value), _accessCount(1), _weight(0), _prev(0),
+          _next(0) {}
 
-    Key get_key() const { return _key; }
-    Value get_value() const { return _value; }
+    const Key &get_key() const { return _key; }
+    const Value &get_value() const { return _value; }
     void set_value(const Value &value) { _value = value; }
     size_t get_accessCount() const { return _accessCount; }
     void increment_accessCount() { ++_accessCount; }
@@ -41,196 +63,1594 @@ template <typename Key, typename Value>
 class LruCache : public CachePolicy<Key, Value> {
 public:
     using LruNodeType = LruNode<Key, Value>;
-    using NodePtr = std::shared_ptr<LruNodeType>;
-    using NodeMap = std::unordered_map<Key, NodePtr>;
+    using NodeIndex = uint32_t;
+    using NodeMap = FlatIndex<Key>;
+    using Weigher = std::function<size_t(const Key &, const Value &)>;
+    using EvictionSink = std::function<void(Key &&, Value &&)>;
+    using ReplicaFilter = std::function<bool(const Key &)>;
 
-    LruCache(int capacity) : _capacity(capacity) { initialize_list(); }
+    // bytes every entry costs on top of what the weigher reports: its slab
+    // node and its share of the index table
+    static constexpr size_t kEntryOverhead =
+        sizeof(LruNodeType) + NodeMap::kBytesPerEntry;
 
-    void put(Key key, Value value) override {
-        std::lock_guard<std::mutex> lock(_mutex);
-        auto it = _nodeMap.find(key);
-        if (it != _nodeMap.end()) {
-            update_existing_node(it->second, value);
-            return;
-        }
-        add_newNode(key, value);
+    // with bufferedReads hits only take a shared lock and record the
+    // access in a read buffer that is replayed by the next exclusive holder
+    LruCache(int capacity, bool bufferedReads = false)
+        : _capacity(capacity), _bufferedReads(bufferedReads) {
+        initialize_list();
+    }
+
+    void put(const Key &key, const Value &value) override {
+        put_internal(key, value, kDefaultTtl);
+    }
+
+    void put(Key &&key, Value &&value) override {
+        put_internal(std::move(key), std::move(value), kDefaultTtl);
+    }
+
+    // the entry expires ttl after this put, zero means never
+    void put(const Key &key, const Value &value, std::chrono::milliseconds ttl) {
+        put_internal(key, value, ttl);
+    }
+
+    void put(Key &&key, Value &&value, std::chrono::milliseconds ttl) {
+        put_internal(std::move(key), std::move(value), ttl);
+    }
+
+    // builds the value from args, moving it into the slab slot
+    template <typename... Args> void emplace(const Key &key, Args &&...args) {
+        put_internal(key, Value(std::forward<Args>(args)...), kDefaultTtl);
+    }
+
+    // ttl applied by puts that do not pass one, zero disables expiration
+    void set_defaultTtl(std::chrono::milliseconds ttl) {
+        std::lock_guard<std::shared_mutex> lock(_mutex);
+        _defaultTtl = ttl;
+    }
+
+    // switches from an entry count to a byte budget: every entry weighs
+    // kEntryOverhead plus weigher(key, value), and the least recently used
+    // entries are evicted until the total fits maxWeight
+    void set_weighted(size_t maxWeight, Weigher weigher = nullptr);
+
+    // sum of entry weights, only tracked in weighted mode
+    size_t weighted_size() {
+        std::shared_lock<std::shared_mutex> lock(_mutex);
+        return _totalWeight;
+    }
+
+    // bytes held by the slab, the map and, in weighted mode, the payload
+    // reported by the weigher
+    size_t memory_usage() {
+        std::shared_lock<std::shared_mutex> lock(_mutex);
+        size_t payload =
+            _weighted ? _totalWeight - _nodeMap.size() * kEntryOverhead : 0;
+        return sizeof(*this) + _nodes.capacity() * sizeof(LruNodeType) +
+               _nodeMap.memory_usage() + payload;
     }
 
     // value is passed by reference to return the value
-    bool get(Key key, Value &value) override {
-        std::lock_guard<std::mutex> lock(_mutex);
-        auto it = _nodeMap.find(key);
-        if (it != _nodeMap.end()) {
-            move_to_recent(it->second);
-            value = it->second->get_value();
-            return true;
-        }
-        return false;
+    bool get(const Key &key, Value &value) override {
+        return visit(key, [&value](const Value &cached) { value = cached; });
     }
 
-    Value get(Key key) override {
+    Value get(const Key &key) override {
         Value value{};
         get(key, value);
         return value;
     }
 
-    void remove(Key key) {
-        std::lock_guard<std::mutex> lock(_mutex);
-        auto it = _nodeMap.find(key);
-        if (it != _nodeMap.end()) {
-            remove_node(it->second);
-            _nodeMap.erase(it);
+    // calls func(const Value &) on a hit while the slice lock is held, so
+    // large values can be read without copying them out; func must not
+    // call back into the cache
+    template <typename Func> bool visit(const Key &key, Func &&func) {
+        if (_bufferedReads) {
+            return visit_buffered(key, func);
         }
+
+        auto lock = _stats.lock(_mutex);
+        uint64_t now = expire_entries();
+        NodeIndex index = find_node(key);
+        if (index == kNullIndex) {
+            _stats.record_miss();
+            check_ghost(key);
+            return false;
+        }
+        if (is_expired(index, now)) {
+            _stats.record_expiration();
+            _stats.record_miss();
+            erase_node(index, RemovalCause::kExpired);
+            return false;
+        }
+
+        _stats.record_hit();
+        move_to_recent(index);
+        func(static_cast<const Value &>(_nodes[index]._value));
+        return true;
+    }
+
+    // batch variants used by HashLruCache: handle keys[order[i]] for
+    // i < count under a single lock acquisition
+    size_t get_batch(const Key *keys, const uint32_t *order, size_t count,
+                     Value *values, bool *found);
+    void put_batch(const Key *keys, const Value *values, const uint32_t *order,
+                   size_t count);
+
+    void remove(const Key &key) {
+        auto lock = _stats.lock(_mutex);
+        drain_readBuffer();
+        expire_entries();
+        NodeIndex index = find_node(key);
+        if (index != kNullIndex) {
+            erase_node(index, RemovalCause::kExplicit);
+        }
+    }
+
+    CacheStatsSnapshot stats() const { return _stats.snapshot(); }
+
+    // entry capacity, shrinking evicts the least recently used entries
+    // right away; ignored in weighted mode
+    void set_capacity(int capacity);
+
+    int capacity() {
+        std::shared_lock<std::shared_mutex> lock(_mutex);
+        return _capacity;
+    }
+
+    size_t size() {
+        std::shared_lock<std::shared_mutex> lock(_mutex);
+        return _nodeMap.size();
+    }
+
+    // remembers the hashes of the last capacity evicted keys so misses on
+    // them count as ghost hits; zero turns tracking off
+    void set_ghostCapacity(size_t capacity) {
+        std::lock_guard<std::shared_mutex> lock(_mutex);
+        _ghost.resize(capacity);
+    }
+
+    // evictions and ghost hits since the previous call
+    SlicePressure take_pressure();
+
+    // calls func(key, value, ttl) on every live entry from the least to
+    // the most recently used while the lock is held; ttl is what is left
+    // of the entry's lifetime, zero if it never expires
+    template <typename Func> void for_each_entry(Func &&func);
+
+    // adds the entry as the most recently used one unless the key is
+    // cached already, in which case the cached value wins; returns
+    // whether it was added
+    template <typename K, typename V>
+    bool insert(K &&key, V &&value, std::chrono::milliseconds ttl = kDefaultTtl);
+
+    // sink receives every entry evicted to make room, moved out of its
+    // slot while the lock is held; it must not call back into the cache
+    void set_evictionSink(EvictionSink sink) {
+        std::lock_guard<std::shared_mutex> lock(_mutex);
+        _evictionSink = std::move(sink);
+    }
+
+    // removals are moved into queue under the lock, see
+    // RemovalDispatcher; null turns reporting off
+    void set_removalQueue(RemovalQueue<Key, Value> *queue) {
+        std::lock_guard<std::shared_mutex> lock(_mutex);
+        _removalQueue = queue;
+    }
+
+    // filter tells the keys this slice only holds as hot-key replicas of
+    // another slice's entry; their removals are neither passed to the
+    // sink nor queued
+    void set_replicaFilter(ReplicaFilter filter) {
+        std::lock_guard<std::shared_mutex> lock(_mutex);
+        _replicaFilter = std::move(filter);
     }
 
 private:
+    // slot 0 and 1 of the slab are the dummy head and tail
+    static constexpr NodeIndex kDummyHead = 0;
+    static constexpr NodeIndex kDummyTail = 1;
+    static constexpr NodeIndex kNullIndex = NodeMap::kNotFound;
+    // expired entries reclaimed per locked operation
+    static constexpr size_t kExpireBatch = 16;
+
     void initialize_list();
-    void update_existing_node(NodePtr node, const Value &value);
-    void add_newNode(const Key &key, const Value &value);
-    void move_to_recent(NodePtr node);
-    void remove_node(NodePtr node);
-    void insert_node(NodePtr node);
-    void evict_node();
+    void check_ghost(const Key &key) {
+        if (_ghost.enabled() && _ghost.contains(std::hash<Key>()(key))) {
+            _ghostHits.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    NodeIndex find_node(const Key &key) const {
+        return _nodeMap.find(key, [this](NodeIndex index) -> const Key & {
+            return _nodes[index]._key;
+        });
+    }
+    template <typename K, typename V>
+    void put_internal(K &&key, V &&value, std::chrono::milliseconds ttl);
+    uint64_t expire_entries();
+    bool is_expired(NodeIndex index, uint64_t now) const {
+        return _expiryEnabled && _timerWheel.is_expired(index, now);
+    }
+    void set_expiry(NodeIndex index, std::chrono::milliseconds ttl);
+    void erase_node(NodeIndex index, RemovalCause cause);
+    void release_node(NodeIndex index, RemovalCause cause);
+    bool is_replica(const Key &key) const {
+        return _replicaFilter && _replicaFilter(key);
+    }
+    template <typename Func> bool visit_buffered(const Key &key, Func &func);
+    void drain_readBuffer();
+    size_t entry_weight(const Key &key, const Value &value) const {
+        return kEntryOverhead + (_weigher ? _weigher(key, value) : 0);
+    }
+    template <typename V> bool update_existing_node(NodeIndex index, V &&value);
+    template <typename K, typename V> NodeIndex add_newNode(K &&key, V &&value);
+    void move_to_recent(NodeIndex index);
+    void remove_node(NodeIndex index);
+    void insert_node(NodeIndex index);
+    NodeIndex evict_node();
+    NodeIndex allocate_node();
+    void free_node(NodeIndex index);
 
 private:
     int _capacity;
+    bool _bufferedReads;
     NodeMap _nodeMap;
-    std::mutex _mutex;
-    NodePtr _dummyHead;
-    NodePtr _dummyTail;
+    std::shared_mutex _mutex;
+    CacheStats _stats;
+    ReadBuffer<> _readBuffer;
+    // expiry bookkeeping is skipped until the first entry gets a ttl
+    bool _expiryEnabled = false;
+    std::chrono::milliseconds _defaultTtl{0};
+    TimerWheel _timerWheel;
+    // weighted mode replaces _capacity by _maxWeight
+    bool _weighted = false;
+    size_t _maxWeight = 0;
+    size_t _totalWeight = 0;
+    Weigher _weigher;
+    // pressure reported to HashLruCache rebalancing; ghost hits are also
+    // counted by buffered reads under the shared lock
+    GhostFilter _ghost;
+    uint64_t _evictionCount = 0;
+    std::atomic<uint64_t> _ghostHits{0};
+    EvictionSink _evictionSink;
+    RemovalQueue<Key, Value> *_removalQueue = nullptr;
+    ReplicaFilter _replicaFilter;
+    // preallocated node slab, free slots are chained through _next
+    std::vector<LruNodeType> _nodes;
+    NodeIndex _freeList;
 };
 
-// Lru-k
+template <typename Key, typename Value> class LruKCache; // forward declaration
+
+// one slab slot per tracked key: resident entries carry a value and sit in
+// the eviction heap, history-only entries sit in the history list
+template <typename Key, typename Value> class LruKNode {
+private:
+    Key _key;
+    Value _value;
+    uint32_t _refs;    // accesses recorded, saturates at k
+    uint32_t _ring;    // next slot of the access time ring
+    uint32_t _prev;    // history list links, free slots chain via _next
+    uint32_t _next;
+    uint32_t _heapPos; // position in the eviction heap, or kNullIndex
+
+public:
+    LruKNode()
+        : _key(), _value(), _refs(0), _ring(0), _prev(0), _next(0),
+          _heapPos(UINT32_MAX) {}
+
+    friend class LruKCache<Key, Value>;
+};
+
+//--------------------------------------------------------------------
+// LRU-K: a key becomes resident once it has been accessed k times, and
+// the resident entry whose k-th most recent access is oldest (largest
+// backward k-distance) is evicted first. History and resident entries
+// share one slab, one index and one lock; the last k access times of
+// every slot live in a flat ring array next to the slab.
+//--------------------------------------------------------------------
+
 template <typename Key, typename Value>
-class LruKCache : public LruCache<Key, Value> {
+class LruKCache : public CachePolicy<Key, Value> {
 public:
+    using Node = LruKNode<Key, Value>;
+    using NodeIndex = uint32_t;
+    using NodeMap = FlatIndex<Key>;
+
+    // historyCapacity bounds the keys remembered without being resident
     LruKCache(int capacity, int historyCapacity, int k)
-        : LruCache<Key, Value>(capacity),
-          _historyList(
-              std::make_unique<LruCache<Key, size_t>>(historyCapacity)),
-          _k(k) {}
+        : _capacity(std::max(capacity, 0)),
+          _historyCapacity(std::max(historyCapacity, 0)),
+          _k(static_cast<uint32_t>(std::max(k, 1))), _clock(0),
+          _historySize(0), _freeList(kNullIndex) {
+        initialize();
+    }
 
-    Value get(Key key) {
-        int histroyCount = _historyList->get(key);
-        _historyList->put(key, ++histroyCount);
+    ~LruKCache() override = default;
+
+    void put(const Key &key, const Value &value) override {
+        put_internal(key, value);
+    }
+
+    void put(Key &&key, Value &&value) override {
+        put_internal(std::move(key), std::move(value));
+    }
+
+    bool get(const Key &key, Value &value) override {
+        return visit(key, [&value](const Value &cached) { value = cached; });
+    }
 
-        return LruCache<Key, Value>::get(key);
+    Value get(const Key &key) override {
+        Value value{};
+        get(key, value);
+        return value;
     }
 
-    void put(Key key, Value value) {
-        if (LruCache<Key, Value>::get(key) != "")
-            LruCache<Key, Value>::put(key, value);
+    // calls func(const Value &) on a hit while the lock is held; a miss
+    // still counts as an access towards admission
+    template <typename Func> bool visit(const Key &key, Func &&func) {
+        auto lock = _stats.lock(_mutex);
+        NodeIndex index = find_node(key);
+        if (index == kNullIndex) {
+            _stats.record_miss();
+            add_history(key);
+            return false;
+        }
 
-        int histroyCount = _historyList->get(key);
-        _historyList->put(key, ++histroyCount);
+        record_access(index);
+        if (!is_resident(index)) {
+            _stats.record_miss();
+            move_to_recent(index);
+            return false;
+        }
+
+        _stats.record_hit();
+        update_heap(index);
+        func(static_cast<const Value &>(_nodes[index]._value));
+        return true;
+    }
 
-        if (histroyCount >= _k) {
-            _historyList->remove(key);
-            LruCache<Key, Value>::put(key, value);
+    // forgets the key entirely, including its access history
+    void remove(const Key &key) {
+        auto lock = _stats.lock(_mutex);
+        NodeIndex index = find_node(key);
+        if (index == kNullIndex) {
+            return;
+        }
+        if (is_resident(index)) {
+            heap_remove(_nodes[index]._heapPos);
+        } else {
+            remove_node(index);
         }
+        _nodeMap.erase(_nodes[index]._key, index);
+        free_node(index);
+    }
+
+    size_t size() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _heap.size();
     }
 
+    CacheStatsSnapshot stats() const { return _stats.snapshot(); }
+
 private:
-    int _k;
-    std::unique_ptr<LruCache<Key, size_t>> _historyList;
-};
+    // slot 0 is the dummy head of the circular history list
+    static constexpr NodeIndex kHistoryHead = 0;
+    static constexpr NodeIndex kNullIndex = NodeMap::kNotFound;
 
-template <typename Key, typename Value>
+    // the k-th access time is kept inline so sifting never reads the slab
+    struct HeapEntry {
+        uint64_t time;
+        NodeIndex index;
+    };
+
+    void initialize();
+    NodeIndex find_node(const Key &key) const {
+        return _nodeMap.find(key, [this](NodeIndex index) -> const Key & {
+            return _nodes[index]._key;
+        });
+    }
+    bool is_resident(NodeIndex index) const {
+        return _nodes[index]._heapPos != kNullIndex;
+    }
+    template <typename K, typename V> void put_internal(K &&key, V &&value);
+    template <typename K> NodeIndex create_node(K &&key);
+    template <typename K> NodeIndex add_history(K &&key);
+    template <typename V> void admit(NodeIndex index, V &&value);
+    void record_access(NodeIndex index);
+    uint64_t kth_accessTime(NodeIndex index) const;
+    void evict();
+    void trim_history(size_t limit);
+    void move_to_recent(NodeIndex index);
+    void remove_node(NodeIndex index);
+    void insert_node(NodeIndex index);
+    NodeIndex allocate_node();
+    void free_node(NodeIndex index);
+    void heap_push(NodeIndex index);
+    void update_heap(NodeIndex index);
+    void heap_remove(uint32_t pos);
+    void sift_up(uint32_t pos);
+    void sift_down(uint32_t pos);
+    void heap_set(uint32_t pos, const HeapEntry &entry) {
+        _heap[pos] = entry;
+        _nodes[entry.index]._heapPos = pos;
+    }
+
+private:
+    size_t _capacity;
+    size_t _historyCapacity;
+    uint32_t _k;
+    uint64_t _clock; // logical time, one tick per access
+    size_t _historySize;
+    std::mutex _mutex;
+    CacheStats _stats;
+    NodeMap _nodeMap;
+    std::vector<Node> _nodes;
+    // access time ring of slot i is _accessTimes[i * k, (i + 1) * k)
+    std::vector<uint64_t> _accessTimes;
+    // min-heap of resident slots ordered by their k-th most recent access
+    std::vector<HeapEntry> _heap;
+    NodeIndex _freeList;
+};
 
+template <typename Key, typename Value, typename Hasher = MixedHash<Key>>
 class HashLruCache {
 public:
-    HashLruCache(size_t capacity, int sliceNum)
+    HashLruCache(size_t capacity, int sliceNum, bool bufferedReads = false)
         : _capacity(capacity),
-          _sliceNum(sliceNum > 0 ? sliceNum
-                                 : std::thread::hardware_concurrency()) {
+          _sliceNum(static_cast<int>(round_upPowerOfTwo(
+              sliceNum > 0 ? sliceNum : std::thread::hardware_concurrency()))),
+          _sliceMask(static_cast<size_t>(_sliceNum) - 1) {
         size_t sliceSize = std::ceil(capacity / static_cast<double>(_sliceNum));
         for (int i = 0; i < _sliceNum; ++i) {
             _lruSliceCaches.emplace_back(
-                std::make_unique<LruCache<Key, Value>>(sliceSize));
+                std::make_unique<LruCache<Key, Value>>(sliceSize, bufferedReads));
         }
     }
 
-    void put(Key key, Value value) {
-        size_t sliceIndex = Hash(key) % _sliceNum;
-        return _lruSliceCaches[sliceIndex]->put(key, value);
+    void put(const Key &key, const Value &value) {
+        maybe_rebalance();
+        write_key(key, [&](LruCache<Key, Value> &slice) { slice.put(key, value); });
     }
 
-    bool get(Key key, Value &value) {
-        size_t sliceIndex = Hash(key) % _sliceNum;
+    void put(Key &&key, Value &&value) {
+        maybe_rebalance();
+        if (_hotKeys.enabled()) {
+            write_key(key, [&](LruCache<Key, Value> &slice) { slice.put(key, value); });
+            return;
+        }
+        size_t hash = _hasher(key);
+        sample_access(hash, false);
+        size_t sliceIndex = slice_of(hash, _sliceMask);
+        wait_forRoom(sliceIndex);
+        _lruSliceCaches[sliceIndex]->put(std::move(key), std::move(value));
+    }
+
+    void put(const Key &key, const Value &value, std::chrono::milliseconds ttl) {
+        maybe_rebalance();
+        write_key(key, [&](LruCache<Key, Value> &slice) { slice.put(key, value, ttl); });
+    }
+
+    void put(Key &&key, Value &&value, std::chrono::milliseconds ttl) {
+        maybe_rebalance();
+        if (_hotKeys.enabled()) {
+            write_key(key, [&](LruCache<Key, Value> &slice) { slice.put(key, value, ttl); });
+            return;
+        }
+        size_t hash = _hasher(key);
+        sample_access(hash, false);
+        size_t sliceIndex = slice_of(hash, _sliceMask);
+        wait_forRoom(sliceIndex);
+        _lruSliceCaches[sliceIndex]->put(std::move(key), std::move(value), ttl);
+    }
+
+    template <typename... Args> void emplace(const Key &key, Args &&...args) {
+        maybe_rebalance();
+        write_key(key, [&](LruCache<Key, Value> &slice) {
+            slice.emplace(key, std::forward<Args>(args)...);
+        });
+    }
+
+    // the byte budget is split evenly between the slices and capacity
+    // rebalancing stops
+    void set_weighted(size_t maxWeight,
+                      typename LruCache<Key, Value>::Weigher weigher = nullptr) {
+        std::lock_guard<std::mutex> lock(_balanceMutex);
+        _weighted = true;
+        size_t sliceWeight = maxWeight / _sliceNum;
+        for (auto &lruSliceCache : _lruSliceCaches) {
+            lruSliceCache->set_weighted(sliceWeight, weigher);
+        }
+    }
+
+    size_t weighted_size() {
+        size_t total = 0;
+        for (auto &lruSliceCache : _lruSliceCaches) {
+            total += lruSliceCache->weighted_size();
+        }
+        return total;
+    }
+
+    size_t memory_usage() {
+        size_t total = sizeof(*this);
+        for (auto &lruSliceCache : _lruSliceCaches) {
+            total += lruSliceCache->memory_usage();
+        }
+        return total;
+    }
+
+    void set_defaultTtl(std::chrono::milliseconds ttl) {
+        for (auto &lruSliceCache : _lruSliceCaches) {
+            lruSliceCache->set_defaultTtl(ttl);
+        }
+    }
+
+    void remove(const Key &key) {
+        write_key(key, [&](LruCache<Key, Value> &slice) { slice.remove(key); });
+        if (_missRatio) {
+            _missRatio->forget(_hasher(key));
+        }
+    }
+
+    // adds the entry unless the key is cached already, in which case the
+    // cached value wins; returns whether it was added
+    bool insert(const Key &key, const Value &value) {
+        maybe_rebalance();
+        bool added = false;
+        write_key(key, [&](LruCache<Key, Value> &slice) {
+            added = slice.insert(key, value);
+        });
+        return added;
+    }
+
+    // every slice hands the entries it evicts to sink, see
+    // LruCache::set_evictionSink
+    void set_evictionSink(typename LruCache<Key, Value>::EvictionSink sink) {
+        for (auto &lruSliceCache : _lruSliceCaches) {
+            lruSliceCache->set_evictionSink(sink);
+        }
+    }
+
+    // listener gets every entry that leaves the cache, with its cause,
+    // in batches on a dispatcher thread; hot-key replica copies do not.
+    // Slices only move the entry into a queue under their lock.
+    // capacity bounds what is queued over all slices, overflow says
+    // what writers do when their slice's share is full; reads never wait
+    // and under kBlock drop past twice the share. Set it before
+    // the cache is shared; nullptr stops reporting
+    void set_removalListener(
+        typename RemovalDispatcher<Key, Value>::Listener listener,
+        size_t capacity = kDefaultRemovalCapacity,
+        RemovalOverflow overflow = RemovalOverflow::kBlock) {
+        for (auto &slice : _lruSliceCaches) {
+            slice->set_removalQueue(nullptr);
+        }
+        _removals.reset();
+        if (!listener) {
+            return;
+        }
+        _removals = std::make_unique<RemovalDispatcher<Key, Value>>(
+            _lruSliceCaches.size(), capacity, overflow, std::move(listener));
+        for (size_t i = 0; i < _lruSliceCaches.size(); ++i) {
+            _lruSliceCaches[i]->set_removalQueue(&_removals->queue(i));
+        }
+    }
+
+    // removals lost to a full queue, see RemovalOverflow
+    uint64_t dropped_removals() {
+        return _removals ? _removals->dropped() : 0;
+    }
+
+    // samples accesses into a MissRatioEstimator so miss_ratio_curve can
+    // tell how the cache would do at other sizes, up to maxCapacity (four
+    // times the current capacity by default). Lookups are what the curve
+    // counts; writes and removals keep the sampled LRU stack in step.
+    // Call it before the cache is shared
+    void enable_missRatioCurve(
+        size_t maxCapacity = 0,
+        double sampleRate = MissRatioEstimator::kDefaultSampleRate,
+        size_t maxSamples = MissRatioEstimator::kDefaultMaxSamples) {
+        if (maxCapacity == 0) {
+            maxCapacity = 4 * capacity();
+        }
+        _missRatio = std::make_unique<MissRatioEstimator>(
+            maxCapacity, sampleRate, maxSamples);
+    }
+
+    void disable_missRatioCurve() { _missRatio.reset(); }
+
+    // estimated miss ratio at points evenly spaced capacities, empty
+    // unless enable_missRatioCurve was called
+    std::vector<MissRatioPoint> miss_ratio_curve(size_t points = 32) const {
+        return _missRatio ? _missRatio->curve(points)
+                          : std::vector<MissRatioPoint>();
+    }
+
+    // smallest capacity on the estimated curve whose miss ratio is at
+    // most target, zero if unknown or beyond the curve; a candidate for
+    // set_capacity
+    size_t capacity_forMissRatio(double target, size_t points = 64) const {
+        return MinCache::capacity_forMissRatio(miss_ratio_curve(points), target);
+    }
+
+    bool get(const Key &key, Value &value) {
+        maybe_rebalance();
+        size_t hash = _hasher(key);
+        size_t sliceIndex = slice_of(hash, _sliceMask);
+        sample_access(hash, true);
+        if (_hotKeys.enabled()) {
+            int slot = _hotKeys.on_read(key, hash, slice_accessor());
+            if (slot >= 0) {
+                return _hotKeys.get(slot, key, sliceIndex, slice_accessor(),
+                                    value);
+            }
+        }
         return _lruSliceCaches[sliceIndex]->get(key, value);
     }
 
-    Value get(Key key) {
+    // hot keys are copied out of their replica before func sees them
+    template <typename Func> bool visit(const Key &key, Func &&func) {
+        maybe_rebalance();
+        size_t hash = _hasher(key);
+        size_t sliceIndex = slice_of(hash, _sliceMask);
+        sample_access(hash, true);
+        if (_hotKeys.enabled()) {
+            int slot = _hotKeys.on_read(key, hash, slice_accessor());
+            if (slot >= 0) {
+                Value value{};
+                if (!_hotKeys.get(slot, key, sliceIndex, slice_accessor(),
+                                  value)) {
+                    return false;
+                }
+                func(static_cast<const Value &>(value));
+                return true;
+            }
+        }
+        return _lruSliceCaches[sliceIndex]->visit(key, std::forward<Func>(func));
+    }
+
+    // looks up count keys taking every slice lock at most once, values[i]
+    // and found[i] are filled for keys[i], returns the number of hits
+    size_t multi_get(const Key *keys, size_t count, Value *values,
+                     bool *found) {
+        maybe_rebalance();
+        sample_accesses(keys, count, true);
+        std::vector<uint32_t> order, offsets;
+        group_keys(keys, count, order, offsets);
+        size_t hits = 0;
+        for (int i = 0; i < _sliceNum; ++i) {
+            if (offsets[i + 1] > offsets[i]) {
+                hits += _lruSliceCaches[i]->get_batch(
+                    keys, order.data() + offsets[i],
+                    offsets[i + 1] - offsets[i], values, found);
+            }
+        }
+        return hits;
+    }
+
+    // hot keys among them are written to their home slice only, their
+    // replicas are dropped once the batch is in
+    void multi_put(const Key *keys, const Value *values, size_t count) {
+        maybe_rebalance();
+        sample_accesses(keys, count, false);
+        std::vector<uint32_t> order, offsets;
+        group_keys(keys, count, order, offsets);
+        std::vector<int> hotSlots;
+        if (_hotKeys.enabled()) {
+            hotSlots.resize(count);
+            for (size_t i = 0; i < count; ++i) {
+                hotSlots[i] = _hotKeys.begin_batchWrite(_hasher(keys[i]));
+            }
+        }
+        for (int i = 0; i < _sliceNum; ++i) {
+            if (offsets[i + 1] > offsets[i]) {
+                wait_forRoom(i);
+                _lruSliceCaches[i]->put_batch(keys, values,
+                                              order.data() + offsets[i],
+                                              offsets[i + 1] - offsets[i]);
+            }
+        }
+        for (size_t i = 0; i < hotSlots.size(); ++i) {
+            size_t hash = _hasher(keys[i]);
+            _hotKeys.end_batchWrite(hotSlots[i], keys[i], hash,
+                                    slice_of(hash, _sliceMask),
+                                    slice_accessor());
+        }
+    }
+
+    Value get(const Key &key) {
         Value value{};
-        memset(&value, 0, sizeof(Value));
         get(key, value);
         return value;
     }
 
+    // totals over all slices; every slice is read without locking
+    CacheStatsSnapshot stats() const {
+        CacheStatsSnapshot total;
+        for (const auto &lruSliceCache : _lruSliceCaches) {
+            total += lruSliceCache->stats();
+        }
+        return total;
+    }
+
+    CacheStatsSnapshot slice_stats(size_t sliceIndex) const {
+        return _lruSliceCaches[sliceIndex]->stats();
+    }
+
+    // serves each key that alone draws more than a slice's share of the
+    // reads from up to replicas slices; call before the cache is shared
+    void enable_hotKeyReplication(size_t replicas = kHotKeyReplicas) {
+        _hotKeys.enable(replicas, static_cast<size_t>(_sliceNum));
+        for (size_t i = 0; i < _lruSliceCaches.size(); ++i) {
+            _lruSliceCaches[i]->set_replicaFilter(
+                [this, i](const Key &key) { return slice_index(key) != i; });
+        }
+    }
+
+    // hashes of the keys currently replicated
+    std::vector<size_t> hot_keyHashes() const { return _hotKeys.hot_hashes(); }
+
+    // every interval operations of a thread, capacity moves from slices
+    // that gain little from it to slices whose misses keep hitting keys
+    // they evicted recently; call before the cache is shared
+    void enable_rebalancing(size_t interval = kRebalanceInterval) {
+        std::lock_guard<std::mutex> lock(_balanceMutex);
+        for (auto &lruSliceCache : _lruSliceCaches) {
+            lruSliceCache->set_ghostCapacity(lruSliceCache->capacity());
+        }
+        _rebalanceInterval = interval;
+    }
+
+    // one rebalancing round, see enable_rebalancing
+    void rebalance() {
+        std::lock_guard<std::mutex> lock(_balanceMutex);
+        rebalance_locked();
+    }
+
+    // changes the total entry capacity at runtime, every slice keeps its
+    // share of it
+    void set_capacity(size_t capacity) {
+        std::lock_guard<std::mutex> lock(_balanceMutex);
+        std::vector<size_t> current;
+        for (auto &lruSliceCache : _lruSliceCaches) {
+            current.push_back(lruSliceCache->capacity());
+        }
+        std::vector<size_t> capacities = scale_capacities(current, capacity);
+        for (int i = 0; i < _sliceNum; ++i) {
+            _lruSliceCaches[i]->set_capacity(static_cast<int>(capacities[i]));
+        }
+        _capacity = capacity;
+    }
+
+    size_t capacity() {
+        std::lock_guard<std::mutex> lock(_balanceMutex);
+        return _capacity;
+    }
+
+    size_t slice_capacity(size_t sliceIndex) {
+        return _lruSliceCaches[sliceIndex]->capacity();
+    }
+
+    // writes every slice to path, least recently used entries first;
+    // a slice is locked only while its entries are copied into a buffer
+    // and path is replaced only once the whole file is on disk
+    bool save_snapshot(const std::string &path) {
+        SnapshotWriter writer;
+        if (!writer.open(path, SnapshotKind::kLru, _lruSliceCaches.size())) {
+            return false;
+        }
+        std::string bytes;
+        for (auto &lruSliceCache : _lruSliceCaches) {
+            bytes.clear();
+            uint64_t entries = 0;
+            lruSliceCache->for_each_entry([&](const Key &key, const Value &value,
+                                              std::chrono::milliseconds ttl) {
+                SnapshotCodec<Key>::encode(key, bytes);
+                SnapshotCodec<Value>::encode(value, bytes);
+                put_varint(bytes, static_cast<uint64_t>(ttl.count()));
+                ++entries;
+            });
+            if (!writer.write_slice(bytes, entries)) {
+                return false;
+            }
+        }
+        return writer.commit();
+    }
+
+    // save_snapshot on a background thread; the cache must outlive it
+    std::future<bool> save_snapshotAsync(const std::string &path) {
+        return std::async(std::launch::async,
+                          [this, path] { return save_snapshot(path); });
+    }
+
+    // adds the entries of a snapshot, decoding its slices on up to threads
+    // threads (zero: one per hardware thread); keys already cached keep
+    // their value and entries beyond capacity evict the least recent
+    // ones. Returns false if the file is unusable or a slice is damaged,
+    // the intact slices are loaded either way
+    bool load_snapshot(const std::string &path, size_t threads = 0) {
+        SnapshotReader reader;
+        if (!reader.open(path, SnapshotKind::kLru)) {
+            return false;
+        }
+        std::atomic<bool> intact{true};
+        parallel_for(reader.slice_count(), threads, [&](size_t i) {
+            SnapshotSliceView view;
+            if (!reader.slice(i, view)) {
+                intact = false;
+                return;
+            }
+            const char *p = view.data;
+            const char *end = view.data + view.bytes;
+            for (uint64_t n = 0; n < view.entries; ++n) {
+                Key key{};
+                Value value{};
+                uint64_t ttl;
+                if (!SnapshotCodec<Key>::decode(p, end, key) ||
+                    !SnapshotCodec<Value>::decode(p, end, value) ||
+                    !get_varint(p, end, ttl)) {
+                    intact = false;
+                    return;
+                }
+                _lruSliceCaches[slice_index(key)]->insert(
+                    std::move(key), std::move(value),
+                    std::chrono::milliseconds(ttl));
+            }
+        });
+        return intact;
+    }
+
 private:
-    size_t Hash(const Key key) {
-        std::hash<Key> hashFunc;
-        return hashFunc(key);
+    static constexpr size_t kRebalanceInterval = 1 << 16;
+    static constexpr size_t kHotKeyReplicas = 4;
+
+    void maybe_rebalance() {
+        if (_rebalanceInterval == 0) {
+            return;
+        }
+        thread_local size_t operations = 0;
+        if (++operations % _rebalanceInterval == 0 && _balanceMutex.try_lock()) {
+            std::lock_guard<std::mutex> lock(_balanceMutex, std::adopt_lock);
+            rebalance_locked();
+        }
+    }
+
+    void rebalance_locked() {
+        if (_weighted) {
+            return;
+        }
+
+        std::vector<SlicePressure> pressures;
+        for (auto &lruSliceCache : _lruSliceCaches) {
+            pressures.push_back(lruSliceCache->take_pressure());
+        }
+        // no slice shrinks below a quarter of an even split
+        size_t minCapacity = std::max<size_t>(_capacity / _sliceNum / 4, 1);
+        std::vector<size_t> capacities =
+            rebalance_capacities(pressures, minCapacity);
+        for (int i = 0; i < _sliceNum; ++i) {
+            if (capacities[i] != pressures[i].capacity) {
+                _lruSliceCaches[i]->set_capacity(static_cast<int>(capacities[i]));
+            }
+        }
+    }
+
+    size_t slice_index(const Key &key) const {
+        return slice_of(_hasher(key), _sliceMask);
+    }
+
+    auto slice_accessor() {
+        return [this](size_t sliceIndex) -> LruCache<Key, Value> & {
+            return *_lruSliceCaches[sliceIndex];
+        };
+    }
+
+    // applies write to the home slice of key, keeping hot-key replicas
+    // consistent when replication is on
+    template <typename Write> void write_key(const Key &key, Write &&write) {
+        size_t hash = _hasher(key);
+        size_t sliceIndex = slice_of(hash, _sliceMask);
+        sample_access(hash, false);
+        wait_forRoom(sliceIndex);
+        if (!_hotKeys.enabled()) {
+            write(*_lruSliceCaches[sliceIndex]);
+            return;
+        }
+        _hotKeys.write(key, hash, sliceIndex, slice_accessor(),
+                       std::forward<Write>(write));
+    }
+
+    void sample_access(size_t hash, bool lookup) {
+        if (_missRatio) {
+            _missRatio->record(hash, lookup);
+        }
+    }
+
+    void sample_accesses(const Key *keys, size_t count, bool lookup) {
+        if (_missRatio) {
+            for (size_t i = 0; i < count; ++i) {
+                _missRatio->record(_hasher(keys[i]), lookup);
+            }
+        }
+    }
+
+    // holds a writer back while the removal queue of its slice is full,
+    // see RemovalOverflow::kBlock
+    void wait_forRoom(size_t sliceIndex) {
+        if (_removals) {
+            _removals->queue(sliceIndex).wait_forRoom();
+        }
+    }
+
+    void group_keys(const Key *keys, size_t count, std::vector<uint32_t> &order,
+                    std::vector<uint32_t> &offsets) {
+        std::vector<uint32_t> slices(count);
+        for (size_t i = 0; i < count; ++i) {
+            slices[i] = static_cast<uint32_t>(slice_index(keys[i]));
+        }
+        group_bySlice(slices, _sliceNum, order, offsets);
     }
 
 private:
     size_t _capacity;
     int _sliceNum;
+    size_t _sliceMask;
+    Hasher _hasher;
+    HotKeyReplicas<Key> _hotKeys;
+    // guards _capacity, _weighted and the slice capacities as a whole
+    std::mutex _balanceMutex;
+    bool _weighted = false;
+    size_t _rebalanceInterval = 0;
+    std::unique_ptr<MissRatioEstimator> _missRatio;
     std::vector<std::unique_ptr<LruCache<Key, Value>>> _lruSliceCaches;
+    // destroyed before the slices, so queued removals are delivered
+    // while the listener can still use the cache
+    std::unique_ptr<RemovalDispatcher<Key, Value>> _removals;
 };
 
 template <typename Key, typename Value>
 void LruCache<Key, Value>::initialize_list() {
-    _dummyHead = std::make_shared<LruNodeType>(Key(), Value());
-    _dummyTail = std::make_shared<LruNodeType>(Key(), Value());
-    _dummyHead->_next = _dummyTail;
-    _dummyTail->_prev = _dummyHead;
+    size_t slots = _capacity > 0 ? static_cast<size_t>(_capacity) : 0;
+    _nodes.reserve(slots + 2);
+    _nodes.emplace_back();
+    _nodes.emplace_back();
+    _nodes[kDummyHead]._next = kDummyTail;
+    _nodes[kDummyTail]._prev = kDummyHead;
+    _freeList = kNullIndex;
+    _nodeMap.reserve(slots);
 }
 
 template <typename Key, typename Value>
-void LruCache<Key, Value>::update_existing_node(NodePtr node,
-                                                const Value &value) {
-    node->set_value(value);
-    move_to_recent(node);
+size_t LruCache<Key, Value>::get_batch(const Key *keys, const uint32_t *order,
+                                       size_t count, Value *values,
+                                       bool *found) {
+    std::vector<NodeIndex> indices(count);
+    auto lock = _stats.lock(_mutex);
+    drain_readBuffer();
+    uint64_t now = expire_entries();
+
+    // probe every key first and prefetch the nodes, so the splices and
+    // value copies below do not stall on one node at a time
+    for (size_t i = 0; i < count; ++i) {
+        indices[i] = find_node(keys[order[i]]);
+        if (indices[i] != kNullIndex && is_expired(indices[i], now)) {
+            _stats.record_expiration();
+            erase_node(indices[i], RemovalCause::kExpired);
+            indices[i] = kNullIndex;
+        }
+        if (indices[i] != kNullIndex) {
+            prefetch_read(&_nodes[indices[i]]);
+        }
+    }
+
+    size_t hits = 0;
+    for (size_t i = 0; i < count; ++i) {
+        found[order[i]] = indices[i] != kNullIndex;
+        if (found[order[i]]) {
+            _stats.record_hit();
+            move_to_recent(indices[i]);
+            values[order[i]] = _nodes[indices[i]]._value;
+            ++hits;
+        } else {
+            _stats.record_miss();
+            check_ghost(keys[order[i]]);
+        }
+    }
+    return hits;
 }
 
 template <typename Key, typename Value>
-void LruCache<Key, Value>::add_newNode(const Key &key, const Value &value) {
-    if (_nodeMap.size() >= _capacity) {
-        evict_node();
+void LruCache<Key, Value>::put_batch(const Key *keys, const Value *values,
+                                     const uint32_t *order, size_t count) {
+    auto lock = _stats.lock(_mutex);
+    drain_readBuffer();
+    expire_entries();
+    for (size_t i = 0; i < count; ++i) {
+        const Key &key = keys[order[i]];
+        NodeIndex index = find_node(key);
+        if (index != kNullIndex) {
+            if (update_existing_node(index, values[order[i]])) {
+                set_expiry(index, kDefaultTtl);
+            }
+        } else if (NodeIndex index = add_newNode(key, values[order[i]]);
+                   index != kNullIndex) {
+            set_expiry(index, kDefaultTtl);
+        }
+    }
+}
+
+template <typename Key, typename Value>
+template <typename K, typename V>
+void LruCache<Key, Value>::put_internal(K &&key, V &&value,
+                                        std::chrono::milliseconds ttl) {
+    auto lock = _stats.lock(_mutex);
+    drain_readBuffer();
+    expire_entries();
+    NodeIndex index = find_node(key);
+    if (index != kNullIndex) {
+        if (update_existing_node(index, std::forward<V>(value))) {
+            set_expiry(index, ttl);
+        }
+        return;
     }
 
-    NodePtr newNode = std::make_shared<LruNodeType>(key, value);
-    insert_node(newNode);
-    _nodeMap[key] = newNode;
+    index = add_newNode(std::forward<K>(key), std::forward<V>(value));
+    if (index != kNullIndex) {
+        set_expiry(index, ttl);
+    }
+}
+
+// reclaims up to kExpireBatch expired entries, returns the current tick
+template <typename Key, typename Value>
+uint64_t LruCache<Key, Value>::expire_entries() {
+    if (!_expiryEnabled) {
+        return 0;
+    }
+
+    uint64_t now = _timerWheel.now_tick();
+    _timerWheel.advance(now, kExpireBatch, [this](NodeIndex index) {
+        _stats.record_expiration();
+        erase_node(index, RemovalCause::kExpired);
+    });
+    return now;
 }
 
 template <typename Key, typename Value>
-void LruCache<Key, Value>::move_to_recent(NodePtr node) {
-    remove_node(node);
-    insert_node(node);
+void LruCache<Key, Value>::set_expiry(NodeIndex index,
+                                      std::chrono::milliseconds ttl) {
+    if (ttl == kDefaultTtl) {
+        ttl = _defaultTtl;
+    }
+    if (ttl.count() > 0) {
+        _expiryEnabled = true;
+        _timerWheel.schedule(index, _timerWheel.tick_after(ttl));
+    } else {
+        _timerWheel.cancel(index);
+    }
+}
+
+template <typename Key, typename Value>
+void LruCache<Key, Value>::erase_node(NodeIndex index, RemovalCause cause) {
+    remove_node(index);
+    _nodeMap.erase(_nodes[index]._key, index);
+    _totalWeight -= _nodes[index]._weight;
+    _timerWheel.cancel(index);
+    release_node(index, cause);
+    free_node(index);
 }
 
+// hands a node that leaves the cache to the removal queue and, if it was
+// evicted, to the eviction sink; both take its key and value by move.
+// Hot-key replicas go unreported, their home entry is still cached
 template <typename Key, typename Value>
-void LruCache<Key, Value>::remove_node(NodePtr node) {
-    node->_prev->_next = node->_next;
-    node->_next->_prev = node->_prev;
+void LruCache<Key, Value>::release_node(NodeIndex index, RemovalCause cause) {
+    LruNodeType &node = _nodes[index];
+    if ((!_removalQueue && !_evictionSink) || is_replica(node._key)) {
+        return;
+    }
+    bool sink = cause == RemovalCause::kEvicted && _evictionSink;
+    if (_removalQueue) {
+        if (sink) {
+            _removalQueue->push(Key(node._key), Value(node._value), cause);
+        } else {
+            _removalQueue->push(std::move(node._key), std::move(node._value),
+                                cause);
+        }
+    }
+    if (sink) {
+        _evictionSink(std::move(node._key), std::move(node._value));
+    }
+}
+
+template <typename Key, typename Value>
+template <typename Func>
+bool LruCache<Key, Value>::visit_buffered(const Key &key, Func &func) {
+    bool needDrain = false;
+    {
+        auto lock = _stats.lock_shared(_mutex);
+        NodeIndex index = find_node(key);
+        if (index == kNullIndex) {
+            _stats.record_miss();
+            check_ghost(key);
+            return false;
+        }
+        // expired entries are left for the next exclusive holder
+        if (_expiryEnabled &&
+            _timerWheel.is_expired(index, _timerWheel.now_tick())) {
+            _stats.record_miss();
+            return false;
+        }
+        _stats.record_hit();
+        func(static_cast<const Value &>(_nodes[index]._value));
+        needDrain = _readBuffer.record(index);
+    }
+
+    // never wait for the lock on a hit, somebody else will drain later
+    if (needDrain && _mutex.try_lock()) {
+        drain_readBuffer();
+        _mutex.unlock();
+    }
+    return true;
+}
+
+template <typename Key, typename Value>
+void LruCache<Key, Value>::drain_readBuffer() {
+    if (!_bufferedReads) {
+        return;
+    }
+
+    // a recorded slot may have been freed or reused since, skip free ones
+    _readBuffer.drain([this](NodeIndex index) {
+        if (_nodes[index]._prev != kNullIndex) {
+            move_to_recent(index);
+        }
+    });
+}
+
+template <typename Key, typename Value>
+void LruCache<Key, Value>::set_weighted(size_t maxWeight, Weigher weigher) {
+    std::lock_guard<std::shared_mutex> lock(_mutex);
+    drain_readBuffer();
+    _weighted = true;
+    _maxWeight = maxWeight;
+    _weigher = std::move(weigher);
+
+    _totalWeight = 0;
+    for (NodeIndex index = _nodes[kDummyHead]._next; index != kDummyTail;
+         index = _nodes[index]._next) {
+        _nodes[index]._weight = entry_weight(_nodes[index]._key,
+                                             _nodes[index]._value);
+        _totalWeight += _nodes[index]._weight;
+    }
+    while (_totalWeight > _maxWeight) {
+        free_node(evict_node());
+    }
+}
+
+template <typename Key, typename Value>
+void LruCache<Key, Value>::set_capacity(int capacity) {
+    std::lock_guard<std::shared_mutex> lock(_mutex);
+    drain_readBuffer();
+    _capacity = capacity;
+    while (!_weighted && _nodeMap.size() > static_cast<size_t>(std::max(capacity, 0))) {
+        free_node(evict_node());
+    }
+}
+
+template <typename Key, typename Value>
+SlicePressure LruCache<Key, Value>::take_pressure() {
+    std::lock_guard<std::shared_mutex> lock(_mutex);
+    SlicePressure pressure;
+    pressure.evictions = _evictionCount;
+    pressure.ghostHits = _ghostHits.exchange(0, std::memory_order_relaxed);
+    pressure.size = _nodeMap.size();
+    pressure.capacity = static_cast<size_t>(std::max(_capacity, 0));
+    _evictionCount = 0;
+    return pressure;
+}
+
+template <typename Key, typename Value>
+template <typename Func>
+void LruCache<Key, Value>::for_each_entry(Func &&func) {
+    std::lock_guard<std::shared_mutex> lock(_mutex);
+    drain_readBuffer();
+    uint64_t now = _expiryEnabled ? _timerWheel.now_tick() : 0;
+    for (NodeIndex index = _nodes[kDummyHead]._next; index != kDummyTail;
+         index = _nodes[index]._next) {
+        std::chrono::milliseconds ttl{0};
+        if (_expiryEnabled && _timerWheel.is_scheduled(index)) {
+            uint64_t expireTick = _timerWheel.expire_tick(index);
+            if (expireTick <= now) {
+                continue;
+            }
+            ttl = std::chrono::milliseconds(expireTick - now);
+        }
+        func(static_cast<const Key &>(_nodes[index]._key),
+             static_cast<const Value &>(_nodes[index]._value), ttl);
+    }
+}
+
+template <typename Key, typename Value>
+template <typename K, typename V>
+bool LruCache<Key, Value>::insert(K &&key, V &&value,
+                                  std::chrono::milliseconds ttl) {
+    auto lock = _stats.lock(_mutex);
+    drain_readBuffer();
+    expire_entries();
+    if (find_node(key) != kNullIndex) {
+        return false;
+    }
+    NodeIndex index = add_newNode(std::forward<K>(key), std::forward<V>(value));
+    if (index == kNullIndex) {
+        return false;
+    }
+    set_expiry(index, ttl);
+    return true;
+}
+
+// returns false if the new value alone exceeds the budget and the entry
+// was dropped
+template <typename Key, typename Value>
+template <typename V>
+bool LruCache<Key, Value>::update_existing_node(NodeIndex index, V &&value) {
+    if (_weighted) {
+        size_t weight = entry_weight(_nodes[index]._key, value);
+        if (weight > _maxWeight) {
+            erase_node(index, RemovalCause::kReplaced);
+            return false;
+        }
+        _totalWeight += weight - _nodes[index]._weight;
+        _nodes[index]._weight = weight;
+    }
+
+    _stats.record_update();
+    if (_removalQueue && !is_replica(_nodes[index]._key)) {
+        _removalQueue->push(Key(_nodes[index]._key),
+                            std::move(_nodes[index]._value),
+                            RemovalCause::kReplaced);
+    }
+    _nodes[index]._value = std::forward<V>(value);
+    move_to_recent(index);
+    while (_weighted && _totalWeight > _maxWeight) {
+        free_node(evict_node());
+    }
+    return true;
+}
+
+template <typename Key, typename Value>
+template <typename K, typename V>
+typename LruCache<Key, Value>::NodeIndex
+LruCache<Key, Value>::add_newNode(K &&key, V &&value) {
+    NodeIndex index;
+    size_t weight = 0;
+    if (_weighted) {
+        weight = entry_weight(key, value);
+        if (weight > _maxWeight) {
+            return kNullIndex;
+        }
+        while (_totalWeight + weight > _maxWeight) {
+            free_node(evict_node());
+        }
+        index = allocate_node();
+    } else if (_capacity <= 0) {
+        return kNullIndex;
+    } else {
+        // reuse the evicted slot directly so a full cache never allocates
+        index = _nodeMap.size() >= static_cast<size_t>(_capacity)
+                    ? evict_node()
+                    : allocate_node();
+    }
+
+    LruNodeType &node = _nodes[index];
+    node._key = std::forward<K>(key);
+    node._value = std::forward<V>(value);
+    node._accessCount = 1;
+    node._weight = weight;
+    _totalWeight += weight;
+    insert_node(index);
+    _nodeMap.insert(node._key, index);
+    _stats.record_insert();
+    return index;
+}
+
+template <typename Key, typename Value>
+void LruCache<Key, Value>::move_to_recent(NodeIndex index) {
+    remove_node(index);
+    insert_node(index);
+}
+
+template <typename Key, typename Value>
+void LruCache<Key, Value>::remove_node(NodeIndex index) {
+    LruNodeType &node = _nodes[index];
+    _nodes[node._prev]._next = node._next;
+    _nodes[node._next]._prev = node._prev;
 }
 
 // in tail insert to remove the least recently used node
 template <typename Key, typename Value>
-void LruCache<Key, Value>::insert_node(NodePtr node) {
-    node->_next = _dummyTail;
-    node->_prev = _dummyTail->_prev;
-    _dummyTail->_prev->_next = node;
-    _dummyTail->_prev = node;
+void LruCache<Key, Value>::insert_node(NodeIndex index) {
+    LruNodeType &node = _nodes[index];
+    node._next = kDummyTail;
+    node._prev = _nodes[kDummyTail]._prev;
+    _nodes[node._prev]._next = index;
+    _nodes[kDummyTail]._prev = index;
+}
+
+template <typename Key, typename Value>
+typename LruCache<Key, Value>::NodeIndex LruCache<Key, Value>::evict_node() {
+    NodeIndex index = _nodes[kDummyHead]._next;
+    _stats.record_eviction();
+    ++_evictionCount;
+    if (_ghost.enabled()) {
+        _ghost.add(std::hash<Key>()(_nodes[index]._key));
+    }
+    remove_node(index);
+    _nodeMap.erase(_nodes[index]._key, index);
+    _timerWheel.cancel(index);
+    _totalWeight -= _nodes[index]._weight;
+    release_node(index, RemovalCause::kEvicted);
+    return index;
+}
+
+template <typename Key, typename Value>
+typename LruCache<Key, Value>::NodeIndex
+LruCache<Key, Value>::allocate_node() {
+    if (_freeList != kNullIndex) {
+        NodeIndex index = _freeList;
+        _freeList = _nodes[index]._next;
+        return index;
+    }
+
+    _nodes.emplace_back();
+    return static_cast<NodeIndex>(_nodes.size() - 1);
+}
+
+template <typename Key, typename Value>
+void LruCache<Key, Value>::free_node(NodeIndex index) {
+    // release whatever the value holds, the slot itself stays in the slab
+    _nodes[index]._key = Key();
+    _nodes[index]._value = Value();
+    _nodes[index]._prev = kNullIndex;
+    _nodes[index]._next = _freeList;
+    _freeList = index;
+}
+
+template <typename Key, typename Value>
+void LruKCache<Key, Value>::initialize() {
+    size_t slots = _capacity + _historyCapacity + 1;
+    _nodes.reserve(slots);
+    _accessTimes.reserve(slots * _k);
+    _heap.reserve(_capacity);
+    _nodeMap.reserve(slots);
+    _nodes.emplace_back();
+    _accessTimes.resize(_k, 0);
+    _nodes[kHistoryHead]._prev = kHistoryHead;
+    _nodes[kHistoryHead]._next = kHistoryHead;
+}
+
+template <typename Key, typename Value>
+template <typename K, typename V>
+void LruKCache<Key, Value>::put_internal(K &&key, V &&value) {
+    auto lock = _stats.lock(_mutex);
+    NodeIndex index = find_node(key);
+    if (index == kNullIndex) {
+        if (_k == 1) {
+            // the first access already qualifies
+            admit(create_node(std::forward<K>(key)), std::forward<V>(value));
+            return;
+        }
+        index = add_history(std::forward<K>(key));
+    } else {
+        record_access(index);
+        if (is_resident(index)) {
+            _stats.record_update();
+            _nodes[index]._value = std::forward<V>(value);
+            update_heap(index);
+            return;
+        }
+        move_to_recent(index);
+    }
+
+    if (_nodes[index]._refs >= _k) {
+        remove_node(index);
+        admit(index, std::forward<V>(value));
+    }
+}
+
+// a slot for a key with one recorded access, in neither list
+template <typename Key, typename Value>
+template <typename K>
+typename LruKCache<Key, Value>::NodeIndex
+LruKCache<Key, Value>::create_node(K &&key) {
+    NodeIndex index = allocate_node();
+    Node &node = _nodes[index];
+    node._key = std::forward<K>(key);
+    node._refs = 0;
+    node._ring = 0;
+    _nodeMap.insert(node._key, index);
+    record_access(index);
+    return index;
+}
+
+// starts tracking a key with one recorded access. Room is made before
+// it is linked, so the newest key survives even without history
+// capacity and a second access can still admit it
+template <typename Key, typename Value>
+template <typename K>
+typename LruKCache<Key, Value>::NodeIndex
+LruKCache<Key, Value>::add_history(K &&key) {
+    trim_history(_historyCapacity > 0 ? _historyCapacity - 1 : 0);
+    NodeIndex index = create_node(std::forward<K>(key));
+    insert_node(index);
+    return index;
+}
+
+// moves an entry with k accesses, already out of the history list, into
+// the resident set
+template <typename Key, typename Value>
+template <typename V>
+void LruKCache<Key, Value>::admit(NodeIndex index, V &&value) {
+    if (_capacity == 0) {
+        _nodeMap.erase(_nodes[index]._key, index);
+        free_node(index);
+        return;
+    }
+
+    if (_heap.size() >= _capacity) {
+        evict();
+    }
+    _stats.record_insert();
+    _nodes[index]._value = std::forward<V>(value);
+    heap_push(index);
+    trim_history(_historyCapacity);
+}
+
+template <typename Key, typename Value>
+void LruKCache<Key, Value>::record_access(NodeIndex index) {
+    Node &node = _nodes[index];
+    _accessTimes[static_cast<size_t>(index) * _k + node._ring] = ++_clock;
+    node._ring = node._ring + 1 == _k ? 0 : node._ring + 1;
+    node._refs = std::min(node._refs + 1, _k);
+}
+
+// the oldest time in a full ring is the one about to be overwritten
+template <typename Key, typename Value>
+uint64_t LruKCache<Key, Value>::kth_accessTime(NodeIndex index) const {
+    const Node &node = _nodes[index];
+    if (node._refs < _k) {
+        return 0;
+    }
+    return _accessTimes[static_cast<size_t>(index) * _k + node._ring];
+}
+
+// the victim drops its value but keeps its access history, so a key that
+// comes back soon is readmitted on its next put
+template <typename Key, typename Value>
+void LruKCache<Key, Value>::evict() {
+    NodeIndex victim = _heap.front().index;
+    _stats.record_eviction();
+    heap_remove(0);
+    _nodes[victim]._value = Value();
+    insert_node(victim);
+}
+
+template <typename Key, typename Value>
+void LruKCache<Key, Value>::trim_history(size_t limit) {
+    while (_historySize > limit) {
+        NodeIndex oldest = _nodes[kHistoryHead]._next;
+        remove_node(oldest);
+        _nodeMap.erase(_nodes[oldest]._key, oldest);
+        free_node(oldest);
+    }
+}
+
+template <typename Key, typename Value>
+void LruKCache<Key, Value>::move_to_recent(NodeIndex index) {
+    remove_node(index);
+    insert_node(index);
+}
+
+template <typename Key, typename Value>
+void LruKCache<Key, Value>::remove_node(NodeIndex index) {
+    Node &node = _nodes[index];
+    _nodes[node._prev]._next = node._next;
+    _nodes[node._next]._prev = node._prev;
+    --_historySize;
+}
+
+template <typename Key, typename Value>
+void LruKCache<Key, Value>::insert_node(NodeIndex index) {
+    Node &node = _nodes[index];
+    node._next = kHistoryHead;
+    node._prev = _nodes[kHistoryHead]._prev;
+    _nodes[node._prev]._next = index;
+    _nodes[kHistoryHead]._prev = index;
+    ++_historySize;
+}
+
+template <typename Key, typename Value>
+typename LruKCache<Key, Value>::NodeIndex LruKCache<Key, Value>::allocate_node() {
+    if (_freeList != kNullIndex) {
+        NodeIndex index = _freeList;
+        _freeList = _nodes[index]._next;
+        return index;
+    }
+
+    _nodes.emplace_back();
+    _accessTimes.resize(_nodes.size() * _k, 0);
+    return static_cast<NodeIndex>(_nodes.size() - 1);
 }
 
 template <typename Key, typename Value>
-void LruCache<Key, Value>::evict_node() {
-    NodePtr node = _dummyHead->_next;
-    remove_node(node);
-    _nodeMap.erase(node->get_key());
+void LruKCache<Key, Value>::free_node(NodeIndex index) {
+    Node &node = _nodes[index];
+    node._key = Key();
+    node._value = Value();
+    node._heapPos = kNullIndex;
+    node._next = _freeList;
+    _freeList = index;
+}
+
+template <typename Key, typename Value>
+void LruKCache<Key, Value>::heap_push(NodeIndex index) {
+    _heap.push_back({kth_accessTime(index), index});
+    sift_up(static_cast<uint32_t>(_heap.size() - 1));
+}
+
+// accesses only ever make a slot's k-th time larger, so a touched
+// resident entry only moves down
+template <typename Key, typename Value>
+void LruKCache<Key, Value>::update_heap(NodeIndex index) {
+    uint32_t pos = _nodes[index]._heapPos;
+    _heap[pos].time = kth_accessTime(index);
+    sift_down(pos);
+}
+
+template <typename Key, typename Value>
+void LruKCache<Key, Value>::heap_remove(uint32_t pos) {
+    _nodes[_heap[pos].index]._heapPos = kNullIndex;
+    HeapEntry last = _heap.back();
+    _heap.pop_back();
+    if (pos < _heap.size()) {
+        heap_set(pos, last);
+        sift_up(pos);
+        sift_down(_nodes[last.index]._heapPos);
+    }
+}
+
+template <typename Key, typename Value>
+void LruKCache<Key, Value>::sift_up(uint32_t pos) {
+    HeapEntry entry = _heap[pos];
+    while (pos > 0) {
+        uint32_t parent = (pos - 1) / 2;
+        if (_heap[parent].time <= entry.time) {
+            break;
+        }
+        heap_set(pos, _heap[parent]);
+        pos = parent;
+    }
+    heap_set(pos, entry);
+}
+
+template <typename Key, typename Value>
+void LruKCache<Key, Value>::sift_down(uint32_t pos) {
+    HeapEntry entry = _heap[pos];
+    uint32_t size = static_cast<uint32_t>(_heap.size());
+    while (true) {
+        uint32_t child = 2 * pos + 1;
+        if (child >= size) {
+            break;
+        }
+        if (child + 1 < size && _heap[child + 1].time < _heap[child].time) {
+            ++child;
+        }
+        if (entry.time <= _heap[child].time) {
+            break;
+        }
+        heap_set(pos, _heap[child]);
+        pos = child;
+    }
+    heap_set(pos, entry);
 }
 
 } // namespace MinCache
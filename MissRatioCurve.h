@@ -0,0 +1,307 @@
+#pragma once
+
+#include "CacheUtil.h"
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace MinCache {
+
+// estimated miss ratio of an LRU cache holding capacity entries
+struct MissRatioPoint {
+    size_t capacity = 0;
+    double missRatio = 1.0;
+};
+
+// smallest capacity on curve whose miss ratio is at most target, zero if
+// none reaches it
+inline size_t capacity_forMissRatio(const std::vector<MissRatioPoint> &curve,
+                                    double target) {
+    for (const auto &point : curve) {
+        if (point.missRatio <= target) {
+            return point.capacity;
+        }
+    }
+    return 0;
+}
+
+//--------------------------------------------------------------------
+// MissRatioEstimator: LRU miss-ratio curve from a spatially hashed
+// sample of the accesses, after SHARDS (Waldspurger et al.). A key is
+// sampled when a hash of it falls below a threshold, so either all of
+// its accesses are seen or none. The reuse distance of a sampled lookup
+// is the number of distinct sampled keys touched since its previous
+// access, counted in a Fenwick tree over access times, and scaled up by
+// the sampling rate. Once more than maxSamples keys are tracked the
+// threshold is lowered and keys above it are dropped, which bounds
+// memory whatever the key space.
+//
+// A few hot keys make up much of the traffic, so whether they happen to
+// be sampled skews the estimate. As in SHARDS_adj every lookup is also
+// counted, and the gap between that count and the scaled sampled count
+// is credited to the shortest reuse distances.
+//
+// Lookups feed the curve, writes only move a key to the top of the LRU
+// stack and forget takes it out. Unsampled accesses cost a hash, a
+// compare and for lookups a mostly uncontended counter increment;
+// sampled ones take the estimator's own mutex.
+//--------------------------------------------------------------------
+
+class MissRatioEstimator {
+public:
+    static constexpr double kDefaultSampleRate = 0.01;
+    static constexpr size_t kDefaultMaxSamples = 1 << 14;
+
+    // the curve covers capacities up to maxCapacity
+    explicit MissRatioEstimator(size_t maxCapacity,
+                                double sampleRate = kDefaultSampleRate,
+                                size_t maxSamples = kDefaultMaxSamples)
+        : _maxCapacity(maxCapacity > 0 ? maxCapacity : 1),
+          _maxSamples(maxSamples > 0 ? maxSamples : 1),
+          _binWidth(std::max<size_t>(1, (_maxCapacity + kBins - 1) / kBins)),
+          _histogram(kBins, 0.0) {
+        double rate = std::min(1.0, std::max(sampleRate, 1.0 / kSpotRange));
+        _threshold.store(static_cast<uint64_t>(rate * kSpotRange),
+                         std::memory_order_relaxed);
+        _tree.assign(4 * _maxSamples + 1, 0);
+        _samples.reserve(_maxSamples + 1);
+    }
+
+    // hash is the cache's hash of the key
+    void record(uint64_t hash, bool lookup) {
+        if (lookup) {
+            _lookupCounts[counter_index()].count.fetch_add(
+                1, std::memory_order_relaxed);
+        }
+        uint64_t spot = spot_of(hash);
+        if (spot >= _threshold.load(std::memory_order_relaxed)) {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(_mutex);
+        record_locked(hash, spot, lookup);
+    }
+
+    // the key left the cache for good, e.g. remove()
+    void forget(uint64_t hash) {
+        if (spot_of(hash) >= _threshold.load(std::memory_order_relaxed)) {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto it = _samples.find(hash);
+        if (it != _samples.end()) {
+            unmark(it->second.time);
+            _samples.erase(it);
+        }
+    }
+
+    // miss ratio at points capacities evenly spread up to maxCapacity;
+    // all ones before any sampled lookup
+    std::vector<MissRatioPoint> curve(size_t points) const {
+        std::vector<MissRatioPoint> curve;
+        if (points == 0) {
+            return curve;
+        }
+        double lookups = counted_lookups();
+        std::lock_guard<std::mutex> lock(_mutex);
+        curve.reserve(points);
+        lookups -= _lookupsBefore;
+        // sampling error, credited to the first bin
+        double hits = lookups - _lookups;
+        size_t bin = 0;
+        for (size_t i = 1; i <= points; ++i) {
+            MissRatioPoint point;
+            point.capacity = _maxCapacity * i / points;
+            // a lookup at distance d hits once more than d entries fit
+            for (; bin < kBins && (bin + 1) * _binWidth <= point.capacity;
+                 ++bin) {
+                hits += _histogram[bin];
+            }
+            if (lookups > 0 && _lookups > 0) {
+                point.missRatio =
+                    std::min(1.0, std::max(0.0, 1.0 - hits / lookups));
+            }
+            curve.push_back(point);
+        }
+        return curve;
+    }
+
+    // current sampling rate, lower than requested once maxSamples is hit
+    double sample_rate() const {
+        return static_cast<double>(_threshold.load(std::memory_order_relaxed)) /
+               kSpotRange;
+    }
+
+    size_t max_capacity() const { return _maxCapacity; }
+
+    // forgets the lookups seen so far, keeping the sampled LRU stack
+    void reset() {
+        double lookups = counted_lookups();
+        std::lock_guard<std::mutex> lock(_mutex);
+        std::fill(_histogram.begin(), _histogram.end(), 0.0);
+        _lookups = 0;
+        _lookupsBefore = lookups;
+    }
+
+private:
+    static constexpr int kSpotBits = 24;
+    static constexpr uint64_t kSpotRange = uint64_t(1) << kSpotBits;
+    static constexpr size_t kBins = 512;
+    static constexpr size_t kLookupCounters = 16;
+
+    // threads spread over several, so counting every lookup stays cheap
+    struct alignas(64) LookupCounter {
+        std::atomic<uint64_t> count{0};
+    };
+
+    static size_t counter_index() {
+        static std::atomic<size_t> nextThread{0};
+        thread_local size_t index =
+            nextThread.fetch_add(1, std::memory_order_relaxed) %
+            kLookupCounters;
+        return index;
+    }
+
+    double counted_lookups() const {
+        uint64_t total = 0;
+        for (const auto &counter : _lookupCounts) {
+            total += counter.count.load(std::memory_order_relaxed);
+        }
+        return static_cast<double>(total);
+    }
+
+    struct Sample {
+        uint32_t time;
+        uint32_t spot;
+    };
+
+    // independent of the bits the cache routes slices with
+    static uint64_t spot_of(uint64_t hash) {
+        return mix_hash(hash ^ 0x5bd1e9955bd1e995ULL) & (kSpotRange - 1);
+    }
+
+    void record_locked(uint64_t hash, uint64_t spot, bool lookup) {
+        double weight = 1.0 / sample_rate();
+        auto it = _samples.find(hash);
+        if (it != _samples.end()) {
+            if (lookup) {
+                // marks after the previous access are the distinct keys
+                // touched since
+                size_t distance = _live - prefix(it->second.time);
+                size_t scaled = static_cast<size_t>(distance * weight);
+                size_t bin = scaled / _binWidth;
+                if (bin < kBins) {
+                    _histogram[bin] += weight;
+                }
+                _lookups += weight;
+            }
+            unmark(it->second.time);
+            it->second.time = 0;
+        } else {
+            if (lookup) {
+                _lookups += weight;
+            }
+            it = _samples.emplace(hash, Sample{0, static_cast<uint32_t>(spot)})
+                     .first;
+        }
+        if (_clock + 1 >= _tree.size()) {
+            compact();
+        }
+        it->second.time = static_cast<uint32_t>(++_clock);
+        mark(it->second.time);
+        if (_samples.size() > _maxSamples) {
+            lower_threshold();
+        }
+    }
+
+    // keeps the lowest spots, dropping about one in eight samples
+    void lower_threshold() {
+        std::vector<uint32_t> spots;
+        spots.reserve(_samples.size());
+        for (const auto &entry : _samples) {
+            spots.push_back(entry.second.spot);
+        }
+        size_t keep = _maxSamples - _maxSamples / 8;
+        std::nth_element(spots.begin(), spots.begin() + keep, spots.end());
+        uint64_t threshold = spots[keep];
+        _threshold.store(threshold, std::memory_order_relaxed);
+        for (auto it = _samples.begin(); it != _samples.end();) {
+            if (it->second.spot >= threshold) {
+                unmark(it->second.time);
+                it = _samples.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    // renumbers the live samples 1..n in access order once the clock
+    // reaches the end of the tree
+    void compact() {
+        std::vector<Sample *> order;
+        order.reserve(_samples.size());
+        for (auto &entry : _samples) {
+            if (entry.second.time != 0) {
+                order.push_back(&entry.second);
+            }
+        }
+        std::sort(order.begin(), order.end(), [](Sample *a, Sample *b) {
+            return a->time < b->time;
+        });
+        std::fill(_tree.begin(), _tree.end(), 0);
+        _clock = 0;
+        _live = 0;
+        for (Sample *sample : order) {
+            sample->time = static_cast<uint32_t>(++_clock);
+            mark(sample->time);
+        }
+    }
+
+    void mark(size_t time) {
+        ++_live;
+        for (; time < _tree.size(); time += time & (~time + 1)) {
+            ++_tree[time];
+        }
+    }
+
+    void unmark(size_t time) {
+        --_live;
+        for (; time < _tree.size(); time += time & (~time + 1)) {
+            --_tree[time];
+        }
+    }
+
+    // marks at times 1..time
+    size_t prefix(size_t time) const {
+        size_t sum = 0;
+        for (; time > 0; time -= time & (~time + 1)) {
+            sum += _tree[time];
+        }
+        return sum;
+    }
+
+private:
+    const size_t _maxCapacity;
+    const size_t _maxSamples;
+    const size_t _binWidth;
+    std::atomic<uint64_t> _threshold{0};
+    mutable std::mutex _mutex;
+    std::unordered_map<uint64_t, Sample> _samples;
+    // Fenwick tree over access times, one mark per sampled key at the
+    // time of its latest access
+    std::vector<uint32_t> _tree;
+    size_t _clock = 0;
+    size_t _live = 0;
+    // lookups by scaled reuse distance, _binWidth entries per bin;
+    // first accesses and longer distances count as misses everywhere
+    std::vector<double> _histogram;
+    double _lookups = 0;
+    // every lookup, sampled or not; _lookups estimates the same number
+    LookupCounter _lookupCounts[kLookupCounters];
+    double _lookupsBefore = 0;
+};
+
+} // namespace MinCache
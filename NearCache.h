@@ -0,0 +1,194 @@
+#pragma once
+
+#include "CacheUtil.h"
+#include "LruCache.h"
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace MinCache {
+
+//--------------------------------------------------------------------
+// NearCache: a small direct-mapped L1 per thread in front of a shared
+// cache (HashLruCache by default). Repeat reads of hot keys are served
+// from the calling thread's own table without touching a lock or a
+// shared line that is being written.
+//
+// Every key hashes to one of kStripes generation counters. Writers
+// update the shared tier first and bump the counter after, a local
+// entry remembers the counter it was filled under and is only used
+// while the counter is unchanged, so a read never returns a value older
+// than a put or remove that completed before it. Writes that bypass
+// the NearCache (through shared()) and expirations in the shared tier
+// are only noticed once a local entry is older than maxStaleness.
+//--------------------------------------------------------------------
+
+template <typename Key, typename Value,
+          typename Cache = HashLruCache<Key, Value>,
+          typename Hash = MixedHash<Key>>
+class NearCache {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    // localCapacity entries per thread, rounded up to a power of two;
+    // maxStaleness zero means local entries never age out; sharedArgs
+    // are forwarded to the shared cache
+    template <typename... Args>
+    NearCache(size_t localCapacity, std::chrono::milliseconds maxStaleness,
+              Args &&...sharedArgs)
+        : _shared(std::forward<Args>(sharedArgs)...),
+          _localCapacity(round_upPowerOfTwo(localCapacity)),
+          _maxStaleness(maxStaleness),
+          _id(nextId().fetch_add(1, std::memory_order_relaxed)),
+          _generations(new std::atomic<uint64_t>[kStripes]) {
+        for (size_t i = 0; i < kStripes; ++i) {
+            _generations[i].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    NearCache(const NearCache &) = delete;
+    NearCache &operator=(const NearCache &) = delete;
+
+    void put(const Key &key, const Value &value) {
+        _shared.put(key, value);
+        bump(_hasher(key));
+    }
+
+    void put(Key &&key, Value &&value) {
+        size_t hash = _hasher(key);
+        _shared.put(std::move(key), std::move(value));
+        bump(hash);
+    }
+
+    void remove(const Key &key) {
+        _shared.remove(key);
+        bump(_hasher(key));
+    }
+
+    bool get(const Key &key, Value &value) {
+        size_t hash = _hasher(key);
+        LocalTable &local = local_table();
+        LocalEntry &entry = local.entries[slice_of(hash, local.mask)];
+        std::atomic<uint64_t> &generation = _generations[hash & (kStripes - 1)];
+        uint64_t current = generation.load(std::memory_order_acquire);
+        Clock::time_point now =
+            _maxStaleness.count() > 0 ? Clock::now() : Clock::time_point();
+
+        if (entry.valid && entry.hash == hash && entry.generation == current &&
+            entry.key == key &&
+            (_maxStaleness.count() == 0 || now - entry.loadedAt <= _maxStaleness)) {
+            ++local.hits;
+            value = entry.value;
+            return true;
+        }
+
+        ++local.misses;
+        // current was read before the shared tier, so a write racing
+        // with this read leaves the copy under an outdated generation
+        if (!_shared.get(key, value)) {
+            return false;
+        }
+        // a slot is only given to a key on its second miss in a row,
+        // so one-off reads do not push out the hot set
+        if (entry.missHash != hash) {
+            entry.missHash = hash;
+            return true;
+        }
+        entry.valid = true;
+        entry.hash = hash;
+        entry.generation = current;
+        entry.loadedAt = now;
+        entry.key = key;
+        entry.value = value;
+        return true;
+    }
+
+    Value get(const Key &key) {
+        Value value{};
+        get(key, value);
+        return value;
+    }
+
+    // writes through here are not seen by the local tables until they
+    // age out, see maxStaleness
+    Cache &shared() { return _shared; }
+
+    // local hit and miss counts of the calling thread
+    std::pair<uint64_t, uint64_t> local_stats() {
+        LocalTable &local = local_table();
+        return {local.hits, local.misses};
+    }
+
+private:
+    static constexpr size_t kStripes = 4096;
+
+    struct LocalEntry {
+        Key key{};
+        Value value{};
+        size_t hash = 0;
+        size_t missHash = 0;
+        uint64_t generation = 0;
+        Clock::time_point loadedAt{};
+        bool valid = false;
+    };
+
+    struct LocalTable {
+        explicit LocalTable(size_t capacity)
+            : entries(capacity), mask(capacity - 1) {}
+
+        std::vector<LocalEntry> entries;
+        size_t mask;
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+    };
+
+    static std::atomic<uint64_t> &nextId() {
+        static std::atomic<uint64_t> id{1};
+        return id;
+    }
+
+    void bump(size_t hash) {
+        _generations[hash & (kStripes - 1)].fetch_add(1,
+                                                      std::memory_order_release);
+    }
+
+    // tables are owned by the NearCache and found through a per-thread
+    // map keyed by a never reused id, so a destroyed cache leaves only a
+    // dead map entry behind in each thread that used it
+    LocalTable &local_table() {
+        thread_local uint64_t lastId = 0;
+        thread_local void *lastTable = nullptr;
+        if (lastId == _id) {
+            return *static_cast<LocalTable *>(lastTable);
+        }
+
+        thread_local std::unordered_map<uint64_t, void *> tables;
+        void *&table = tables[_id];
+        if (!table) {
+            std::lock_guard<std::mutex> lock(_tablesMutex);
+            _tables.push_back(std::make_unique<LocalTable>(_localCapacity));
+            table = _tables.back().get();
+        }
+        lastId = _id;
+        lastTable = table;
+        return *static_cast<LocalTable *>(table);
+    }
+
+private:
+    Cache _shared;
+    Hash _hasher;
+    const size_t _localCapacity;
+    const std::chrono::milliseconds _maxStaleness;
+    const uint64_t _id;
+    std::unique_ptr<std::atomic<uint64_t>[]> _generations;
+    std::mutex _tablesMutex;
+    std::vector<std::unique_ptr<LocalTable>> _tables;
+};
+
+} // namespace MinCache
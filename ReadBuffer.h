@@ -0,0 +1,80 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <thread>
+
+namespace MinCache {
+
+//--------------------------------------------------------------------
+// ReadBuffer: lossy multi-producer ring buffer of slab indices.
+// Readers record hits while holding only a shared lock, the holder of
+// the exclusive lock replays them in batches. When a stripe is full the
+// access is simply dropped, recency is kept approximately.
+//--------------------------------------------------------------------
+
+template <size_t Capacity = 64, size_t StripeNum = 4> class ReadBuffer {
+    static_assert((Capacity & (Capacity - 1)) == 0,
+                  "Capacity must be a power of two");
+    static_assert((StripeNum & (StripeNum - 1)) == 0,
+                  "StripeNum must be a power of two");
+
+public:
+    // returns true once the stripe is half full and should be drained
+    bool record(uint32_t index) {
+        Stripe &stripe = _stripes[stripe_index()];
+        uint64_t head = stripe.head.load(std::memory_order_acquire);
+        uint64_t tail = stripe.tail.load(std::memory_order_relaxed);
+        uint64_t size = tail - head;
+        if (size >= Capacity) {
+            return true;
+        }
+
+        // lose the record rather than retry when another reader races us
+        if (stripe.tail.compare_exchange_weak(tail, tail + 1,
+                                              std::memory_order_relaxed)) {
+            stripe.slots[tail & (Capacity - 1)].store(
+                index + 1, std::memory_order_release);
+        }
+        return size + 1 >= Capacity / 2;
+    }
+
+    // must only be called by the exclusive lock holder
+    template <typename Func> void drain(Func &&func) {
+        for (Stripe &stripe : _stripes) {
+            uint64_t head = stripe.head.load(std::memory_order_relaxed);
+            uint64_t tail = stripe.tail.load(std::memory_order_acquire);
+            while (head != tail) {
+                // a zero slot is claimed by a reader that is still writing it
+                uint32_t value = stripe.slots[head & (Capacity - 1)].exchange(
+                    0, std::memory_order_acquire);
+                if (value == 0) {
+                    break;
+                }
+                func(value - 1);
+                ++head;
+            }
+            stripe.head.store(head, std::memory_order_release);
+        }
+    }
+
+private:
+    static size_t stripe_index() {
+        thread_local size_t index =
+            std::hash<std::thread::id>()(std::this_thread::get_id());
+        return index & (StripeNum - 1);
+    }
+
+private:
+    struct alignas(64) Stripe {
+        std::atomic<uint64_t> head{0};
+        alignas(64) std::atomic<uint64_t> tail{0};
+        std::atomic<uint32_t> slots[Capacity] = {};
+    };
+
+    Stripe _stripes[StripeNum];
+};
+
+} // namespace MinCache
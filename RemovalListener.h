@@ -0,0 +1,216 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace MinCache {
+
+enum class RemovalCause {
+    kEvicted,  // pushed out to make room
+    kExpired,  // its ttl ran out
+    kReplaced, // overwritten by a put, the old value is reported
+    kExplicit  // remove()
+};
+
+template <typename Key, typename Value> struct Removal {
+    Key key;
+    Value value;
+    RemovalCause cause;
+};
+
+// set on dispatcher threads: a listener writing to the cache must not
+// wait for room in the queues only its own thread drains
+inline bool &on_removalDispatcher() {
+    thread_local bool onDispatcher = false;
+    return onDispatcher;
+}
+
+// removals queued over all slices before overflow kicks in
+constexpr size_t kDefaultRemovalCapacity = 1 << 16;
+
+// what a full removal queue does to the writers feeding it
+enum class RemovalOverflow {
+    kDrop, // further removals are not reported, see dropped()
+    // writers wait for room before taking a slice lock. Reads never
+    // wait, so expirations they find may go past capacity; at twice
+    // capacity those are dropped as with kDrop
+    kBlock
+};
+
+//--------------------------------------------------------------------
+// RemovalQueue: removals of one slice waiting for delivery. push runs
+// under the slice lock and only moves the entry into a vector; the
+// dispatcher swaps the vector out under the queue's own mutex, which
+// nothing else holds for longer than a push.
+//--------------------------------------------------------------------
+
+template <typename Key, typename Value> class RemovalQueue {
+public:
+    RemovalQueue(size_t capacity, RemovalOverflow overflow,
+                 std::function<void()> wakeDispatcher)
+        : _capacity(capacity > 0 ? capacity : 1), _overflow(overflow),
+          _wakeDispatcher(std::move(wakeDispatcher)) {}
+
+    void push(Key &&key, Value &&value, RemovalCause cause) {
+        bool wake;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            // blocking writers waited for room up front, a single write
+            // can still push a few past capacity, reads any number
+            size_t limit = _overflow == RemovalOverflow::kDrop
+                               ? _capacity
+                               : kBlockSlack * _capacity;
+            if (_pending.size() >= limit) {
+                ++_dropped;
+                return;
+            }
+            _pending.push_back({std::move(key), std::move(value), cause});
+            _size.store(_pending.size(), std::memory_order_relaxed);
+            wake = _pending.size() == kBatchSize || _pending.size() == _capacity;
+        }
+        if (wake) {
+            _wakeDispatcher();
+        }
+    }
+
+    // called before a write takes the slice lock
+    void wait_forRoom() {
+        if (_overflow != RemovalOverflow::kBlock ||
+            _size.load(std::memory_order_relaxed) < _capacity ||
+            on_removalDispatcher()) {
+            return;
+        }
+        _wakeDispatcher();
+        std::unique_lock<std::mutex> lock(_mutex);
+        _room.wait(lock, [this] { return _pending.size() < _capacity; });
+    }
+
+    // swaps the pending removals into batch, which should be empty
+    void take(std::vector<Removal<Key, Value>> &batch) {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            batch.swap(_pending);
+            _size.store(0, std::memory_order_relaxed);
+        }
+        _room.notify_all();
+    }
+
+    uint64_t dropped() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _dropped;
+    }
+
+private:
+    static constexpr size_t kBatchSize = 64;
+    static constexpr size_t kBlockSlack = 2;
+
+    const size_t _capacity;
+    const RemovalOverflow _overflow;
+    std::function<void()> _wakeDispatcher;
+    std::mutex _mutex;
+    std::condition_variable _room;
+    std::vector<Removal<Key, Value>> _pending;
+    std::atomic<size_t> _size{0};
+    uint64_t _dropped = 0;
+};
+
+//--------------------------------------------------------------------
+// RemovalDispatcher: one queue per slice and a thread that hands their
+// contents to the listener in batches, at the latest kDeliveryInterval
+// after a removal. The listener runs on that thread only and may call
+// back into the cache; whatever is still queued is delivered before
+// the dispatcher goes away.
+//--------------------------------------------------------------------
+
+template <typename Key, typename Value> class RemovalDispatcher {
+public:
+    using Listener = std::function<void(std::vector<Removal<Key, Value>> &)>;
+
+    RemovalDispatcher(size_t queues, size_t capacity, RemovalOverflow overflow,
+                      Listener listener)
+        : _listener(std::move(listener)) {
+        size_t queueCapacity = (capacity + queues - 1) / queues;
+        for (size_t i = 0; i < queues; ++i) {
+            _queues.push_back(std::make_unique<RemovalQueue<Key, Value>>(
+                queueCapacity, overflow, [this] { wake(); }));
+        }
+        _worker = std::thread([this] { run(); });
+    }
+
+    ~RemovalDispatcher() {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stop = true;
+        }
+        _wakeCond.notify_one();
+        _worker.join();
+    }
+
+    RemovalDispatcher(const RemovalDispatcher &) = delete;
+    RemovalDispatcher &operator=(const RemovalDispatcher &) = delete;
+
+    RemovalQueue<Key, Value> &queue(size_t index) { return *_queues[index]; }
+
+    uint64_t dropped() {
+        uint64_t total = 0;
+        for (auto &queue : _queues) {
+            total += queue->dropped();
+        }
+        return total;
+    }
+
+private:
+    static constexpr std::chrono::milliseconds kDeliveryInterval{10};
+
+    void wake() {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _signaled = true;
+        }
+        _wakeCond.notify_one();
+    }
+
+    void run() {
+        on_removalDispatcher() = true;
+        std::vector<Removal<Key, Value>> batch;
+        std::unique_lock<std::mutex> lock(_mutex);
+        while (true) {
+            _wakeCond.wait_for(lock, kDeliveryInterval,
+                               [this] { return _stop || _signaled; });
+            bool stop = _stop;
+            _signaled = false;
+            lock.unlock();
+            for (auto &queue : _queues) {
+                queue->take(batch);
+                if (!batch.empty()) {
+                    _listener(batch);
+                    batch.clear();
+                }
+            }
+            if (stop) {
+                return;
+            }
+            lock.lock();
+        }
+    }
+
+private:
+    Listener _listener;
+    std::vector<std::unique_ptr<RemovalQueue<Key, Value>>> _queues;
+    std::mutex _mutex;
+    std::condition_variable _wakeCond;
+    bool _signaled = false;
+    bool _stop = false;
+    std::thread _worker;
+};
+
+} // namespace MinCache
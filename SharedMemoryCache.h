@@ -0,0 +1,731 @@
+#pragma once
+
+#include "CachePolicy.h"
+#include "CacheStats.h"
+#include "CacheUtil.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <pthread.h>
+#include <string>
+#include <string_view>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+
+namespace MinCache {
+
+//--------------------------------------------------------------------
+// SharedMemoryCache: an LRU cache of byte strings that lives entirely in
+// one POSIX shared memory object (or memory mapped file), so every
+// process on the host that opens the same name sees the same entries.
+//
+// The region is a header followed by shards. Each shard has a robust
+// process-shared mutex, a chained hash index, a node slab with an LRU
+// list and a value arena. Everything links by slot number or byte
+// offset, never by pointer, because every process maps the region at
+// its own address. The arena is a buddy allocator of power-of-two
+// blocks: a put splits the smallest free block that fits, and a freed
+// block merges with its free buddy, so space left by small values can
+// serve large ones again. A put that finds no block first evicts a
+// nearby least recent entry of its own size, then keeps evicting from
+// the LRU tail until enough space has merged.
+//
+// A process that dies while holding a shard lock leaves the shard
+// suspect; the next locker gets EOWNERDEAD, empties the shard and marks
+// the mutex consistent again.
+//--------------------------------------------------------------------
+
+class SharedMemoryCache : public CachePolicy<std::string, std::string> {
+public:
+    // names with a single leading '/' are POSIX shared memory objects,
+    // anything else is a file path; the first process creates and sizes
+    // the region, later ones attach to it and ignore the sizes they pass
+    SharedMemoryCache(const std::string &name, size_t capacity,
+                      size_t arenaBytes, size_t shardNum = 8)
+        : _base(nullptr), _size(0) {
+        open_region(name, capacity, arenaBytes,
+                    round_upPowerOfTwo(shardNum > 0 ? shardNum : 1));
+    }
+
+    ~SharedMemoryCache() override {
+        if (_base) {
+            ::munmap(_base, _size);
+        }
+    }
+
+    SharedMemoryCache(const SharedMemoryCache &) = delete;
+    SharedMemoryCache &operator=(const SharedMemoryCache &) = delete;
+
+    bool is_open() const { return _base != nullptr; }
+
+    // deletes the named region; processes that have it open keep it
+    static bool unlink(const std::string &name) {
+        return is_shmName(name) ? ::shm_unlink(name.c_str()) == 0
+                                : ::unlink(name.c_str()) == 0;
+    }
+
+    void put(const std::string &key, const std::string &value) override {
+        store(key, value);
+    }
+
+    bool get(const std::string &key, std::string &value) override {
+        return load(key, value);
+    }
+
+    std::string get(const std::string &key) override {
+        std::string value;
+        load(key, value);
+        return value;
+    }
+
+    // false if the entry is larger than the biggest block or the shard
+    // ran out of entries to evict for it; put is store without the result
+    bool store(std::string_view key, std::string_view value);
+    bool load(std::string_view key, std::string &value);
+    bool remove(std::string_view key);
+
+    size_t size();
+
+    CacheStatsSnapshot stats();
+
+private:
+    static constexpr uint64_t kMagic = 0x4d696e4361636865ULL; // "MinCache"
+    static constexpr uint32_t kVersion = 2;
+    static constexpr uint32_t kInitializing = 0;
+    static constexpr uint32_t kReady = 1;
+    static constexpr uint32_t kNil = UINT32_MAX;
+    static constexpr uint64_t kNilOffset = UINT64_MAX;
+    static constexpr size_t kMinBlock = 64;
+    static constexpr size_t kClassCount = 16;
+    // how far from the LRU tail a put looks for an entry of its size
+    static constexpr size_t kEvictScan = 64;
+    // block state byte: the class, with kFreeBlock set while it is free
+    static constexpr uint8_t kFreeBlock = 0x80;
+
+    static_assert(std::atomic<uint32_t>::is_always_lock_free,
+                  "the region header needs address-free atomics");
+
+    struct RegionHeader {
+        uint64_t magic;
+        uint32_t version;
+        std::atomic<uint32_t> state;
+        uint64_t regionSize;
+        uint64_t shardOffset;
+        uint64_t shardBytes;
+        uint32_t shardNum;
+    };
+
+    struct Node {
+        uint64_t hash;
+        uint64_t block; // arena offset of key bytes followed by value bytes
+        uint32_t chainNext;
+        uint32_t prev;
+        uint32_t next;
+        uint32_t keyLen;
+        uint32_t valueLen;
+        uint32_t blockClass;
+    };
+
+    // all offsets are relative to the shard start
+    struct ShardHeader {
+        pthread_mutex_t mutex;
+        uint64_t bucketOffset;
+        uint64_t nodeOffset;
+        uint64_t arenaOffset;
+        uint64_t arenaSize;
+        // one state byte per kMinBlock of arena, valid at block starts
+        uint64_t stateOffset;
+        // doubly linked through the first 16 bytes of each free block
+        uint64_t freeBlocks[kClassCount];
+        uint32_t maxClass; // largest block the arena holds
+        uint32_t capacity;
+        uint32_t bucketCount;
+        uint32_t count;
+        uint32_t freeNode;
+        uint32_t head; // most recently used
+        uint32_t tail;
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t inserts;
+        uint64_t updates;
+        uint64_t evictions;
+    };
+
+    // typed views of one shard inside the mapping of this process
+    struct Shard {
+        ShardHeader *header;
+        uint32_t *buckets;
+        Node *nodes;
+        char *arena;
+        uint8_t *states;
+    };
+
+    // locks a shard, emptying it if the previous owner died holding it
+    class ShardLock {
+    public:
+        explicit ShardLock(Shard &shard) : _shard(shard), _locked(false) {
+            int rc = ::pthread_mutex_lock(&shard.header->mutex);
+            if (rc == EOWNERDEAD) {
+                reset_shard(shard);
+                ::pthread_mutex_consistent(&shard.header->mutex);
+                rc = 0;
+            }
+            _locked = rc == 0;
+        }
+
+        ~ShardLock() {
+            if (_locked) {
+                ::pthread_mutex_unlock(&_shard.header->mutex);
+            }
+        }
+
+        ShardLock(const ShardLock &) = delete;
+        ShardLock &operator=(const ShardLock &) = delete;
+
+        bool locked() const { return _locked; }
+
+    private:
+        Shard &_shard;
+        bool _locked;
+    };
+
+    static bool is_shmName(const std::string &name) {
+        return name.size() > 1 && name[0] == '/' &&
+               name.find('/', 1) == std::string::npos;
+    }
+
+    static uint64_t align_up(uint64_t n) { return (n + 63) & ~uint64_t(63); }
+
+    // FNV-1a, identical in every process unlike std::hash
+    static uint64_t hash_bytes(std::string_view bytes) {
+        uint64_t hash = 0xcbf29ce484222325ULL;
+        for (unsigned char c : bytes) {
+            hash = (hash ^ c) * 0x100000001b3ULL;
+        }
+        return mix_hash(hash);
+    }
+
+    static size_t class_of(size_t bytes) {
+        size_t blockClass = 0;
+        while (blockClass < kClassCount && (kMinBlock << blockClass) < bytes) {
+            ++blockClass;
+        }
+        return blockClass;
+    }
+
+    RegionHeader *region() const {
+        return reinterpret_cast<RegionHeader *>(_base);
+    }
+
+    Shard shard(size_t index) const {
+        char *start = static_cast<char *>(_base) + region()->shardOffset +
+                      index * region()->shardBytes;
+        ShardHeader *header = reinterpret_cast<ShardHeader *>(start);
+        return {header, reinterpret_cast<uint32_t *>(start + header->bucketOffset),
+                reinterpret_cast<Node *>(start + header->nodeOffset),
+                start + header->arenaOffset,
+                reinterpret_cast<uint8_t *>(start + header->stateOffset)};
+    }
+
+    Shard shard_of(uint64_t hash) const {
+        return shard(slice_of(static_cast<size_t>(hash),
+                              region()->shardNum - 1));
+    }
+
+    static std::string_view key_of(const Shard &shard, const Node &node) {
+        return {shard.arena + node.block, node.keyLen};
+    }
+
+    void open_region(const std::string &name, size_t capacity,
+                     size_t arenaBytes, size_t shardNum);
+    bool wait_ready(int fd);
+    void initialize(size_t capacity, size_t arenaBytes, size_t shardNum,
+                    uint64_t shardBytes);
+    static uint64_t shard_bytes(uint32_t capacity, uint64_t arenaSize);
+    static void reset_shard(Shard &shard);
+
+    static uint32_t find_node(const Shard &shard, uint64_t hash,
+                              std::string_view key);
+    static void unlink_lru(Shard &shard, uint32_t index);
+    static void link_front(Shard &shard, uint32_t index);
+    static void erase_node(Shard &shard, uint32_t index);
+    static uint64_t block_size(size_t blockClass) {
+        return uint64_t(kMinBlock) << blockClass;
+    }
+    static void push_free(Shard &shard, uint64_t block, size_t blockClass);
+    static void unlink_free(Shard &shard, uint64_t block, size_t blockClass);
+    static uint64_t alloc_block(Shard &shard, size_t blockClass);
+    static void free_block(Shard &shard, uint64_t block, size_t blockClass);
+    static uint64_t evict_for(Shard &shard, size_t blockClass, uint32_t keep);
+
+private:
+    void *_base;
+    size_t _size;
+};
+
+inline void SharedMemoryCache::open_region(const std::string &name,
+                                           size_t capacity, size_t arenaBytes,
+                                           size_t shardNum) {
+    bool shm = is_shmName(name);
+    auto openFile = [&](int flags) {
+        return shm ? ::shm_open(name.c_str(), flags, 0600)
+                   : ::open(name.c_str(), flags, 0600);
+    };
+
+    uint32_t shardCapacity =
+        static_cast<uint32_t>((capacity + shardNum - 1) / shardNum);
+    uint64_t shardArena = align_up(arenaBytes / shardNum);
+    uint64_t shardBytes = shard_bytes(shardCapacity, shardArena);
+    uint64_t regionSize = align_up(sizeof(RegionHeader)) + shardNum * shardBytes;
+
+    int fd = openFile(O_RDWR | O_CREAT | O_EXCL);
+    bool creator = fd >= 0;
+    if (!creator) {
+        if (errno != EEXIST || (fd = openFile(O_RDWR)) < 0) {
+            return;
+        }
+        if (!wait_ready(fd)) {
+            ::close(fd);
+            return;
+        }
+        struct stat st;
+        ::fstat(fd, &st);
+        regionSize = static_cast<uint64_t>(st.st_size);
+    } else if (::ftruncate(fd, static_cast<off_t>(regionSize)) != 0) {
+        ::close(fd);
+        unlink(name);
+        return;
+    }
+
+    void *base = ::mmap(nullptr, regionSize, PROT_READ | PROT_WRITE,
+                        MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (base == MAP_FAILED) {
+        return;
+    }
+    _base = base;
+    _size = regionSize;
+
+    if (creator) {
+        initialize(shardCapacity, shardArena, shardNum, shardBytes);
+    } else if (region()->magic != kMagic || region()->version != kVersion ||
+               region()->regionSize != regionSize) {
+        ::munmap(_base, _size);
+        _base = nullptr;
+        _size = 0;
+    }
+}
+
+// an attacher waits until the creator has sized and initialised the
+// region, for at most a few seconds
+inline bool SharedMemoryCache::wait_ready(int fd) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (std::chrono::steady_clock::now() < deadline) {
+        struct stat st;
+        if (::fstat(fd, &st) == 0 &&
+            static_cast<size_t>(st.st_size) >= sizeof(RegionHeader)) {
+            void *header = ::mmap(nullptr, sizeof(RegionHeader), PROT_READ,
+                                  MAP_SHARED, fd, 0);
+            if (header != MAP_FAILED) {
+                bool ready = static_cast<RegionHeader *>(header)->state.load(
+                                 std::memory_order_acquire) == kReady;
+                ::munmap(header, sizeof(RegionHeader));
+                if (ready) {
+                    return true;
+                }
+            }
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return false;
+}
+
+inline uint64_t SharedMemoryCache::shard_bytes(uint32_t capacity,
+                                               uint64_t arenaSize) {
+    uint64_t buckets = round_upPowerOfTwo(capacity > 0 ? capacity : 1);
+    return align_up(sizeof(ShardHeader)) + align_up(buckets * sizeof(uint32_t)) +
+           align_up(uint64_t(capacity) * sizeof(Node)) + arenaSize +
+           align_up(arenaSize / kMinBlock);
+}
+
+inline void SharedMemoryCache::initialize(size_t capacity, size_t arenaBytes,
+                                          size_t shardNum,
+                                          uint64_t shardBytes) {
+    RegionHeader *header = region();
+    header->magic = kMagic;
+    header->version = kVersion;
+    header->regionSize = _size;
+    header->shardOffset = align_up(sizeof(RegionHeader));
+    header->shardBytes = shardBytes;
+    header->shardNum = static_cast<uint32_t>(shardNum);
+
+    for (size_t i = 0; i < shardNum; ++i) {
+        char *start =
+            static_cast<char *>(_base) + header->shardOffset + i * shardBytes;
+        ShardHeader *shardHeader = reinterpret_cast<ShardHeader *>(start);
+        shardHeader->capacity = static_cast<uint32_t>(capacity);
+        shardHeader->bucketCount =
+            static_cast<uint32_t>(round_upPowerOfTwo(capacity > 0 ? capacity : 1));
+        shardHeader->bucketOffset = align_up(sizeof(ShardHeader));
+        shardHeader->nodeOffset =
+            shardHeader->bucketOffset +
+            align_up(uint64_t(shardHeader->bucketCount) * sizeof(uint32_t));
+        shardHeader->arenaOffset =
+            shardHeader->nodeOffset + align_up(uint64_t(capacity) * sizeof(Node));
+        shardHeader->arenaSize = arenaBytes;
+        shardHeader->stateOffset = shardHeader->arenaOffset + arenaBytes;
+
+        pthread_mutexattr_t attr;
+        ::pthread_mutexattr_init(&attr);
+        ::pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+        ::pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+        ::pthread_mutex_init(&shardHeader->mutex, &attr);
+        ::pthread_mutexattr_destroy(&attr);
+
+        Shard view = shard(i);
+        reset_shard(view);
+    }
+    header->state.store(kReady, std::memory_order_release);
+}
+
+// drops every entry of the shard, leaving its layout and mutex alone
+inline void SharedMemoryCache::reset_shard(Shard &shard) {
+    ShardHeader *header = shard.header;
+    for (uint32_t i = 0; i < header->bucketCount; ++i) {
+        shard.buckets[i] = kNil;
+    }
+    for (uint32_t i = 0; i < header->capacity; ++i) {
+        shard.nodes[i].chainNext = i + 1 < header->capacity ? i + 1 : kNil;
+    }
+    for (uint64_t &freeBlock : header->freeBlocks) {
+        freeBlock = kNilOffset;
+    }
+    // carve the arena into the largest aligned blocks that fit; a block
+    // can later merge only with a buddy inside the same carved block
+    header->maxClass = 0;
+    uint64_t offset = 0;
+    while (offset + kMinBlock <= header->arenaSize) {
+        size_t blockClass = kClassCount - 1;
+        while (offset % block_size(blockClass) != 0 ||
+               offset + block_size(blockClass) > header->arenaSize) {
+            --blockClass;
+        }
+        header->maxClass =
+            std::max(header->maxClass, static_cast<uint32_t>(blockClass));
+        push_free(shard, offset, blockClass);
+        offset += block_size(blockClass);
+    }
+    header->freeNode = header->capacity > 0 ? 0 : kNil;
+    header->count = 0;
+    header->head = kNil;
+    header->tail = kNil;
+}
+
+inline uint32_t SharedMemoryCache::find_node(const Shard &shard, uint64_t hash,
+                                             std::string_view key) {
+    uint32_t index = shard.buckets[hash & (shard.header->bucketCount - 1)];
+    while (index != kNil) {
+        const Node &node = shard.nodes[index];
+        if (node.hash == hash && key_of(shard, node) == key) {
+            return index;
+        }
+        index = node.chainNext;
+    }
+    return kNil;
+}
+
+inline void SharedMemoryCache::unlink_lru(Shard &shard, uint32_t index) {
+    Node &node = shard.nodes[index];
+    if (node.prev != kNil) {
+        shard.nodes[node.prev].next = node.next;
+    } else {
+        shard.header->head = node.next;
+    }
+    if (node.next != kNil) {
+        shard.nodes[node.next].prev = node.prev;
+    } else {
+        shard.header->tail = node.prev;
+    }
+}
+
+inline void SharedMemoryCache::link_front(Shard &shard, uint32_t index) {
+    Node &node = shard.nodes[index];
+    node.prev = kNil;
+    node.next = shard.header->head;
+    if (node.next != kNil) {
+        shard.nodes[node.next].prev = index;
+    } else {
+        shard.header->tail = index;
+    }
+    shard.header->head = index;
+}
+
+// unlinks the node and returns its block and slot to the free lists
+inline void SharedMemoryCache::erase_node(Shard &shard, uint32_t index) {
+    Node &node = shard.nodes[index];
+    uint32_t *link = &shard.buckets[node.hash & (shard.header->bucketCount - 1)];
+    while (*link != index) {
+        link = &shard.nodes[*link].chainNext;
+    }
+    *link = node.chainNext;
+    unlink_lru(shard, index);
+
+    free_block(shard, node.block, node.blockClass);
+
+    node.chainNext = shard.header->freeNode;
+    shard.header->freeNode = index;
+    --shard.header->count;
+}
+
+inline void SharedMemoryCache::push_free(Shard &shard, uint64_t block,
+                                          size_t blockClass) {
+    uint64_t links[2] = {shard.header->freeBlocks[blockClass], kNilOffset};
+    if (links[0] != kNilOffset) {
+        std::memcpy(shard.arena + links[0] + sizeof(uint64_t), &block,
+                    sizeof(uint64_t));
+    }
+    std::memcpy(shard.arena + block, links, sizeof(links));
+    shard.header->freeBlocks[blockClass] = block;
+    shard.states[block / kMinBlock] =
+        static_cast<uint8_t>(blockClass) | kFreeBlock;
+}
+
+inline void SharedMemoryCache::unlink_free(Shard &shard, uint64_t block,
+                                           size_t blockClass) {
+    uint64_t links[2]; // next, prev
+    std::memcpy(links, shard.arena + block, sizeof(links));
+    if (links[1] != kNilOffset) {
+        std::memcpy(shard.arena + links[1], &links[0], sizeof(uint64_t));
+    } else {
+        shard.header->freeBlocks[blockClass] = links[0];
+    }
+    if (links[0] != kNilOffset) {
+        std::memcpy(shard.arena + links[0] + sizeof(uint64_t), &links[1],
+                    sizeof(uint64_t));
+    }
+    shard.states[block / kMinBlock] = static_cast<uint8_t>(blockClass);
+}
+
+// takes the smallest free block of at least blockClass and splits it
+// down, the upper halves going back to the free lists
+inline uint64_t SharedMemoryCache::alloc_block(Shard &shard, size_t blockClass) {
+    ShardHeader *header = shard.header;
+    size_t from = blockClass;
+    while (from <= header->maxClass && header->freeBlocks[from] == kNilOffset) {
+        ++from;
+    }
+    if (from > header->maxClass) {
+        return kNilOffset;
+    }
+    uint64_t block = header->freeBlocks[from];
+    unlink_free(shard, block, from);
+    while (from > blockClass) {
+        --from;
+        push_free(shard, block + block_size(from), from);
+    }
+    shard.states[block / kMinBlock] = static_cast<uint8_t>(blockClass);
+    return block;
+}
+
+// merges the block with its buddy for as long as the buddy is free and
+// whole, then puts the result on its free list
+inline void SharedMemoryCache::free_block(Shard &shard, uint64_t block,
+                                          size_t blockClass) {
+    while (blockClass < shard.header->maxClass) {
+        uint64_t size = block_size(blockClass);
+        uint64_t parent = block & ~(2 * size - 1);
+        uint64_t buddy = block ^ size;
+        if (parent + 2 * size > shard.header->arenaSize ||
+            shard.states[buddy / kMinBlock] !=
+                (static_cast<uint8_t>(blockClass) | kFreeBlock)) {
+            break;
+        }
+        unlink_free(shard, buddy, blockClass);
+        block = parent;
+        ++blockClass;
+    }
+    push_free(shard, block, blockClass);
+}
+
+// frees space for a block of blockClass without touching entry keep:
+// first the least recent entry of that size near the tail, which frees
+// exactly one block, then whole LRU tail entries until enough space has
+// merged. kNilOffset if the shard ran out of entries to evict
+inline uint64_t SharedMemoryCache::evict_for(Shard &shard, size_t blockClass,
+                                             uint32_t keep) {
+    uint32_t index = shard.header->tail;
+    for (size_t scanned = 0; index != kNil && scanned < kEvictScan; ++scanned) {
+        if (index != keep && shard.nodes[index].blockClass == blockClass) {
+            erase_node(shard, index);
+            ++shard.header->evictions;
+            return alloc_block(shard, blockClass);
+        }
+        index = shard.nodes[index].prev;
+    }
+
+    while (true) {
+        index = shard.header->tail;
+        if (index == keep) {
+            index = shard.nodes[index].prev;
+        }
+        if (index == kNil) {
+            return kNilOffset;
+        }
+        erase_node(shard, index);
+        ++shard.header->evictions;
+        uint64_t block = alloc_block(shard, blockClass);
+        if (block != kNilOffset) {
+            return block;
+        }
+    }
+}
+
+inline bool SharedMemoryCache::store(std::string_view key,
+                                     std::string_view value) {
+    size_t blockClass = class_of(key.size() + value.size());
+    if (!_base || blockClass == kClassCount) {
+        return false;
+    }
+
+    uint64_t hash = hash_bytes(key);
+    Shard shard = shard_of(hash);
+    ShardLock lock(shard);
+    if (!lock.locked() || shard.header->capacity == 0 ||
+        blockClass > shard.header->maxClass) {
+        return false;
+    }
+
+    uint32_t index = find_node(shard, hash, key);
+    if (index != kNil && shard.nodes[index].blockClass == blockClass) {
+        Node &node = shard.nodes[index];
+        std::memcpy(shard.arena + node.block + node.keyLen, value.data(),
+                    value.size());
+        node.valueLen = static_cast<uint32_t>(value.size());
+        unlink_lru(shard, index);
+        link_front(shard, index);
+        ++shard.header->updates;
+        return true;
+    }
+    // a value that changes size class moves to a new block; the old
+    // entry stays until that block is secured, so a failed put keeps it
+    uint32_t old = index;
+    if (old == kNil && shard.header->count == shard.header->capacity) {
+        erase_node(shard, shard.header->tail);
+        ++shard.header->evictions;
+    }
+    uint64_t block = alloc_block(shard, blockClass);
+    if (block == kNilOffset) {
+        block = evict_for(shard, blockClass, old);
+    }
+    bool update = old != kNil;
+    if (block == kNilOffset && update) {
+        // only the old entry is left in the way; once its block merges
+        // back the shard is empty, so a block of a class up to maxClass
+        // is certain
+        erase_node(shard, old);
+        old = kNil;
+        block = alloc_block(shard, blockClass);
+    }
+    if (block == kNilOffset) {
+        return false;
+    }
+    if (old != kNil) {
+        erase_node(shard, old);
+    }
+
+    index = shard.header->freeNode;
+    Node &node = shard.nodes[index];
+    shard.header->freeNode = node.chainNext;
+    ++shard.header->count;
+
+    node.hash = hash;
+    node.block = block;
+    node.keyLen = static_cast<uint32_t>(key.size());
+    node.valueLen = static_cast<uint32_t>(value.size());
+    node.blockClass = static_cast<uint32_t>(blockClass);
+    std::memcpy(shard.arena + block, key.data(), key.size());
+    std::memcpy(shard.arena + block + key.size(), value.data(), value.size());
+
+    uint32_t &bucket = shard.buckets[hash & (shard.header->bucketCount - 1)];
+    node.chainNext = bucket;
+    bucket = index;
+    link_front(shard, index);
+    ++(update ? shard.header->updates : shard.header->inserts);
+    return true;
+}
+
+inline bool SharedMemoryCache::load(std::string_view key, std::string &value) {
+    if (!_base) {
+        return false;
+    }
+    uint64_t hash = hash_bytes(key);
+    Shard shard = shard_of(hash);
+    ShardLock lock(shard);
+    if (!lock.locked()) {
+        return false;
+    }
+
+    uint32_t index = find_node(shard, hash, key);
+    if (index == kNil) {
+        ++shard.header->misses;
+        return false;
+    }
+    ++shard.header->hits;
+    const Node &node = shard.nodes[index];
+    value.assign(shard.arena + node.block + node.keyLen, node.valueLen);
+    unlink_lru(shard, index);
+    link_front(shard, index);
+    return true;
+}
+
+inline bool SharedMemoryCache::remove(std::string_view key) {
+    if (!_base) {
+        return false;
+    }
+    uint64_t hash = hash_bytes(key);
+    Shard shard = shard_of(hash);
+    ShardLock lock(shard);
+    if (!lock.locked()) {
+        return false;
+    }
+    uint32_t index = find_node(shard, hash, key);
+    if (index == kNil) {
+        return false;
+    }
+    erase_node(shard, index);
+    return true;
+}
+
+inline size_t SharedMemoryCache::size() {
+    size_t total = 0;
+    for (uint32_t i = 0; _base && i < region()->shardNum; ++i) {
+        Shard view = shard(i);
+        ShardLock lock(view);
+        total += view.header->count;
+    }
+    return total;
+}
+
+// counters are kept in the region, so they cover every process
+inline CacheStatsSnapshot SharedMemoryCache::stats() {
+    CacheStatsSnapshot total;
+    for (uint32_t i = 0; _base && i < region()->shardNum; ++i) {
+        Shard view = shard(i);
+        ShardLock lock(view);
+        total.hits += view.header->hits;
+        total.misses += view.header->misses;
+        total.inserts += view.header->inserts;
+        total.updates += view.header->updates;
+        total.evictions += view.header->evictions;
+    }
+    return total;
+}
+
+} // namespace MinCache
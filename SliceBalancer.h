@@ -0,0 +1,146 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <numeric>
+#include <vector>
+
+namespace MinCache {
+
+//--------------------------------------------------------------------
+// GhostFilter: approximate set of the most recently evicted key hashes.
+// A FIFO ring remembers which fingerprints to forget, a table of
+// counters answers membership; a counter can reach the ring size, so
+// they are as wide as the ring's entries. False positives only make a slice look
+// slightly hotter than it is.
+//--------------------------------------------------------------------
+
+class GhostFilter {
+public:
+    bool enabled() const { return !_ring.empty(); }
+
+    // forgets everything and remembers up to capacity evictions from now on
+    void resize(size_t capacity) {
+        _ring.assign(capacity, 0);
+        size_t tableSize = 1;
+        while (tableSize < capacity * 2) {
+            tableSize <<= 1;
+        }
+        _counts.assign(capacity ? tableSize : 0, 0);
+        _head = 0;
+        _size = 0;
+    }
+
+    void add(uint64_t hash) {
+        uint32_t fingerprint = fingerprint_of(hash);
+        if (_size == _ring.size()) {
+            --_counts[_ring[_head] & (_counts.size() - 1)];
+        } else {
+            ++_size;
+        }
+        _ring[_head] = fingerprint;
+        _head = _head + 1 == _ring.size() ? 0 : _head + 1;
+        ++_counts[fingerprint & (_counts.size() - 1)];
+    }
+
+    bool contains(uint64_t hash) const {
+        return _counts[fingerprint_of(hash) & (_counts.size() - 1)] > 0;
+    }
+
+private:
+    static uint32_t fingerprint_of(uint64_t hash) {
+        hash *= 0x9e3779b97f4a7c15ULL;
+        return static_cast<uint32_t>(hash >> 32);
+    }
+
+private:
+    std::vector<uint32_t> _ring;
+    std::vector<uint32_t> _counts;
+    size_t _head = 0;
+    size_t _size = 0;
+};
+
+// what a slice reports since the previous rebalance
+struct SlicePressure {
+    uint64_t evictions = 0;
+    uint64_t ghostHits = 0;
+    size_t size = 0;
+    size_t capacity = 0;
+};
+
+// Moves capacity from the slices that gain least from it to the ones whose
+// misses most often hit recently evicted keys, keeping the total fixed.
+// Each round only shifts a small step between a few pairs so a burst does
+// not swing the layout; no slice drops below minCapacity.
+inline std::vector<size_t>
+rebalance_capacities(const std::vector<SlicePressure> &slices,
+                     size_t minCapacity) {
+    std::vector<size_t> capacities(slices.size());
+    size_t total = 0;
+    for (size_t i = 0; i < slices.size(); ++i) {
+        capacities[i] = slices[i].capacity;
+        total += slices[i].capacity;
+    }
+    if (slices.size() < 2) {
+        return capacities;
+    }
+
+    // ghost hits are the hits a slice would have had with more room; a
+    // slice with free room has none to give up
+    std::vector<size_t> order(slices.size());
+    std::iota(order.begin(), order.end(), 0);
+    auto spare = [&](size_t i) {
+        return slices[i].capacity > slices[i].size
+                   ? slices[i].capacity - slices[i].size
+                   : 0;
+    };
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        if (slices[a].ghostHits != slices[b].ghostHits) {
+            return slices[a].ghostHits > slices[b].ghostHits;
+        }
+        return spare(a) < spare(b);
+    });
+
+    static constexpr uint64_t kMinGhostHits = 8;
+    size_t step = std::max<size_t>(total / slices.size() / 20, 1);
+    size_t pairs = std::max<size_t>(slices.size() / 4, 1);
+    for (size_t p = 0; p < pairs; ++p) {
+        size_t hot = order[p];
+        size_t cold = order[order.size() - 1 - p];
+        uint64_t hotHits = slices[hot].ghostHits;
+        uint64_t coldHits = slices[cold].ghostHits;
+        if (hotHits < kMinGhostHits || hotHits < 2 * coldHits + kMinGhostHits ||
+            capacities[cold] <= minCapacity) {
+            break;
+        }
+
+        size_t amount = std::min(step, capacities[cold] - minCapacity);
+        capacities[cold] -= amount;
+        capacities[hot] += amount;
+    }
+    return capacities;
+}
+
+// spreads total over the slices in proportion to their current share
+inline std::vector<size_t> scale_capacities(const std::vector<size_t> &current,
+                                            size_t total) {
+    std::vector<size_t> capacities(current.size());
+    size_t oldTotal = std::accumulate(current.begin(), current.end(),
+                                      static_cast<size_t>(0));
+    size_t assigned = 0;
+    for (size_t i = 0; i < current.size(); ++i) {
+        capacities[i] =
+            oldTotal ? static_cast<size_t>(static_cast<double>(current[i]) *
+                                           total / oldTotal)
+                     : total / current.size();
+        assigned += capacities[i];
+    }
+    for (size_t i = 0; assigned < total; i = (i + 1) % capacities.size()) {
+        ++capacities[i];
+        ++assigned;
+    }
+    return capacities;
+}
+
+} // namespace MinCache
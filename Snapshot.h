@@ -0,0 +1,465 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define MINCACHE_SNAPSHOT_POSIX
+#endif
+
+namespace MinCache {
+
+//--------------------------------------------------------------------
+// Snapshot files for warm restarts of HashLruCache and HashLfuCache.
+//
+// Layout: a fixed header, one index record per slice and then the
+// slices' record streams back to back. The header and the index are
+// covered by one CRC32C, every slice by its own, so a loader can check
+// and decode slices on separate threads straight out of the mapping.
+// Numbers are stored in host byte order; a file from a host of the other
+// byte order fails the magic check. A file is written under path.tmp and
+// renamed over path once complete, so a crash never leaves a torn
+// snapshot behind.
+//--------------------------------------------------------------------
+
+enum class SnapshotKind : uint32_t { kLru = 1, kLfu = 2 };
+
+// CRC32C (Castagnoli), slice-by-8
+inline uint32_t crc32c(const void *data, size_t size, uint32_t crc = 0) {
+    struct Tables {
+        uint32_t t[8][256];
+        Tables() {
+            for (uint32_t i = 0; i < 256; ++i) {
+                uint32_t c = i;
+                for (int k = 0; k < 8; ++k) {
+                    c = c & 1 ? (c >> 1) ^ 0x82f63b78 : c >> 1;
+                }
+                t[0][i] = c;
+            }
+            for (uint32_t i = 0; i < 256; ++i) {
+                for (int k = 1; k < 8; ++k) {
+                    t[k][i] = (t[k - 1][i] >> 8) ^ t[0][t[k - 1][i] & 0xff];
+                }
+            }
+        }
+    };
+    static const Tables tables;
+    const uint32_t(*t)[256] = tables.t;
+
+    const unsigned char *p = static_cast<const unsigned char *>(data);
+    crc = ~crc;
+    while (size >= 8) {
+        uint32_t low, high;
+        std::memcpy(&low, p, 4);
+        std::memcpy(&high, p + 4, 4);
+        low ^= crc;
+        crc = t[7][low & 0xff] ^ t[6][(low >> 8) & 0xff] ^
+              t[5][(low >> 16) & 0xff] ^ t[4][low >> 24] ^
+              t[3][high & 0xff] ^ t[2][(high >> 8) & 0xff] ^
+              t[1][(high >> 16) & 0xff] ^ t[0][high >> 24];
+        p += 8;
+        size -= 8;
+    }
+    while (size-- > 0) {
+        crc = (crc >> 8) ^ t[0][(crc ^ *p++) & 0xff];
+    }
+    return ~crc;
+}
+
+// LEB128, lengths and counters rarely need more than a byte or two
+inline void put_varint(std::string &out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<char>(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+}
+
+inline bool get_varint(const char *&p, const char *end, uint64_t &value) {
+    value = 0;
+    for (int shift = 0; shift < 64 && p < end; shift += 7) {
+        uint8_t byte = static_cast<uint8_t>(*p++);
+        value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// zigzag, so small negative numbers stay short too
+inline void put_signedVarint(std::string &out, int64_t value) {
+    put_varint(out, (static_cast<uint64_t>(value) << 1) ^
+                        static_cast<uint64_t>(value >> 63));
+}
+
+inline bool get_signedVarint(const char *&p, const char *end, int64_t &value) {
+    uint64_t raw;
+    if (!get_varint(p, end, raw)) {
+        return false;
+    }
+    value = static_cast<int64_t>(raw >> 1) ^ -static_cast<int64_t>(raw & 1);
+    return true;
+}
+
+// how keys and values are written into a snapshot: trivially copyable
+// types as their bytes, std::string length prefixed; specialize it for
+// anything else
+template <typename T> struct SnapshotCodec {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "specialize SnapshotCodec for this type");
+
+    static void encode(const T &value, std::string &out) {
+        out.append(reinterpret_cast<const char *>(&value), sizeof(T));
+    }
+
+    static bool decode(const char *&p, const char *end, T &value) {
+        if (static_cast<size_t>(end - p) < sizeof(T)) {
+            return false;
+        }
+        std::memcpy(&value, p, sizeof(T));
+        p += sizeof(T);
+        return true;
+    }
+};
+
+template <> struct SnapshotCodec<std::string> {
+    static void encode(const std::string &value, std::string &out) {
+        put_varint(out, value.size());
+        out.append(value);
+    }
+
+    static bool decode(const char *&p, const char *end, std::string &value) {
+        uint64_t size;
+        if (!get_varint(p, end, size) ||
+            size > static_cast<uint64_t>(end - p)) {
+            return false;
+        }
+        value.assign(p, static_cast<size_t>(size));
+        p += size;
+        return true;
+    }
+};
+
+struct SnapshotHeader {
+    // "MCSNAPv1" read as a little endian word
+    static constexpr uint64_t kMagic = 0x317650414e53434dULL;
+    static constexpr uint32_t kVersion = 1;
+
+    uint64_t magic;
+    uint32_t version;
+    uint32_t kind;
+    uint32_t sliceCount;
+    // over the header with crc zeroed and the whole slice index
+    uint32_t crc;
+};
+
+struct SnapshotSlice {
+    uint64_t offset;
+    uint64_t bytes;
+    uint64_t entries;
+    uint32_t crc;
+    uint32_t reserved;
+};
+
+// one slice's records, checked against its crc
+struct SnapshotSliceView {
+    const char *data = nullptr;
+    size_t bytes = 0;
+    uint64_t entries = 0;
+};
+
+class SnapshotWriter {
+public:
+    SnapshotWriter() = default;
+    SnapshotWriter(const SnapshotWriter &) = delete;
+    SnapshotWriter &operator=(const SnapshotWriter &) = delete;
+
+    // a snapshot that was never committed removes its temporary file and
+    // leaves path as it was
+    ~SnapshotWriter() {
+        if (_file) {
+            std::fclose(_file);
+            std::remove(_tmpPath.c_str());
+        }
+    }
+
+    // creates a temporary file next to path, unique to this writer so
+    // overlapping saves to one path never share it, with room for the
+    // header and sliceCount slices
+    bool open(const std::string &path, SnapshotKind kind, size_t sliceCount) {
+        _path = path;
+        if (!open_tmp()) {
+            return false;
+        }
+        _header = SnapshotHeader{SnapshotHeader::kMagic, SnapshotHeader::kVersion,
+                                 static_cast<uint32_t>(kind),
+                                 static_cast<uint32_t>(sliceCount), 0};
+        _slices.clear();
+        _slices.reserve(sliceCount);
+        _offset = sizeof(SnapshotHeader) + sliceCount * sizeof(SnapshotSlice);
+        std::vector<char> placeholder(_offset, 0);
+        return write(placeholder.data(), placeholder.size());
+    }
+
+    // slices go in index order, entries is the number of records
+    bool write_slice(const std::string &bytes, uint64_t entries) {
+        if (!_file || _slices.size() == _header.sliceCount) {
+            return false;
+        }
+        _slices.push_back({_offset, bytes.size(), entries,
+                           crc32c(bytes.data(), bytes.size()), 0});
+        _offset += bytes.size();
+        return write(bytes.data(), bytes.size());
+    }
+
+    // fills in the header and moves the finished file over path
+    bool commit() {
+        if (!_file || _slices.size() != _header.sliceCount) {
+            return false;
+        }
+        _header.crc = 0;
+        uint32_t crc = crc32c(&_header, sizeof(_header));
+        _header.crc = crc32c(_slices.data(), _slices.size() * sizeof(SnapshotSlice),
+                             crc);
+        bool written = std::fseek(_file, 0, SEEK_SET) == 0 &&
+                       write(&_header, sizeof(_header)) &&
+                       write(_slices.data(),
+                             _slices.size() * sizeof(SnapshotSlice)) &&
+                       std::fflush(_file) == 0;
+#ifdef MINCACHE_SNAPSHOT_POSIX
+        written = written && ::fsync(fileno(_file)) == 0;
+#endif
+        written = std::fclose(_file) == 0 && written;
+        _file = nullptr;
+        if (!written) {
+            std::remove(_tmpPath.c_str());
+            return false;
+        }
+#ifndef MINCACHE_SNAPSHOT_POSIX
+        std::remove(_path.c_str());
+#endif
+        if (std::rename(_tmpPath.c_str(), _path.c_str()) != 0) {
+            std::remove(_tmpPath.c_str());
+            return false;
+        }
+        return sync_directory();
+    }
+
+private:
+    // path.tmp.<pid>.<n>, created exclusively
+    bool open_tmp() {
+        static std::atomic<uint64_t> counter{0};
+        for (int attempt = 0; attempt < 16; ++attempt) {
+            _tmpPath = _path + ".tmp." + std::to_string(process_id()) + "." +
+                       std::to_string(counter.fetch_add(1));
+#ifdef MINCACHE_SNAPSHOT_POSIX
+            int fd = ::open(_tmpPath.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0666);
+            if (fd < 0) {
+                if (errno == EEXIST) {
+                    continue;
+                }
+                return false;
+            }
+            _file = ::fdopen(fd, "wb");
+            if (!_file) {
+                ::close(fd);
+                std::remove(_tmpPath.c_str());
+            }
+#else
+            _file = std::fopen(_tmpPath.c_str(), "wb");
+#endif
+            return _file != nullptr;
+        }
+        return false;
+    }
+
+    static long process_id() {
+#ifdef MINCACHE_SNAPSHOT_POSIX
+        return static_cast<long>(::getpid());
+#else
+        return 0;
+#endif
+    }
+
+    // makes the rename itself durable
+    bool sync_directory() {
+#ifdef MINCACHE_SNAPSHOT_POSIX
+        size_t slash = _path.rfind('/');
+        std::string dir = slash == std::string::npos ? "."
+                          : slash == 0              ? "/"
+                                                    : _path.substr(0, slash);
+        int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+        if (fd < 0) {
+            return false;
+        }
+        bool synced = ::fsync(fd) == 0;
+        ::close(fd);
+        return synced;
+#else
+        return true;
+#endif
+    }
+
+    bool write(const void *data, size_t size) {
+        return size == 0 || std::fwrite(data, 1, size, _file) == size;
+    }
+
+private:
+    std::string _path;
+    std::string _tmpPath;
+    std::FILE *_file = nullptr;
+    SnapshotHeader _header{};
+    std::vector<SnapshotSlice> _slices;
+    uint64_t _offset = 0;
+};
+
+// read-only view of a snapshot file, memory mapped where available;
+// slice() may be called from several threads at once
+class SnapshotReader {
+public:
+    SnapshotReader() = default;
+    SnapshotReader(const SnapshotReader &) = delete;
+    SnapshotReader &operator=(const SnapshotReader &) = delete;
+
+    ~SnapshotReader() {
+#ifdef MINCACHE_SNAPSHOT_POSIX
+        if (_mapped) {
+            ::munmap(_mapped, _size);
+        }
+#endif
+    }
+
+    // false unless path holds a complete snapshot of the given kind
+    bool open(const std::string &path, SnapshotKind kind) {
+        if (!map(path) || _size < sizeof(SnapshotHeader)) {
+            return false;
+        }
+        SnapshotHeader header;
+        std::memcpy(&header, _data, sizeof(header));
+        if (header.magic != SnapshotHeader::kMagic ||
+            header.version != SnapshotHeader::kVersion ||
+            header.kind != static_cast<uint32_t>(kind)) {
+            return false;
+        }
+        size_t indexBytes = static_cast<size_t>(header.sliceCount) *
+                            sizeof(SnapshotSlice);
+        if (_size - sizeof(header) < indexBytes) {
+            return false;
+        }
+
+        uint32_t expected = header.crc;
+        header.crc = 0;
+        uint32_t crc = crc32c(&header, sizeof(header));
+        crc = crc32c(_data + sizeof(header), indexBytes, crc);
+        if (crc != expected) {
+            return false;
+        }
+
+        _slices.resize(header.sliceCount);
+        std::memcpy(_slices.data(), _data + sizeof(header), indexBytes);
+        for (const SnapshotSlice &slice : _slices) {
+            if (slice.offset > _size || slice.bytes > _size - slice.offset) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    size_t slice_count() const { return _slices.size(); }
+
+    // false if the slice does not match its checksum
+    bool slice(size_t index, SnapshotSliceView &view) const {
+        const SnapshotSlice &slice = _slices[index];
+        const char *data = _data + slice.offset;
+        if (crc32c(data, static_cast<size_t>(slice.bytes)) != slice.crc) {
+            return false;
+        }
+        view.data = data;
+        view.bytes = static_cast<size_t>(slice.bytes);
+        view.entries = slice.entries;
+        return true;
+    }
+
+private:
+    bool map(const std::string &path) {
+#ifdef MINCACHE_SNAPSHOT_POSIX
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat st;
+        bool ok = ::fstat(fd, &st) == 0 && st.st_size > 0;
+        if (ok) {
+            _size = static_cast<size_t>(st.st_size);
+            void *mapped = ::mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+            ok = mapped != MAP_FAILED;
+            if (ok) {
+                // slices are read front to back by the loader threads
+                ::madvise(mapped, _size, MADV_WILLNEED);
+                _mapped = mapped;
+                _data = static_cast<const char *>(mapped);
+            }
+        }
+        ::close(fd);
+        return ok;
+#else
+        std::ifstream in(path, std::ios::binary);
+        if (!in) {
+            return false;
+        }
+        _buffer.assign(std::istreambuf_iterator<char>(in),
+                       std::istreambuf_iterator<char>());
+        _data = _buffer.data();
+        _size = _buffer.size();
+        return true;
+#endif
+    }
+
+private:
+    const char *_data = nullptr;
+    size_t _size = 0;
+    void *_mapped = nullptr;
+    std::vector<char> _buffer;
+    std::vector<SnapshotSlice> _slices;
+};
+
+// calls work(i) for every i < count on up to threads threads, zero means
+// one per hardware thread; the calling thread takes part
+template <typename Func>
+void parallel_for(size_t count, size_t threads, Func &&work) {
+    if (threads == 0) {
+        threads = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+    }
+    threads = std::min(threads, count);
+    std::atomic<size_t> next{0};
+    auto run = [&] {
+        for (size_t i = next++; i < count; i = next++) {
+            work(i);
+        }
+    };
+    std::vector<std::thread> workers;
+    for (size_t t = 1; t < threads; ++t) {
+        workers.emplace_back(run);
+    }
+    run();
+    for (std::thread &worker : workers) {
+        worker.join();
+    }
+}
+
+} // namespace MinCache
@@ -0,0 +1,205 @@
+#pragma once
+
+#include "CacheUtil.h"
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace MinCache {
+
+// ttl argument meaning "use the cache's default ttl"
+inline constexpr std::chrono::milliseconds kDefaultTtl{-1};
+
+//--------------------------------------------------------------------
+// TimerWheel: hierarchical timing wheel keyed by slab slot index.
+// Level l has 64 slots of 64^l ticks each (1 tick = 1 ms), entries are
+// cascaded to lower levels as their slot comes due. Empty stretches are
+// skipped using a per-level occupancy bitmap, so advancing after a long
+// idle period costs nothing more than the slots that hold entries.
+//--------------------------------------------------------------------
+
+class TimerWheel {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    TimerWheel() : _currentTick(0), _start(Clock::now()) {
+        for (uint32_t &head : _heads) {
+            head = kNullIndex;
+        }
+        for (uint64_t &bitmap : _occupied) {
+            bitmap = 0;
+        }
+    }
+
+    uint64_t now_tick() const {
+        return static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::milliseconds>(
+                Clock::now() - _start)
+                .count());
+    }
+
+    uint64_t tick_after(std::chrono::milliseconds ttl) const {
+        return now_tick() + static_cast<uint64_t>(ttl.count());
+    }
+
+    bool is_scheduled(uint32_t id) const {
+        return id < _bucket.size() && _bucket[id] != kUnscheduled;
+    }
+
+    bool is_expired(uint32_t id, uint64_t now) const {
+        return is_scheduled(id) && _expire[id] <= now;
+    }
+
+    // tick at which a scheduled id expires
+    uint64_t expire_tick(uint32_t id) const { return _expire[id]; }
+
+    // (re)schedules id to expire at the given tick
+    void schedule(uint32_t id, uint64_t expireTick) {
+        if (id >= _bucket.size()) {
+            _prev.resize(id + 1, kNullIndex);
+            _next.resize(id + 1, kNullIndex);
+            _expire.resize(id + 1, 0);
+            _bucket.resize(id + 1, kUnscheduled);
+        }
+        cancel(id);
+        _expire[id] = expireTick;
+        place(id);
+    }
+
+    void cancel(uint32_t id) {
+        if (!is_scheduled(id)) {
+            return;
+        }
+
+        uint16_t bucket = _bucket[id];
+        if (_prev[id] == kNullIndex) {
+            _heads[bucket] = _next[id];
+        } else {
+            _next[_prev[id]] = _next[id];
+        }
+        if (_next[id] != kNullIndex) {
+            _prev[_next[id]] = _prev[id];
+        }
+        if (_heads[bucket] == kNullIndex) {
+            _occupied[bucket / kSlots] &= ~(1ULL << (bucket % kSlots));
+        }
+        _bucket[id] = kUnscheduled;
+    }
+
+    // moves the wheel forward to now and calls onExpire(id) for at most
+    // limit expired ids, which are unscheduled before the call; leftovers
+    // are picked up by the next advance
+    template <typename Func>
+    size_t advance(uint64_t now, size_t limit, Func &&onExpire) {
+        size_t expired = 0;
+        while (true) {
+            uint16_t bucket = static_cast<uint16_t>(_currentTick & kMask);
+            while (_heads[bucket] != kNullIndex && expired < limit) {
+                uint32_t id = _heads[bucket];
+                cancel(id);
+                onExpire(id);
+                ++expired;
+            }
+            if (expired >= limit || _currentTick >= now) {
+                return expired;
+            }
+
+            _currentTick = next_dueTick(now);
+            cascade();
+        }
+    }
+
+private:
+    static constexpr int kLevels = 5;
+    static constexpr int kBits = 6;
+    static constexpr uint64_t kSlots = 64;
+    static constexpr uint64_t kMask = kSlots - 1;
+    static constexpr uint32_t kNullIndex = UINT32_MAX;
+    static constexpr uint16_t kUnscheduled = UINT16_MAX;
+
+    void place(uint32_t id) {
+        uint64_t expire = _expire[id] > _currentTick ? _expire[id] : _currentTick;
+        uint64_t delta = expire - _currentTick;
+        int level = 0;
+        while (level < kLevels - 1 && delta >= (kSlots << (kBits * level))) {
+            ++level;
+        }
+        // past the top level: park in the farthest slot, it is re-placed
+        // when that slot cascades
+        if (delta >= (kSlots << (kBits * level))) {
+            expire = _currentTick + (kSlots << (kBits * level)) - 1;
+        }
+
+        uint16_t bucket = static_cast<uint16_t>(
+            level * kSlots + ((expire >> (kBits * level)) & kMask));
+        _bucket[id] = bucket;
+        _prev[id] = kNullIndex;
+        _next[id] = _heads[bucket];
+        if (_heads[bucket] != kNullIndex) {
+            _prev[_heads[bucket]] = id;
+        }
+        _heads[bucket] = id;
+        _occupied[level] |= 1ULL << (bucket % kSlots);
+    }
+
+    // the earliest tick after the current one at which some slot comes
+    // due, capped at now
+    uint64_t next_dueTick(uint64_t now) const {
+        uint64_t due = now;
+        for (int level = 0; level < kLevels; ++level) {
+            if (_occupied[level] == 0) {
+                continue;
+            }
+            int shift = kBits * level;
+            uint64_t position = (_currentTick >> shift) & kMask;
+            uint64_t base = (_currentTick >> shift) - position;
+            uint64_t later = position == kMask
+                                 ? 0
+                                 : _occupied[level] & (~0ULL << (position + 1));
+            uint64_t slot =
+                later ? count_trailingZeros(later)
+                      : kSlots + count_trailingZeros(_occupied[level]);
+            uint64_t tick = (base + slot) << shift;
+            if (tick > _currentTick && tick < due) {
+                due = tick;
+            }
+        }
+        return due > _currentTick ? due : _currentTick + 1;
+    }
+
+    // re-place the entries of every higher level slot that starts at the
+    // current tick
+    void cascade() {
+        for (int level = 1; level < kLevels; ++level) {
+            int shift = kBits * level;
+            if (_currentTick & ((1ULL << shift) - 1)) {
+                return;
+            }
+
+            uint16_t bucket = static_cast<uint16_t>(
+                level * kSlots + ((_currentTick >> shift) & kMask));
+            uint32_t id = _heads[bucket];
+            _heads[bucket] = kNullIndex;
+            _occupied[level] &= ~(1ULL << (bucket % kSlots));
+            while (id != kNullIndex) {
+                uint32_t next = _next[id];
+                place(id);
+                id = next;
+            }
+        }
+    }
+
+private:
+    uint64_t _currentTick;
+    Clock::time_point _start;
+    uint32_t _heads[kLevels * kSlots];
+    uint64_t _occupied[kLevels];
+    // per slot links, indexed by the cache's slab index
+    std::vector<uint32_t> _prev;
+    std::vector<uint32_t> _next;
+    std::vector<uint64_t> _expire;
+    std::vector<uint16_t> _bucket;
+};
+
+} // namespace MinCache
@@ -0,0 +1,369 @@
+#pragma once
+
+#include "CachePolicy.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace MinCache {
+
+template <typename Key, typename Value> class TinyLfuCache; // forward declaration
+
+//--------------------------------------------------------------------
+// FrequencySketch: 4-bit count-min sketch with a doorkeeper bloom
+// filter in front. A key only reaches the sketch on its second access,
+// and all counters are halved every sampleSize recorded accesses.
+//--------------------------------------------------------------------
+
+class FrequencySketch {
+public:
+    explicit FrequencySketch(size_t capacity) {
+        size_t maximum = std::max<size_t>(capacity, 1);
+        // tiny caches still get 256 counters to keep collisions down
+        _table.assign(next_powerOfTwo(std::max<size_t>(maximum, 16)), 0);
+        _doorkeeper.assign(
+            next_powerOfTwo(std::max<size_t>(maximum * 8, 64)) / 64, 0);
+        _sampleSize = 10 * _table.size();
+        _additions = 0;
+    }
+
+    void increment(uint64_t hash) {
+        if (!doorkeeper_put(hash)) {
+            return;
+        }
+
+        bool added = false;
+        for (int i = 0; i < 4; ++i) {
+            uint64_t &word = _table[word_index(hash, i)];
+            int shift = counter_shift(hash, i);
+            if (((word >> shift) & 0xfULL) < 15) {
+                word += 1ULL << shift;
+                added = true;
+            }
+        }
+
+        if (added && ++_additions >= _sampleSize) {
+            reset();
+        }
+    }
+
+    int frequency(uint64_t hash) const {
+        int freq = 15;
+        for (int i = 0; i < 4; ++i) {
+            uint64_t word = _table[word_index(hash, i)];
+            freq = std::min(freq, static_cast<int>(
+                                      (word >> counter_shift(hash, i)) & 0xf));
+        }
+        return freq + (doorkeeper_contains(hash) ? 1 : 0);
+    }
+
+private:
+    static size_t next_powerOfTwo(size_t n) {
+        size_t power = 1;
+        while (power < n) {
+            power <<= 1;
+        }
+        return power;
+    }
+
+    static uint64_t mix(uint64_t x) {
+        x ^= x >> 33;
+        x *= 0xff51afd7ed558ccdULL;
+        x ^= x >> 33;
+        x *= 0xc4ceb9fe1a85ec53ULL;
+        x ^= x >> 33;
+        return x;
+    }
+
+    static uint64_t row_hash(uint64_t hash, int row) {
+        static constexpr uint64_t seeds[4] = {
+            0xc3a5c85c97cb3127ULL, 0xb492b66fbe98f273ULL,
+            0x9ae16a3b2f90404fULL, 0xcbf29ce484222325ULL};
+        return mix(hash + seeds[row]);
+    }
+
+    size_t word_index(uint64_t hash, int row) const {
+        return row_hash(hash, row) & (_table.size() - 1);
+    }
+
+    // each word holds 16 counters, the top bits pick one of them
+    static int counter_shift(uint64_t hash, int row) {
+        return static_cast<int>(row_hash(hash, row) >> 60) << 2;
+    }
+
+    bool doorkeeper_contains(uint64_t hash) const {
+        size_t mask = _doorkeeper.size() * 64 - 1;
+        for (int i = 0; i < 2; ++i) {
+            size_t bit = row_hash(hash, i) & mask;
+            if (!(_doorkeeper[bit / 64] & (1ULL << (bit % 64)))) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // returns true if the key was already known to the doorkeeper
+    bool doorkeeper_put(uint64_t hash) {
+        if (doorkeeper_contains(hash)) {
+            return true;
+        }
+
+        size_t mask = _doorkeeper.size() * 64 - 1;
+        for (int i = 0; i < 2; ++i) {
+            size_t bit = row_hash(hash, i) & mask;
+            _doorkeeper[bit / 64] |= 1ULL << (bit % 64);
+        }
+        return false;
+    }
+
+    void reset() {
+        for (uint64_t &word : _table) {
+            word = (word >> 1) & 0x7777777777777777ULL;
+        }
+        std::fill(_doorkeeper.begin(), _doorkeeper.end(), 0);
+        _additions /= 2;
+    }
+
+private:
+    std::vector<uint64_t> _table;
+    std::vector<uint64_t> _doorkeeper;
+    size_t _sampleSize;
+    size_t _additions;
+};
+
+template <typename Key, typename Value> class TinyLfuNode {
+private:
+    Key _key;
+    Value _value;
+    uint8_t _queue;
+    uint32_t _prev;
+    uint32_t _next;
+
+public:
+    TinyLfuNode() : _key(), _value(), _queue(0), _prev(0), _next(0) {}
+
+    friend class TinyLfuCache<Key, Value>;
+};
+
+//--------------------------------------------------------------------
+// W-TinyLFU: new entries go to a small window LRU, the window victim is
+// only admitted to the segmented main LRU if the sketch says it is used
+// more often than the main victim.
+//--------------------------------------------------------------------
+
+template <typename Key, typename Value>
+class TinyLfuCache : public CachePolicy<Key, Value> {
+public:
+    using Node = TinyLfuNode<Key, Value>;
+    using NodeIndex = uint32_t;
+    using NodeMap = std::unordered_map<Key, NodeIndex>;
+
+    // windowPercent of the capacity goes to the window, 80% of the rest
+    // is the protected segment. Caches too small for a window slot admit
+    // every new entry through the sketch directly.
+    TinyLfuCache(int capacity, int windowPercent = 1)
+        : _capacity(std::max(capacity, 0)),
+          _sketch(static_cast<size_t>(std::max(capacity, 1))) {
+        _windowCapacity = _capacity * std::clamp(windowPercent, 0, 100) / 100;
+        size_t mainCapacity = _capacity - _windowCapacity;
+        _protectedCapacity = mainCapacity * 8 / 10;
+        initialize_lists();
+    }
+
+    ~TinyLfuCache() override = default;
+
+    void put(const Key &key, const Value &value) override {
+        put_internal(key, value);
+    }
+
+    void put(Key &&key, Value &&value) override {
+        put_internal(std::move(key), std::move(value));
+    }
+
+    bool get(const Key &key, Value &value) override {
+        return visit(key, [&value](const Value &cached) { value = cached; });
+    }
+
+    Value get(const Key &key) override {
+        Value value{};
+        get(key, value);
+        return value;
+    }
+
+    // calls func(const Value &) on a hit while the lock is held instead of
+    // copying the value out; func must not call back into the cache
+    template <typename Func> bool visit(const Key &key, Func &&func) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _sketch.increment(_hasher(key));
+        auto it = _nodeMap.find(key);
+        if (it == _nodeMap.end()) {
+            return false;
+        }
+
+        on_hit(it->second);
+        func(static_cast<const Value &>(_nodes[it->second]._value));
+        return true;
+    }
+
+private:
+    // the first three slots are the dummy heads of the circular queues
+    enum Queue : uint8_t { kWindow = 0, kProbation = 1, kProtected = 2 };
+    static constexpr NodeIndex kFirstNode = 3;
+
+    void initialize_lists();
+    template <typename K, typename V> void put_internal(K &&key, V &&value);
+    void on_hit(NodeIndex index);
+    template <typename K, typename V> void add_newNode(K &&key, V &&value);
+    void evict_fromWindow();
+    void remove_node(NodeIndex index);
+    void push_back(Queue queue, NodeIndex index);
+    NodeIndex front(Queue queue) const { return _nodes[queue]._next; }
+    void evict_node(NodeIndex index);
+
+private:
+    size_t _capacity;
+    size_t _windowCapacity;
+    size_t _protectedCapacity;
+    size_t _queueSize[3] = {0, 0, 0};
+    std::mutex _mutex;
+    std::hash<Key> _hasher;
+    FrequencySketch _sketch;
+
+    NodeMap _nodeMap;
+    std::vector<Node> _nodes;
+    std::vector<NodeIndex> _freeNodes;
+};
+
+template <typename Key, typename Value>
+void TinyLfuCache<Key, Value>::initialize_lists() {
+    // one extra slot for the window overflow before it is resolved
+    _nodes.reserve(_capacity + kFirstNode + 1);
+    for (NodeIndex queue = 0; queue < kFirstNode; ++queue) {
+        _nodes.emplace_back();
+        _nodes[queue]._prev = queue;
+        _nodes[queue]._next = queue;
+    }
+    _nodeMap.reserve(_capacity);
+}
+
+template <typename Key, typename Value>
+template <typename K, typename V>
+void TinyLfuCache<Key, Value>::put_internal(K &&key, V &&value) {
+    if (_capacity == 0) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    _sketch.increment(_hasher(key));
+    auto it = _nodeMap.find(key);
+    if (it != _nodeMap.end()) {
+        _nodes[it->second]._value = std::forward<V>(value);
+        on_hit(it->second);
+        return;
+    }
+
+    add_newNode(std::forward<K>(key), std::forward<V>(value));
+}
+
+template <typename Key, typename Value>
+void TinyLfuCache<Key, Value>::on_hit(NodeIndex index) {
+    Node &node = _nodes[index];
+    if (node._queue != kProbation) {
+        remove_node(index);
+        push_back(static_cast<Queue>(node._queue), index);
+        return;
+    }
+
+    // a second hit promotes a probation entry, protected overflow is
+    // demoted back to probation
+    remove_node(index);
+    push_back(kProtected, index);
+    if (_queueSize[kProtected] > _protectedCapacity) {
+        NodeIndex demoted = front(kProtected);
+        remove_node(demoted);
+        push_back(kProbation, demoted);
+    }
+}
+
+template <typename Key, typename Value>
+template <typename K, typename V>
+void TinyLfuCache<Key, Value>::add_newNode(K &&key, V &&value) {
+    NodeIndex index;
+    if (!_freeNodes.empty()) {
+        index = _freeNodes.back();
+        _freeNodes.pop_back();
+    } else {
+        _nodes.emplace_back();
+        index = static_cast<NodeIndex>(_nodes.size() - 1);
+    }
+
+    Node &node = _nodes[index];
+    node._key = key;
+    node._value = std::forward<V>(value);
+    push_back(kWindow, index);
+    _nodeMap.emplace(std::forward<K>(key), index);
+
+    if (_queueSize[kWindow] > _windowCapacity) {
+        evict_fromWindow();
+    }
+}
+
+template <typename Key, typename Value>
+void TinyLfuCache<Key, Value>::evict_fromWindow() {
+    NodeIndex candidate = front(kWindow);
+    remove_node(candidate);
+    push_back(kProbation, candidate);
+    if (_nodeMap.size() <= _capacity) {
+        return;
+    }
+
+    // the main cache is full: keep whichever of the window candidate and
+    // the probation victim the sketch considers more popular
+    NodeIndex victim = front(kProbation);
+    if (victim == candidate) {
+        victim = front(kProtected);
+    }
+    if (victim == kProtected) {
+        evict_node(candidate);
+        return;
+    }
+
+    int candidateFreq = _sketch.frequency(_hasher(_nodes[candidate]._key));
+    int victimFreq = _sketch.frequency(_hasher(_nodes[victim]._key));
+    evict_node(candidateFreq > victimFreq ? victim : candidate);
+}
+
+template <typename Key, typename Value>
+void TinyLfuCache<Key, Value>::evict_node(NodeIndex index) {
+    remove_node(index);
+    _nodeMap.erase(_nodes[index]._key);
+    _nodes[index]._key = Key();
+    _nodes[index]._value = Value();
+    _freeNodes.push_back(index);
+}
+
+template <typename Key, typename Value>
+void TinyLfuCache<Key, Value>::remove_node(NodeIndex index) {
+    Node &node = _nodes[index];
+    _nodes[node._prev]._next = node._next;
+    _nodes[node._next]._prev = node._prev;
+    --_queueSize[node._queue];
+}
+
+template <typename Key, typename Value>
+void TinyLfuCache<Key, Value>::push_back(Queue queue, NodeIndex index) {
+    Node &node = _nodes[index];
+    node._queue = queue;
+    node._next = queue;
+    node._prev = _nodes[queue]._prev;
+    _nodes[node._prev]._next = index;
+    _nodes[queue]._prev = index;
+    ++_queueSize[queue];
+}
+
+} // namespace MinCache
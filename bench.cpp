@@ -0,0 +1,476 @@
+#include "BasicCache.h"
+#include "ClockCache.h"
+#include "LfuCache.h"
+#include "LruCache.h"
+#include "NearCache.h"
+#include "TinyLfuCache.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Multithreaded throughput and latency benchmark.
+//
+//   bench [--policies lru,lruk,lfu,tinylfu,hashlru,hashlfu,clock,basic,near]
+//         [--workloads zipf,uniform,scan] [--threads N] [--ops N]
+//         [--keys N] [--capacity N] [--slices N] [--read-ratio R]
+//         [--theta T] [--seed S] [--format text|csv|json]
+//
+// Every workload runs with 1, 2, 4 ... N threads. Reads that miss are
+// followed by a put, like a cache-aside client would do.
+
+namespace {
+
+struct Options {
+    std::vector<std::string> policies = {"lru",     "lruk",    "lfu",
+                                         "tinylfu", "hashlru", "hashlfu",
+                                         "clock",   "basic",   "near"};
+    std::vector<std::string> workloads = {"zipf", "uniform", "scan"};
+    int threads = static_cast<int>(
+        std::max(1u, std::min(8u, std::thread::hardware_concurrency())));
+    size_t ops = 1000000; // per thread
+    size_t keys = 100000;
+    size_t capacity = 10000;
+    int slices = 16;
+    double readRatio = 0.9;
+    double theta = 0.99;
+    uint64_t seed = 42;
+    std::string format = "text";
+};
+
+//--------------------------------------------------------------------
+// LatencyHistogram: log-linear buckets in the style of HdrHistogram.
+// Values below 2^kSubBits ns are exact, larger values keep kSubBits
+// significant bits, so any reported percentile is within ~3%.
+//--------------------------------------------------------------------
+
+class LatencyHistogram {
+public:
+    LatencyHistogram() : _counts(kBucketNum, 0), _total(0), _max(0) {}
+
+    void record(uint64_t nanos) {
+        ++_counts[bucket_index(nanos)];
+        ++_total;
+        _max = std::max(_max, nanos);
+    }
+
+    void merge(const LatencyHistogram &other) {
+        for (size_t i = 0; i < kBucketNum; ++i) {
+            _counts[i] += other._counts[i];
+        }
+        _total += other._total;
+        _max = std::max(_max, other._max);
+    }
+
+    // upper bound of the bucket holding the given percentile
+    uint64_t percentile(double pct) const {
+        if (_total == 0) {
+            return 0;
+        }
+
+        uint64_t rank = static_cast<uint64_t>(
+            std::ceil(pct / 100.0 * static_cast<double>(_total)));
+        rank = std::max<uint64_t>(rank, 1);
+        uint64_t seen = 0;
+        for (size_t i = 0; i < kBucketNum; ++i) {
+            seen += _counts[i];
+            if (seen >= rank) {
+                return std::min(bucket_upperBound(i), _max);
+            }
+        }
+        return _max;
+    }
+
+    uint64_t max() const { return _max; }
+
+private:
+    static constexpr int kSubBits = 5;
+    static constexpr uint64_t kSubCount = 1ULL << kSubBits;
+    static constexpr size_t kBucketNum = (64 - kSubBits + 1) * kSubCount;
+
+    static size_t bucket_index(uint64_t value) {
+        if (value < kSubCount) {
+            return static_cast<size_t>(value);
+        }
+        int msb = 63 - MinCache::count_leadingZeros(value);
+        int shift = msb - kSubBits;
+        uint64_t sub = (value >> shift) & (kSubCount - 1);
+        return static_cast<size_t>((shift + 1) * kSubCount + sub);
+    }
+
+    static uint64_t bucket_upperBound(size_t index) {
+        if (index < kSubCount) {
+            return index;
+        }
+        int shift = static_cast<int>(index / kSubCount) - 1;
+        uint64_t sub = index % kSubCount;
+        return ((kSubCount + sub + 1) << shift) - 1;
+    }
+
+private:
+    std::vector<uint64_t> _counts;
+    uint64_t _total;
+    uint64_t _max;
+};
+
+// Zipfian ranks over [0, n) by inverting a precomputed CDF
+class ZipfGenerator {
+public:
+    ZipfGenerator(size_t n, double theta) : _cdf(n) {
+        double sum = 0;
+        for (size_t i = 0; i < n; ++i) {
+            sum += 1.0 / std::pow(static_cast<double>(i + 1), theta);
+            _cdf[i] = sum;
+        }
+        for (double &c : _cdf) {
+            c /= sum;
+        }
+    }
+
+    template <typename Rng> uint32_t next(Rng &rng) const {
+        double u = std::uniform_real_distribution<double>(0.0, 1.0)(rng);
+        auto it = std::lower_bound(_cdf.begin(), _cdf.end(), u);
+        return static_cast<uint32_t>(
+            std::min<size_t>(it - _cdf.begin(), _cdf.size() - 1));
+    }
+
+private:
+    std::vector<double> _cdf;
+};
+
+// the top bit of each op marks a write
+constexpr uint32_t kWriteFlag = 1u << 31;
+
+// key streams are generated up front so the timed loop only measures the
+// cache
+std::vector<std::vector<uint32_t>>
+make_workload(const std::string &workload, const Options &opts, int threads,
+              const ZipfGenerator &zipf) {
+    std::vector<std::vector<uint32_t>> streams(threads);
+    for (int t = 0; t < threads; ++t) {
+        std::mt19937_64 rng(opts.seed + t);
+        std::uniform_int_distribution<uint32_t> uniform(
+            0, static_cast<uint32_t>(opts.keys - 1));
+        std::bernoulli_distribution isRead(opts.readRatio);
+        std::vector<uint32_t> &ops = streams[t];
+        ops.resize(opts.ops);
+        size_t scanPos = opts.keys * t / threads;
+        for (size_t i = 0; i < opts.ops; ++i) {
+            uint32_t key;
+            if (workload == "zipf") {
+                // scramble ranks so hot keys do not share a slice
+                key = static_cast<uint32_t>(
+                    (zipf.next(rng) * 2654435761ULL) % opts.keys);
+            } else if (workload == "scan") {
+                key = static_cast<uint32_t>(scanPos++ % opts.keys);
+            } else {
+                key = uniform(rng);
+            }
+            ops[i] = isRead(rng) ? key : (key | kWriteFlag);
+        }
+    }
+    return streams;
+}
+
+struct RunResult {
+    std::string policy;
+    std::string workload;
+    int threads;
+    double opsPerSec;
+    double hitRatio;
+    uint64_t p50;
+    uint64_t p99;
+    uint64_t p999;
+    uint64_t max;
+};
+
+template <typename Cache>
+RunResult run_one(Cache &cache, const std::string &policy,
+                  const std::string &workload,
+                  const std::vector<std::vector<uint32_t>> &streams) {
+    using Clock = std::chrono::steady_clock;
+    int threads = static_cast<int>(streams.size());
+    std::vector<LatencyHistogram> histograms(threads);
+    std::vector<uint64_t> hits(threads, 0);
+    std::vector<uint64_t> reads(threads, 0);
+    std::atomic<int> ready(0);
+    std::atomic<bool> go(false);
+
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t] {
+            const std::vector<uint32_t> &ops = streams[t];
+            LatencyHistogram &histogram = histograms[t];
+            std::string value;
+            uint64_t localHits = 0;
+            uint64_t localReads = 0;
+            ready.fetch_add(1);
+            while (!go.load(std::memory_order_acquire)) {
+            }
+
+            for (uint32_t op : ops) {
+                int key = static_cast<int>(op & ~kWriteFlag);
+                auto begin = Clock::now();
+                if (op & kWriteFlag) {
+                    cache.put(key, std::to_string(key));
+                } else {
+                    ++localReads;
+                    if (cache.get(key, value)) {
+                        ++localHits;
+                    } else {
+                        cache.put(key, std::to_string(key));
+                    }
+                }
+                auto end = Clock::now();
+                histogram.record(static_cast<uint64_t>(
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        end - begin)
+                        .count()));
+            }
+            hits[t] = localHits;
+            reads[t] = localReads;
+        });
+    }
+
+    while (ready.load() < threads) {
+    }
+    auto start = Clock::now();
+    go.store(true, std::memory_order_release);
+    for (std::thread &worker : workers) {
+        worker.join();
+    }
+    double seconds =
+        std::chrono::duration<double>(Clock::now() - start).count();
+
+    LatencyHistogram total;
+    uint64_t totalHits = 0;
+    uint64_t totalReads = 0;
+    size_t totalOps = 0;
+    for (int t = 0; t < threads; ++t) {
+        total.merge(histograms[t]);
+        totalHits += hits[t];
+        totalReads += reads[t];
+        totalOps += streams[t].size();
+    }
+
+    RunResult result;
+    result.policy = policy;
+    result.workload = workload;
+    result.threads = threads;
+    result.opsPerSec = seconds > 0 ? totalOps / seconds : 0;
+    result.hitRatio = totalReads ? double(totalHits) / totalReads : 0;
+    result.p50 = total.percentile(50);
+    result.p99 = total.percentile(99);
+    result.p999 = total.percentile(99.9);
+    result.max = total.max();
+    return result;
+}
+
+RunResult run_policy(const std::string &policy, const std::string &workload,
+                     const Options &opts,
+                     const std::vector<std::vector<uint32_t>> &streams) {
+    int capacity = static_cast<int>(opts.capacity);
+    if (policy == "lru") {
+        MinCache::LruCache<int, std::string> cache(capacity);
+        return run_one(cache, policy, workload, streams);
+    }
+    if (policy == "lruk") {
+        MinCache::LruKCache<int, std::string> cache(capacity, 2 * capacity, 2);
+        return run_one(cache, policy, workload, streams);
+    }
+    if (policy == "lfu") {
+        MinCache::LfuCache<int, std::string> cache(capacity);
+        return run_one(cache, policy, workload, streams);
+    }
+    if (policy == "tinylfu") {
+        MinCache::TinyLfuCache<int, std::string> cache(capacity);
+        return run_one(cache, policy, workload, streams);
+    }
+    if (policy == "hashlru") {
+        MinCache::HashLruCache<int, std::string> cache(opts.capacity,
+                                                       opts.slices);
+        return run_one(cache, policy, workload, streams);
+    }
+    if (policy == "hashlfu") {
+        MinCache::HashLfuCache<int, std::string> cache(opts.capacity,
+                                                       opts.slices);
+        return run_one(cache, policy, workload, streams);
+    }
+    if (policy == "clock") {
+        MinCache::ClockCache<int, std::string> cache(capacity);
+        return run_one(cache, policy, workload, streams);
+    }
+    if (policy == "basic") {
+        MinCache::BasicCache<int, std::string> cache(capacity);
+        return run_one(cache, policy, workload, streams);
+    }
+    // 1024 thread-local entries in front of hashlru
+    MinCache::NearCache<int, std::string> cache(
+        1024, std::chrono::milliseconds(0), opts.capacity, opts.slices);
+    return run_one(cache, policy, workload, streams);
+}
+
+std::vector<std::string> split(const std::string &list) {
+    std::vector<std::string> items;
+    std::stringstream stream(list);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        if (!item.empty()) {
+            items.push_back(item);
+        }
+    }
+    return items;
+}
+
+void usage(const char *program) {
+    std::cerr << "usage: " << program
+              << " [--policies lru,lruk,lfu,tinylfu,hashlru,hashlfu,clock,"
+                 "basic,near] [--workloads zipf,uniform,scan] [--threads N] [--ops N]"
+                 " [--keys N] [--capacity N] [--slices N] [--read-ratio R]"
+                 " [--theta T] [--seed S] [--format text|csv|json]"
+              << std::endl;
+}
+
+bool parse_options(int argc, char *argv[], Options &opts) {
+    static const std::vector<std::string> knownPolicies = {
+        "lru", "lruk", "lfu", "tinylfu", "hashlru", "hashlfu", "clock",
+        "basic", "near"};
+    static const std::vector<std::string> knownWorkloads = {"zipf", "uniform",
+                                                            "scan"};
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            return false;
+        }
+        std::string value = argv[++i];
+        if (arg == "--policies") {
+            opts.policies = split(value);
+        } else if (arg == "--workloads") {
+            opts.workloads = split(value);
+        } else if (arg == "--threads") {
+            opts.threads = std::max(1, std::atoi(value.c_str()));
+        } else if (arg == "--ops") {
+            opts.ops = std::strtoull(value.c_str(), nullptr, 10);
+        } else if (arg == "--keys") {
+            opts.keys = std::max<size_t>(
+                1, std::strtoull(value.c_str(), nullptr, 10));
+        } else if (arg == "--capacity") {
+            opts.capacity = std::strtoull(value.c_str(), nullptr, 10);
+        } else if (arg == "--slices") {
+            opts.slices = std::max(1, std::atoi(value.c_str()));
+        } else if (arg == "--read-ratio") {
+            opts.readRatio = std::clamp(std::atof(value.c_str()), 0.0, 1.0);
+        } else if (arg == "--theta") {
+            opts.theta = std::atof(value.c_str());
+        } else if (arg == "--seed") {
+            opts.seed = std::strtoull(value.c_str(), nullptr, 10);
+        } else if (arg == "--format") {
+            opts.format = value;
+        } else {
+            return false;
+        }
+    }
+
+    auto known = [](const std::vector<std::string> &items,
+                    const std::vector<std::string> &allowed) {
+        for (const std::string &item : items) {
+            if (std::find(allowed.begin(), allowed.end(), item) ==
+                allowed.end()) {
+                return false;
+            }
+        }
+        return true;
+    };
+    // keys share their 32 bits with kWriteFlag and are replayed as int
+    return opts.keys <= INT32_MAX && known(opts.policies, knownPolicies) &&
+           known(opts.workloads, knownWorkloads) &&
+           (opts.format == "text" || opts.format == "csv" ||
+            opts.format == "json");
+}
+
+void print_header(const Options &opts) {
+    if (opts.format == "csv") {
+        std::cout << "policy,workload,threads,ops_per_sec,hit_ratio,p50_ns,"
+                     "p99_ns,p999_ns,max_ns"
+                  << std::endl;
+    } else if (opts.format == "json") {
+        std::cout << "[" << std::endl;
+    } else {
+        std::cout << std::left << std::setw(9) << "policy" << std::setw(9)
+                  << "workload" << std::right << std::setw(8) << "threads"
+                  << std::setw(14) << "ops/sec" << std::setw(8) << "hit%"
+                  << std::setw(9) << "p50ns" << std::setw(9) << "p99ns"
+                  << std::setw(10) << "p99.9ns" << std::setw(10) << "maxns"
+                  << std::endl;
+    }
+}
+
+void print_result(const Options &opts, const RunResult &r, bool first) {
+    if (opts.format == "csv") {
+        std::cout << r.policy << "," << r.workload << "," << r.threads << ","
+                  << std::fixed << std::setprecision(0) << r.opsPerSec << ","
+                  << std::setprecision(4) << r.hitRatio << "," << r.p50 << ","
+                  << r.p99 << "," << r.p999 << "," << r.max << std::endl;
+    } else if (opts.format == "json") {
+        std::cout << (first ? "  " : ",\n  ") << "{\"policy\": \"" << r.policy
+                  << "\", \"workload\": \"" << r.workload
+                  << "\", \"threads\": " << r.threads
+                  << ", \"ops_per_sec\": " << std::fixed
+                  << std::setprecision(0) << r.opsPerSec
+                  << ", \"hit_ratio\": " << std::setprecision(4) << r.hitRatio
+                  << ", \"p50_ns\": " << r.p50 << ", \"p99_ns\": " << r.p99
+                  << ", \"p999_ns\": " << r.p999 << ", \"max_ns\": " << r.max
+                  << "}" << std::flush;
+    } else {
+        std::cout << std::left << std::setw(9) << r.policy << std::setw(9)
+                  << r.workload << std::right << std::setw(8) << r.threads
+                  << std::setw(14) << std::fixed << std::setprecision(0)
+                  << r.opsPerSec << std::setw(8) << std::setprecision(2)
+                  << 100.0 * r.hitRatio << std::setw(9) << r.p50
+                  << std::setw(9) << r.p99 << std::setw(10) << r.p999
+                  << std::setw(10) << r.max << std::endl;
+    }
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    Options opts;
+    if (!parse_options(argc, argv, opts)) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    ZipfGenerator zipf(opts.keys, opts.theta);
+    print_header(opts);
+    bool first = true;
+    for (const std::string &workload : opts.workloads) {
+        for (int threads = 1;; threads = std::min(threads * 2, opts.threads)) {
+            auto streams = make_workload(workload, opts, threads, zipf);
+            for (const std::string &policy : opts.policies) {
+                print_result(opts, run_policy(policy, workload, opts, streams),
+                             first);
+                first = false;
+            }
+            if (threads == opts.threads) {
+                break;
+            }
+        }
+    }
+    if (opts.format == "json") {
+        std::cout << "\n]" << std::endl;
+    }
+    return 0;
+}
@@ -1,6 +1,7 @@
 #include "CachePolicy.h"
 #include "LfuCache.h"
 #include "LruCache.h"
+#include "TinyLfuCache.h"
 #include <array>
 #include <chrono>
 #include <iomanip>
@@ -34,6 +35,8 @@ void print_results(const std::string &testname, int capacity,
               << (100.0 * hits[1] / get_operations[1]) << "%" << std::endl;
     std::cout << "LFU - Hit rate:  " << std::fixed << std::setprecision(2)
               << (100.0 * hits[2] / get_operations[2]) << "%" << std::endl;
+    std::cout << "TinyLFU - Hit rate:  " << std::fixed << std::setprecision(2)
+              << (100.0 * hits[3] / get_operations[3]) << "%" << std::endl;
 }
 
 void test_hotdata_acess() {
@@ -47,14 +50,15 @@ void test_hotdata_acess() {
     MinCache::LruCache<int, std::string> lru(CAPACITY);
     MinCache::LruKCache<int, std::string> lruk(CAPACITY, 2 * CAPACITY, 2);
     MinCache::LfuCache<int, std::string> lfu(CAPACITY);
+    MinCache::TinyLfuCache<int, std::string> tinylfu(CAPACITY);
 
     std::random_device rd;
     std::mt19937 gen(rd());
 
-    std::array<MinCache::CachePolicy<int, std::string> *, 3> caches = {
-        &lru, &lruk, &lfu};
-    std::vector<int> hits(3, 0);
-    std::vector<int> get_operations(3, 0);
+    std::array<MinCache::CachePolicy<int, std::string> *, 4> caches = {
+        &lru, &lruk, &lfu, &tinylfu};
+    std::vector<int> hits(4, 0);
+    std::vector<int> get_operations(4, 0);
 
     for (int i = 0; i < caches.size(); i++) {
         for (int op = 0; op < OPERATIONS; op++) {
@@ -95,11 +99,12 @@ void test_loop_pattern() {
     MinCache::LruCache<int, std::string> lru(CAPACITY);
     MinCache::LruKCache<int, std::string> lruk(CAPACITY, 2 * CAPACITY, 2);
     MinCache::LfuCache<int, std::string> lfu(CAPACITY);
+    MinCache::TinyLfuCache<int, std::string> tinylfu(CAPACITY);
 
-    std::array<MinCache::CachePolicy<int, std::string> *, 3> caches = {
-        &lru, &lruk, &lfu};
-    std::vector<int> hits(3, 0);
-    std::vector<int> get_operations(3, 0);
+    std::array<MinCache::CachePolicy<int, std::string> *, 4> caches = {
+        &lru, &lruk, &lfu, &tinylfu};
+    std::vector<int> hits(4, 0);
+    std::vector<int> get_operations(4, 0);
 
     std::random_device rd;
     std::mt19937 gen(rd());
@@ -142,13 +147,14 @@ void test_workload_shift() {
     MinCache::LruCache<int, std::string> lru(CAPACITY);
     MinCache::LruKCache<int, std::string> lruk(CAPACITY, 2 * CAPACITY, 2);
     MinCache::LfuCache<int, std::string> lfu(CAPACITY);
+    MinCache::TinyLfuCache<int, std::string> tinylfu(CAPACITY);
 
     std::random_device rd;
     std::mt19937 gen(rd());
-    std::array<MinCache::CachePolicy<int, std::string> *, 3> caches = {
-        &lru, &lruk, &lfu};
-    std::vector<int> hits(3, 0);
-    std::vector<int> get_operations(3, 0);
+    std::array<MinCache::CachePolicy<int, std::string> *, 4> caches = {
+        &lru, &lruk, &lfu, &tinylfu};
+    std::vector<int> hits(4, 0);
+    std::vector<int> get_operations(4, 0);
 
     for (int i = 0; i < caches.size(); ++i) {
         for (int key = 0; key < 1000; ++key) {
@@ -0,0 +1,488 @@
+#include "CachePolicy.h"
+#include "ClockCache.h"
+#include "LfuCache.h"
+#include "LruCache.h"
+#include "TinyLfuCache.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+// Offline trace replay: hit ratio of every policy at every capacity.
+//
+//   replay <trace> [--format arc|lirs|oks|bin]
+//          [--policies lru,lruk,lfu,tinylfu,clock]
+//          [--capacities 1000,10000,...] [--jobs N] [--csv]
+//
+// Trace formats:
+//   arc   "start count ignored request" per line, count blocks per request
+//   lirs  one block number per line, other lines are skipped
+//   oks   "op key size" per line; set/put/write ops store, anything else
+//         is a read. Non-numeric keys are hashed.
+//   bin   little-endian uint64 keys, all reads
+// The format defaults to the file extension, then to oks.
+//
+// The trace is memory mapped and every (policy, capacity) pair streams it
+// on its own thread, so the trace is never copied into memory.
+
+namespace {
+
+enum class TraceFormat { kArc, kLirs, kOks, kBin };
+
+struct Access {
+    uint64_t key;
+    bool write;
+};
+
+class MappedFile {
+public:
+    explicit MappedFile(const std::string &path) : _data(nullptr), _size(0) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return;
+        }
+        struct stat st;
+        if (::fstat(fd, &st) == 0 && st.st_size > 0) {
+            void *data = ::mmap(nullptr, static_cast<size_t>(st.st_size),
+                                PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data != MAP_FAILED) {
+                _data = static_cast<const char *>(data);
+                _size = static_cast<size_t>(st.st_size);
+                ::madvise(data, _size, MADV_SEQUENTIAL);
+            }
+        }
+        ::close(fd);
+    }
+
+    ~MappedFile() {
+        if (_data) {
+            ::munmap(const_cast<char *>(_data), _size);
+        }
+    }
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    const char *data() const { return _data; }
+    size_t size() const { return _size; }
+
+private:
+    const char *_data;
+    size_t _size;
+};
+
+//--------------------------------------------------------------------
+// TraceReader: forward-only parser over a mapped trace. Each replay
+// thread owns one, so they share the page cache but nothing else.
+//--------------------------------------------------------------------
+
+class TraceReader {
+public:
+    TraceReader(const char *data, size_t size, TraceFormat format)
+        : _pos(data), _end(data + size), _format(format), _runKey(0),
+          _runLeft(0) {}
+
+    bool next(Access &access) {
+        if (_runLeft > 0) {
+            access = {_runKey++, false};
+            --_runLeft;
+            return true;
+        }
+
+        switch (_format) {
+        case TraceFormat::kBin:
+            return next_binary(access);
+        case TraceFormat::kArc:
+            return next_arc(access);
+        case TraceFormat::kLirs:
+            return next_lirs(access);
+        case TraceFormat::kOks:
+            return next_oks(access);
+        }
+        return false;
+    }
+
+private:
+    bool next_binary(Access &access) {
+        if (_end - _pos < 8) {
+            return false;
+        }
+        uint64_t key = 0;
+        for (int i = 7; i >= 0; --i) {
+            key = (key << 8) | static_cast<unsigned char>(_pos[i]);
+        }
+        _pos += 8;
+        access = {key, false};
+        return true;
+    }
+
+    bool next_arc(Access &access) {
+        while (_pos < _end) {
+            uint64_t start;
+            uint64_t count;
+            bool ok = parse_number(start) && parse_number(count);
+            skip_line();
+            if (ok && count > 0) {
+                _runKey = start + 1;
+                _runLeft = count - 1;
+                access = {start, false};
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool next_lirs(Access &access) {
+        while (_pos < _end) {
+            uint64_t key;
+            bool ok = parse_number(key);
+            skip_line();
+            if (ok) {
+                access = {key, false};
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool next_oks(Access &access) {
+        while (_pos < _end) {
+            const char *op;
+            size_t opLen;
+            const char *key;
+            size_t keyLen;
+            bool ok = parse_token(op, opLen) && parse_token(key, keyLen);
+            skip_line();
+            if (ok) {
+                access = {key_hash(key, keyLen), is_write(op, opLen)};
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void skip_blanks() {
+        while (_pos < _end && (*_pos == ' ' || *_pos == '\t' || *_pos == ',')) {
+            ++_pos;
+        }
+    }
+
+    void skip_line() {
+        while (_pos < _end && *_pos != '\n') {
+            ++_pos;
+        }
+        if (_pos < _end) {
+            ++_pos;
+        }
+    }
+
+    bool parse_number(uint64_t &value) {
+        skip_blanks();
+        if (_pos >= _end || *_pos < '0' || *_pos > '9') {
+            return false;
+        }
+        value = 0;
+        while (_pos < _end && *_pos >= '0' && *_pos <= '9') {
+            value = value * 10 + static_cast<uint64_t>(*_pos - '0');
+            ++_pos;
+        }
+        return true;
+    }
+
+    bool parse_token(const char *&token, size_t &length) {
+        skip_blanks();
+        token = _pos;
+        while (_pos < _end && *_pos != ' ' && *_pos != '\t' && *_pos != ',' &&
+               *_pos != '\n' && *_pos != '\r') {
+            ++_pos;
+        }
+        length = static_cast<size_t>(_pos - token);
+        return length > 0;
+    }
+
+    // numeric keys are used as is, anything else goes through FNV-1a
+    static uint64_t key_hash(const char *key, size_t length) {
+        uint64_t value = 0;
+        size_t i = 0;
+        while (i < length && i < 19 && key[i] >= '0' && key[i] <= '9') {
+            value = value * 10 + static_cast<uint64_t>(key[i] - '0');
+            ++i;
+        }
+        if (i == length) {
+            return value;
+        }
+
+        uint64_t hash = 0xcbf29ce484222325ULL;
+        for (size_t j = 0; j < length; ++j) {
+            hash = (hash ^ static_cast<unsigned char>(key[j])) *
+                   0x100000001b3ULL;
+        }
+        return hash;
+    }
+
+    static bool is_write(const char *op, size_t length) {
+        static const char *writeOps[] = {"set", "put", "write", "add",
+                                         "replace", "SET", "PUT", "W"};
+        for (const char *name : writeOps) {
+            if (std::strlen(name) == length &&
+                std::strncmp(op, name, length) == 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+private:
+    const char *_pos;
+    const char *_end;
+    TraceFormat _format;
+    // pending blocks of a multi-block ARC request
+    uint64_t _runKey;
+    uint64_t _runLeft;
+};
+
+std::unique_ptr<MinCache::CachePolicy<uint64_t, std::string>>
+make_cache(const std::string &policy, int capacity) {
+    if (policy == "lru") {
+        return std::make_unique<MinCache::LruCache<uint64_t, std::string>>(
+            capacity);
+    }
+    if (policy == "lruk") {
+        return std::make_unique<MinCache::LruKCache<uint64_t, std::string>>(
+            capacity, 2 * capacity, 2);
+    }
+    if (policy == "lfu") {
+        return std::make_unique<MinCache::LfuCache<uint64_t, std::string>>(
+            capacity);
+    }
+    if (policy == "tinylfu") {
+        return std::make_unique<MinCache::TinyLfuCache<uint64_t, std::string>>(
+            capacity);
+    }
+    if (policy == "clock") {
+        return std::make_unique<MinCache::ClockCache<uint64_t, std::string>>(
+            capacity);
+    }
+    return nullptr;
+}
+
+struct Job {
+    std::string policy;
+    int capacity;
+    uint64_t reads = 0;
+    uint64_t hits = 0;
+};
+
+// misses are filled like a cache-aside client would
+void replay(const MappedFile &trace, TraceFormat format, Job &job) {
+    auto cache = make_cache(job.policy, job.capacity);
+    const std::string value = "v";
+    std::string cached;
+    TraceReader reader(trace.data(), trace.size(), format);
+    Access access;
+    while (reader.next(access)) {
+        if (access.write) {
+            cache->put(access.key, value);
+            continue;
+        }
+        ++job.reads;
+        if (cache->get(access.key, cached)) {
+            ++job.hits;
+        } else {
+            cache->put(access.key, value);
+        }
+    }
+}
+
+std::vector<std::string> split(const std::string &list) {
+    std::vector<std::string> items;
+    std::stringstream stream(list);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        if (!item.empty()) {
+            items.push_back(item);
+        }
+    }
+    return items;
+}
+
+bool parse_format(const std::string &name, TraceFormat &format) {
+    if (name == "arc") {
+        format = TraceFormat::kArc;
+    } else if (name == "lirs") {
+        format = TraceFormat::kLirs;
+    } else if (name == "oks") {
+        format = TraceFormat::kOks;
+    } else if (name == "bin") {
+        format = TraceFormat::kBin;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+void usage(const char *program) {
+    std::cerr << "usage: " << program
+              << " <trace> [--format arc|lirs|oks|bin]"
+                 " [--policies lru,lruk,lfu,tinylfu,clock]"
+                 " [--capacities 1000,10000,...] [--jobs N] [--csv]"
+              << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    std::string path = argv[1];
+    std::string formatName;
+    bool formatGiven = false;
+    std::vector<std::string> policies = {"lru", "lruk", "lfu", "tinylfu"};
+    std::vector<int> capacities = {100, 1000, 10000, 100000};
+    unsigned jobNum = std::max(1u, std::thread::hardware_concurrency());
+    bool csv = false;
+
+    for (int i = 2; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--csv") {
+            csv = true;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            usage(argv[0]);
+            return 1;
+        }
+        std::string value = argv[++i];
+        if (arg == "--format") {
+            formatName = value;
+            formatGiven = true;
+        } else if (arg == "--policies") {
+            policies = split(value);
+        } else if (arg == "--capacities") {
+            capacities.clear();
+            for (const std::string &item : split(value)) {
+                capacities.push_back(std::max(1, std::atoi(item.c_str())));
+            }
+        } else if (arg == "--jobs") {
+            jobNum = static_cast<unsigned>(std::max(1, std::atoi(value.c_str())));
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    TraceFormat format = TraceFormat::kOks;
+    if (formatGiven) {
+        if (!parse_format(formatName, format)) {
+            std::cerr << "unknown format: " << formatName << std::endl;
+            usage(argv[0]);
+            return 1;
+        }
+    } else {
+        // guessed from the extension; said on stderr so a wrong guess is
+        // noticed without disturbing --csv output
+        size_t dot = path.rfind('.');
+        size_t slash = path.find_last_of("/\\");
+        if (dot != std::string::npos &&
+            (slash == std::string::npos || dot > slash)) {
+            formatName = path.substr(dot + 1);
+        }
+        if (parse_format(formatName, format)) {
+            std::cerr << "format: " << formatName << " (from the file extension)"
+                      << std::endl;
+        } else {
+            std::cerr << "format: oks (extension not recognised, use --format)"
+                      << std::endl;
+        }
+    }
+    for (const std::string &policy : policies) {
+        if (!make_cache(policy, 1)) {
+            std::cerr << "unknown policy: " << policy << std::endl;
+            return 1;
+        }
+    }
+    std::sort(capacities.begin(), capacities.end());
+
+    MappedFile trace(path);
+    if (!trace.data()) {
+        std::cerr << "cannot map trace: " << path << std::endl;
+        return 1;
+    }
+
+    std::vector<Job> jobs;
+    for (int capacity : capacities) {
+        for (const std::string &policy : policies) {
+            jobs.push_back({policy, capacity});
+        }
+    }
+
+    std::atomic<size_t> nextJob(0);
+    std::vector<std::thread> workers;
+    for (unsigned t = 0; t < std::min<size_t>(jobNum, jobs.size()); ++t) {
+        workers.emplace_back([&] {
+            size_t job;
+            while ((job = nextJob.fetch_add(1)) < jobs.size()) {
+                replay(trace, format, jobs[job]);
+            }
+        });
+    }
+    for (std::thread &worker : workers) {
+        worker.join();
+    }
+
+    // one row per capacity, one column per policy
+    if (csv) {
+        std::cout << "capacity";
+        for (const std::string &policy : policies) {
+            std::cout << "," << policy;
+        }
+        std::cout << std::endl;
+    } else {
+        std::cout << "Reads: " << (jobs.empty() ? 0 : jobs[0].reads)
+                  << std::endl;
+        std::cout << std::left << std::setw(12) << "capacity" << std::right;
+        for (const std::string &policy : policies) {
+            std::cout << std::setw(10) << policy;
+        }
+        std::cout << std::endl;
+    }
+
+    size_t job = 0;
+    for (int capacity : capacities) {
+        if (csv) {
+            std::cout << capacity;
+        } else {
+            std::cout << std::left << std::setw(12) << capacity << std::right;
+        }
+        for (size_t p = 0; p < policies.size(); ++p, ++job) {
+            double ratio =
+                jobs[job].reads
+                    ? 100.0 * jobs[job].hits / jobs[job].reads
+                    : 0.0;
+            if (csv) {
+                std::cout << "," << std::fixed << std::setprecision(4)
+                          << ratio / 100.0;
+            } else {
+                std::cout << std::setw(9) << std::fixed << std::setprecision(2)
+                          << ratio << "%";
+            }
+        }
+        std::cout << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdlib>
+
+// minimal checks for the test executables: a failed CHECK prints where
+// and exits non-zero so ctest reports the test as failed
+#define CHECK(condition)                                                       \
+    do {                                                                       \
+        if (!(condition)) {                                                    \
+            std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__,       \
+                         __LINE__, #condition);                                \
+            std::exit(1);                                                      \
+        }                                                                      \
+    } while (0)
+
+#define CHECK_EQ(a, b) CHECK((a) == (b))
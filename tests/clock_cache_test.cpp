@@ -0,0 +1,140 @@
+#include "../ClockCache.h"
+#include "TestUtil.h"
+#include <atomic>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace MinCache;
+
+namespace {
+
+// every field follows from key and version, so a reader can tell a torn
+// or freed value from a whole one
+struct Payload {
+    uint64_t key = 0;
+    uint64_t version = 0;
+    uint64_t check = 0;
+    std::string blob;
+};
+
+uint64_t check_of(uint64_t key, uint64_t version) {
+    return mix_hash(key * 0x9e3779b97f4a7c15ULL + version);
+}
+
+Payload make_payload(uint64_t key, uint64_t version) {
+    Payload payload;
+    payload.key = key;
+    payload.version = version;
+    payload.check = check_of(key, version);
+    payload.blob.assign(24 + (key + version) % 64,
+                        static_cast<char>('a' + (key + version) % 26));
+    return payload;
+}
+
+bool intact(uint64_t key, const Payload &payload) {
+    if (payload.key != key ||
+        payload.check != check_of(key, payload.version) ||
+        payload.blob.size() != 24 + (key + payload.version) % 64) {
+        return false;
+    }
+    char c = static_cast<char>('a' + (key + payload.version) % 26);
+    for (char b : payload.blob) {
+        if (b != c) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// readers check values in place while writers replace, remove and evict
+// them and the churn of tombstones keeps forcing table rebuilds; meant
+// to run under ASan and TSan as well
+void test_concurrent() {
+    constexpr int kCapacity = 64;
+    constexpr uint64_t kKeys = 512;
+    constexpr int kReaders = 3;
+    constexpr int kWriters = 3;
+    constexpr int kWrites = 20000;
+    ClockCache<uint64_t, Payload> cache(kCapacity);
+
+    std::atomic<int> writersLeft{kWriters};
+    std::atomic<bool> torn{false};
+    std::atomic<bool> overfull{false};
+    std::vector<std::thread> threads;
+    for (int t = 0; t < kReaders; ++t) {
+        threads.emplace_back([&, t] {
+            std::mt19937_64 rng(t);
+            while (writersLeft > 0) {
+                for (int i = 0; i < 64; ++i) {
+                    uint64_t key = rng() % kKeys;
+                    cache.visit(key, [&](const Payload &payload) {
+                        if (!intact(key, payload)) {
+                            torn = true;
+                        }
+                    });
+                    if (cache.size() > kCapacity) {
+                        overfull = true;
+                    }
+                }
+                std::this_thread::yield();
+            }
+        });
+    }
+    for (int t = 0; t < kWriters; ++t) {
+        threads.emplace_back([&, t] {
+            std::mt19937_64 rng(100 + t);
+            for (int i = 0; i < kWrites; ++i) {
+                uint64_t key = rng() % kKeys;
+                if (rng() % 4 == 0) {
+                    cache.remove(key);
+                } else {
+                    cache.put(key, make_payload(key, rng() % 1000));
+                }
+                if (cache.size() > kCapacity) {
+                    overfull = true;
+                }
+                if (i % 64 == 0) {
+                    std::this_thread::yield();
+                }
+            }
+            --writersLeft;
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    CHECK(!torn);
+    CHECK(!overfull);
+    CHECK(cache.size() <= size_t(kCapacity));
+
+    // whatever is left reads back whole
+    size_t found = 0;
+    for (uint64_t key = 0; key < kKeys; ++key) {
+        Payload payload;
+        if (cache.get(key, payload)) {
+            CHECK(intact(key, payload));
+            ++found;
+        }
+    }
+    CHECK_EQ(found, cache.size());
+}
+
+// once no reader is pinned, retired entries are actually freed
+void test_reclaim() {
+    ClockCache<uint64_t, Payload> cache(16);
+    for (uint64_t i = 0; i < 10000; ++i) {
+        cache.put(i % 100, make_payload(i % 100, i));
+    }
+    CHECK(EpochDomain::global().pending() < 1000);
+}
+
+} // namespace
+
+int main() {
+    test_concurrent();
+    test_reclaim();
+    std::puts("clock_cache_test passed");
+    return 0;
+}
@@ -0,0 +1,126 @@
+#include "../Compression.h"
+#include "TestUtil.h"
+#include <random>
+
+using namespace MinCache;
+
+namespace {
+
+std::string text(size_t size) {
+    static const char *words[] = {"cache ", "slice ", "entry ", "lock ",
+                                  "value ", "key ",   "miss ",  "hit "};
+    std::mt19937 rng(7);
+    std::string out;
+    while (out.size() < size) {
+        out += words[rng() % 8];
+    }
+    out.resize(size);
+    return out;
+}
+
+std::string noise(size_t size) {
+    std::mt19937 rng(11);
+    std::string out(size, '\0');
+    for (char &c : out) {
+        c = static_cast<char>(rng());
+    }
+    return out;
+}
+
+void round_trip(const std::string &data) {
+    std::string packed = "prefix";
+    CHECK(LzCodec::compress(data.data(), data.size(), packed));
+    CHECK(packed.size() < 6 + data.size());
+    CHECK_EQ(packed.compare(0, 6, "prefix"), 0);
+    std::string out;
+    CHECK(LzCodec::decompress(packed.data() + 6, packed.size() - 6,
+                              data.size(), out));
+    CHECK(out == data);
+}
+
+void test_roundTrip() {
+    round_trip(text(100));
+    round_trip(text(100000));
+    // long runs give overlapping matches and extended lengths
+    round_trip(std::string(70000, 'a'));
+    round_trip(std::string(300, 'x') + noise(300) + std::string(300, 'x'));
+}
+
+// refused input leaves the output as it was
+void test_refused() {
+    std::string out = "keep";
+    std::string random = noise(4096);
+    CHECK(!LzCodec::compress(random.data(), random.size(), out));
+    CHECK(out == "keep");
+    CHECK(!LzCodec::compress("abcabcabc", 9, out));
+    CHECK(out == "keep");
+}
+
+// every malformed block is rejected without reading or writing out of
+// bounds; run under ASan to check the latter
+void test_corrupt() {
+    std::string data = text(20000);
+    std::string packed;
+    CHECK(LzCodec::compress(data.data(), data.size(), packed));
+    std::string out;
+
+    for (size_t cut = 0; cut < packed.size(); cut += 97) {
+        CHECK(!LzCodec::decompress(packed.data(), cut, data.size(), out));
+    }
+    CHECK(!LzCodec::decompress(packed.data(), packed.size(), data.size() - 1,
+                               out));
+    CHECK(!LzCodec::decompress(packed.data(), packed.size(), data.size() + 1,
+                               out));
+
+    std::mt19937 rng(3);
+    for (int i = 0; i < 2000; ++i) {
+        std::string damaged = packed;
+        for (int flips = 0; flips < 4; ++flips) {
+            damaged[rng() % damaged.size()] ^= static_cast<char>(1 + rng() % 255);
+        }
+        // damage may still decode, but never to more than rawSize bytes
+        if (LzCodec::decompress(damaged.data(), damaged.size(), data.size(),
+                                out)) {
+            CHECK_EQ(out.size(), data.size());
+        }
+    }
+
+    // a match reaching back before the start of the output
+    const char bad[] = {0x10, 'a', 0x05, 0x00};
+    CHECK(!LzCodec::decompress(bad, sizeof(bad), 8, out));
+}
+
+void test_cache() {
+    CompressedCache<int> cache(64, 100, 4);
+    std::string big = text(5000);
+    std::string random = noise(5000);
+    cache.put(1, big);
+    cache.put(2, "short");
+    cache.put(3, random);
+
+    std::string value;
+    CHECK(cache.get(1, value));
+    CHECK(value == big);
+    CHECK(cache.get(2, value));
+    CHECK(value == "short");
+    CHECK(cache.get(3, value));
+    CHECK(value == random);
+    CHECK(!cache.get(4, value));
+
+    CompressionStats stats = cache.stats();
+    CHECK_EQ(stats.compressed, 1u);
+    CHECK_EQ(stats.storedRaw, 2u);
+    CHECK_EQ(stats.rawBytes, uint64_t(big.size() + 5 + random.size()));
+    CHECK(stats.storedBytes < stats.rawBytes);
+}
+
+} // namespace
+
+int main() {
+    test_roundTrip();
+    test_refused();
+    test_corrupt();
+    test_cache();
+    std::puts("compression_test passed");
+    return 0;
+}
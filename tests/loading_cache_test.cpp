@@ -0,0 +1,119 @@
+#include "../LoadingCache.h"
+#include "TestUtil.h"
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <thread>
+#include <vector>
+
+using namespace MinCache;
+
+namespace {
+
+using Cache = LoadingCache<int, int>;
+
+bool cached(Cache &cache, int key, int &value) {
+    return cache.cache().visit(key, [&](const Cache::Entry &entry) {
+        value = entry.value;
+    });
+}
+
+void test_singleFlight() {
+    Cache cache(64, 4);
+    std::atomic<int> calls{0};
+    std::vector<std::thread> threads;
+    std::vector<int> results(8);
+    for (int i = 0; i < 8; ++i) {
+        threads.emplace_back([&, i] {
+            results[i] = cache.get_or_load(1, [&](const int &key) {
+                ++calls;
+                std::this_thread::sleep_for(std::chrono::milliseconds(50));
+                return key * 10;
+            });
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    CHECK_EQ(calls.load(), 1);
+    for (int result : results) {
+        CHECK_EQ(result, 10);
+    }
+}
+
+// a load that finishes after invalidate returns its value to its callers
+// but must not bring the key back
+void test_invalidateDuringLoad() {
+    Cache cache(64, 4);
+    std::promise<void> started, release;
+    auto releaseFuture = release.get_future();
+    std::thread loader([&] {
+        int value = cache.get_or_load(2, [&](const int &) {
+            started.set_value();
+            releaseFuture.wait();
+            return 20;
+        });
+        CHECK_EQ(value, 20);
+    });
+    started.get_future().wait();
+    cache.invalidate(2);
+    release.set_value();
+    loader.join();
+    int value;
+    CHECK(!cached(cache, 2, value));
+}
+
+void test_putDuringLoad() {
+    Cache cache(64, 4);
+    std::promise<void> started, release;
+    auto releaseFuture = release.get_future();
+    std::thread loader([&] {
+        cache.get_or_load(3, [&](const int &) {
+            started.set_value();
+            releaseFuture.wait();
+            return 30;
+        });
+    });
+    started.get_future().wait();
+    cache.put(3, 31);
+    release.set_value();
+    loader.join();
+    int value = 0;
+    CHECK(cached(cache, 3, value));
+    CHECK_EQ(value, 31);
+}
+
+// a refresh queued before a put must not overwrite the newer value
+void test_putDuringRefresh() {
+    Cache cache(64, 4);
+    std::atomic<bool> inRefresh{false};
+    std::promise<void> release;
+    std::shared_future<void> releaseFuture = release.get_future().share();
+    cache.enable_refresh(std::chrono::milliseconds(0), [&](const int &) {
+        inRefresh = true;
+        releaseFuture.wait();
+        return 40;
+    });
+    cache.put(4, 41);
+    int value;
+    cache.get_or_load(4, [](const int &) { return 0; });
+    while (!inRefresh) {
+        std::this_thread::yield();
+    }
+    cache.put(4, 42);
+    release.set_value();
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    CHECK(cached(cache, 4, value));
+    CHECK_EQ(value, 42);
+}
+
+} // namespace
+
+int main() {
+    test_singleFlight();
+    test_invalidateDuringLoad();
+    test_putDuringLoad();
+    test_putDuringRefresh();
+    std::puts("loading_cache_test passed");
+    return 0;
+}
@@ -0,0 +1,56 @@
+#include "../LruCache.h"
+#include "TestUtil.h"
+
+using namespace MinCache;
+
+namespace {
+
+// k == 1 admits on the first put, history or not
+void test_noHistoryK1() {
+    LruKCache<int, int> cache(4, 0, 1);
+    for (int i = 0; i < 100; ++i) {
+        cache.put(i, i * 2);
+    }
+    CHECK_EQ(cache.size(), 4u);
+    int value = 0;
+    CHECK(cache.get(99, value));
+    CHECK_EQ(value, 198);
+}
+
+// without history the newest key is still remembered, so a second put
+// admits it
+void test_noHistoryK2() {
+    LruKCache<int, int> cache(4, 0, 2);
+    for (int i = 0; i < 50; ++i) {
+        cache.put(i, i);
+        cache.put(i, i);
+    }
+    CHECK_EQ(cache.size(), 4u);
+    int value = 0;
+    CHECK(cache.get(49, value));
+    CHECK_EQ(value, 49);
+}
+
+void test_admission() {
+    LruKCache<int, int> cache(4, 8, 2);
+    int value = 0;
+    cache.put(1, 1);
+    CHECK(!cache.get(2, value));
+    CHECK_EQ(cache.size(), 0u);
+    cache.put(1, 1);
+    CHECK(cache.get(1, value));
+    // a miss counts as an access, so the following put admits
+    cache.put(2, 2);
+    CHECK(cache.get(2, value));
+    CHECK_EQ(value, 2);
+}
+
+} // namespace
+
+int main() {
+    test_noHistoryK1();
+    test_noHistoryK2();
+    test_admission();
+    std::puts("lruk_cache_test passed");
+    return 0;
+}
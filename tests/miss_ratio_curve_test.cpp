@@ -0,0 +1,105 @@
+#include "../MissRatioCurve.h"
+#include "TestUtil.h"
+
+using namespace MinCache;
+
+namespace {
+
+// lookups of keys 0..loop-1 in order, rounds times over
+void run_loop(MissRatioEstimator &estimator, uint64_t loop, int rounds) {
+    for (int round = 0; round < rounds; ++round) {
+        for (uint64_t key = 0; key < loop; ++key) {
+            estimator.record(mix_hash(key), true);
+        }
+    }
+}
+
+void check_monotone(const std::vector<MissRatioPoint> &curve) {
+    for (size_t i = 0; i < curve.size(); ++i) {
+        CHECK(curve[i].missRatio >= 0.0 && curve[i].missRatio <= 1.0);
+        if (i > 0) {
+            CHECK(curve[i].capacity > curve[i - 1].capacity);
+            CHECK(curve[i].missRatio <= curve[i - 1].missRatio);
+        }
+    }
+}
+
+// an LRU cache smaller than a loop misses every time, one that holds it
+// only misses on the first round
+void test_loop() {
+    constexpr uint64_t kLoop = 10000;
+    constexpr int kRounds = 10;
+    MissRatioEstimator estimator(4 * kLoop, 0.1);
+    run_loop(estimator, kLoop, kRounds);
+
+    auto curve = estimator.curve(8);
+    CHECK_EQ(curve.size(), 8u);
+    CHECK_EQ(curve.back().capacity, 4 * kLoop);
+    check_monotone(curve);
+    double cold = 1.0 / kRounds;
+    for (const auto &point : curve) {
+        if (point.capacity < kLoop * 9 / 10) {
+            CHECK(point.missRatio > 0.9);
+        } else if (point.capacity > kLoop * 11 / 10) {
+            CHECK(point.missRatio < cold + 0.05);
+        }
+    }
+    size_t fits = capacity_forMissRatio(curve, cold + 0.05);
+    CHECK(fits >= kLoop * 9 / 10 && fits <= 2 * kLoop);
+    CHECK_EQ(capacity_forMissRatio(curve, 0.01), 0u);
+}
+
+// with room for a handful of samples the threshold keeps dropping and
+// the Fenwick tree is compacted over and over; the estimate gets coarse
+// but stays a curve
+void test_fewSamples() {
+    constexpr uint64_t kLoop = 5000;
+    MissRatioEstimator estimator(4 * kLoop, 1.0, 64);
+    CHECK_EQ(estimator.sample_rate(), 1.0);
+    // writes move keys without counting as lookups
+    for (uint64_t key = 0; key < 4 * kLoop; ++key) {
+        estimator.record(mix_hash(key), false);
+    }
+    CHECK(estimator.sample_rate() < 0.01);
+    run_loop(estimator, kLoop, 20);
+    CHECK(estimator.sample_rate() > 0.0);
+
+    auto curve = estimator.curve(16);
+    check_monotone(curve);
+    CHECK(curve.front().missRatio > 0.7);
+    CHECK(curve.back().missRatio < 0.3);
+
+    // forgotten keys count as first accesses again
+    for (uint64_t key = 0; key < kLoop; ++key) {
+        estimator.forget(mix_hash(key));
+    }
+    estimator.reset();
+    for (const auto &point : estimator.curve(4)) {
+        CHECK_EQ(point.missRatio, 1.0);
+    }
+    run_loop(estimator, kLoop, 1);
+    for (const auto &point : estimator.curve(4)) {
+        CHECK(point.missRatio > 0.9);
+    }
+}
+
+void test_empty() {
+    MissRatioEstimator estimator(100);
+    CHECK(estimator.curve(0).empty());
+    auto curve = estimator.curve(5);
+    CHECK_EQ(curve.size(), 5u);
+    CHECK_EQ(curve[0].capacity, 20u);
+    for (const auto &point : curve) {
+        CHECK_EQ(point.missRatio, 1.0);
+    }
+}
+
+} // namespace
+
+int main() {
+    test_loop();
+    test_fewSamples();
+    test_empty();
+    std::puts("miss_ratio_curve_test passed");
+    return 0;
+}
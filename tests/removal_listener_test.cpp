@@ -0,0 +1,176 @@
+#include "../LfuCache.h"
+#include "../LruCache.h"
+#include "TestUtil.h"
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace MinCache;
+
+namespace {
+
+using Batch = std::vector<Removal<int, int>>;
+
+// polls condition until it holds, false once timeout has passed
+template <typename Condition>
+bool wait_until(Condition condition,
+                std::chrono::milliseconds timeout = std::chrono::seconds(10)) {
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    while (!condition()) {
+        if (std::chrono::steady_clock::now() > deadline) {
+            return false;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return true;
+}
+
+// every cause is reported once, off the writing thread
+template <typename Cache> void test_causes() {
+    Cache cache(16, 1);
+    std::mutex mutex;
+    std::map<RemovalCause, int> causes;
+    cache.set_removalListener([&](Batch &batch) {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto &removal : batch) {
+            ++causes[removal.cause];
+        }
+    });
+    for (int i = 0; i < 100; ++i) {
+        cache.put(i, i);
+    }
+    cache.put(99, -1);
+    cache.remove(98);
+    cache.put(1000, 0, std::chrono::milliseconds(5));
+    int value;
+    CHECK(wait_until([&] { return !cache.get(1000, value); }));
+    CHECK(wait_until([&] {
+        std::lock_guard<std::mutex> lock(mutex);
+        int total = 0;
+        for (auto &cause : causes) {
+            total += cause.second;
+        }
+        return total == 87;
+    }));
+
+    std::lock_guard<std::mutex> lock(mutex);
+    CHECK_EQ(causes[RemovalCause::kEvicted], 84);
+    CHECK_EQ(causes[RemovalCause::kReplaced], 1);
+    CHECK_EQ(causes[RemovalCause::kExplicit], 1);
+    CHECK_EQ(causes[RemovalCause::kExpired], 1);
+}
+
+// replica copies of a hot key come and go while its home entry stays;
+// none of that is a removal
+template <typename Cache> void test_replicasUnreported() {
+    constexpr int kSlices = 8;
+    Cache cache(1024, kSlices);
+    cache.enable_hotKeyReplication(4);
+    const int hot = 7;
+    std::atomic<int> reported{0};
+    cache.set_removalListener([&](Batch &batch) {
+        for (auto &removal : batch) {
+            reported += removal.key == hot;
+        }
+    });
+    cache.put(hot, hot);
+
+    std::atomic<bool> stop{false};
+    std::vector<std::thread> readers;
+    for (int t = 0; t < 4; ++t) {
+        readers.emplace_back([&] {
+            int value;
+            while (!stop) {
+                for (int i = 0; i < 64; ++i) {
+                    cache.get(hot, value);
+                }
+                std::this_thread::yield();
+            }
+        });
+    }
+    auto slice = [](int key) {
+        return slice_of(MixedHash<int>()(key), kSlices - 1);
+    };
+    int key = 1000;
+    for (int round = 0; round < 100; ++round) {
+        for (int i = 0; i < 1000; ++i, ++key) {
+            if (slice(key) != slice(hot)) {
+                cache.put(key, key);
+            }
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    stop = true;
+    for (auto &reader : readers) {
+        reader.join();
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    CHECK(!cache.hot_keyHashes().empty());
+    CHECK_EQ(reported.load(), 0);
+}
+
+// with the listener stuck, expirations found by reads cannot make the
+// queue grow past twice its capacity, and the reads never block
+template <typename Cache> void test_readsBounded() {
+    constexpr size_t kCapacity = 64;
+    constexpr int kKeys = 5000;
+    Cache cache(2 * kKeys, 1);
+    // the listener only gets stuck once armed, so entries expiring while
+    // the cache is filled are delivered and writers never wait for good
+    std::atomic<bool> armed{false};
+    std::atomic<bool> parked{false};
+    std::atomic<bool> hold{true};
+    std::atomic<size_t> delivered{0};
+    std::atomic<size_t> beforeParked{0};
+    cache.set_removalListener(
+        [&](Batch &batch) {
+            if (armed && !parked) {
+                beforeParked = delivered + batch.size();
+                parked = true;
+                while (hold) {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                }
+            }
+            delivered += batch.size();
+        },
+        kCapacity, RemovalOverflow::kBlock);
+
+    for (int i = 0; i < kKeys; ++i) {
+        cache.put(i, i, std::chrono::milliseconds(50));
+    }
+    armed = true;
+    cache.put(-1, -1);
+    cache.remove(-1);
+    CHECK(wait_until([&] { return parked.load(); }));
+
+    // every key ends up removed, by the reads or by expire_entries
+    int value;
+    for (int i = 0; i < kKeys; ++i) {
+        CHECK(wait_until([&] { return !cache.get(i, value); }));
+    }
+    uint64_t dropped = cache.dropped_removals();
+    size_t queued = kKeys + 1 - beforeParked - dropped;
+    CHECK(queued <= 2 * kCapacity);
+
+    hold = false;
+    CHECK(wait_until([&] {
+        return delivered.load() + dropped == size_t(kKeys + 1);
+    }));
+    CHECK_EQ(cache.dropped_removals(), dropped);
+}
+
+} // namespace
+
+int main() {
+    test_causes<HashLruCache<int, int>>();
+    test_causes<HashLfuCache<int, int>>();
+    test_replicasUnreported<HashLruCache<int, int>>();
+    test_replicasUnreported<HashLfuCache<int, int>>();
+    test_readsBounded<HashLruCache<int, int>>();
+    test_readsBounded<HashLfuCache<int, int>>();
+    std::puts("removal_listener_test passed");
+    return 0;
+}
@@ -0,0 +1,97 @@
+#include "../SharedMemoryCache.h"
+#include "TestUtil.h"
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace MinCache;
+
+namespace {
+
+std::string region_name() {
+    return "/mincache_test_" + std::to_string(::getpid());
+}
+
+// a second process attaches by name and sees the same entries
+void test_multiProcess() {
+    std::string name = region_name();
+    SharedMemoryCache::unlink(name);
+    SharedMemoryCache cache(name, 1024, 256 * 1024, 4);
+    CHECK(cache.is_open());
+    cache.put("parent", "p");
+
+    pid_t child = ::fork();
+    CHECK(child >= 0);
+    if (child == 0) {
+        SharedMemoryCache attached(name, 0, 0);
+        std::string value;
+        bool ok = attached.is_open() && attached.get("parent", value) &&
+                  value == "p" && attached.store("child", "c");
+        ::_exit(ok ? 0 : 1);
+    }
+    int status = 0;
+    ::waitpid(child, &status, 0);
+    CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    std::string value;
+    CHECK(cache.get("child", value));
+    CHECK_EQ(value, "c");
+    SharedMemoryCache::unlink(name);
+}
+
+// an arena carved up by small values serves large ones again once the
+// small entries are evicted and their blocks merge
+void test_fragmentation() {
+    std::string name = region_name();
+    SharedMemoryCache::unlink(name);
+    SharedMemoryCache cache(name, 10000, 64 * 1024, 4);
+    CHECK(cache.is_open());
+    for (int i = 0; i < 5000; ++i) {
+        cache.put("small" + std::to_string(i), "x");
+    }
+    int stored = 0;
+    for (int i = 0; i < 1000; ++i) {
+        stored += cache.store("large" + std::to_string(i), std::string(900, 'y'));
+    }
+    CHECK_EQ(stored, 1000);
+
+    for (int i = 0; i < 1000; ++i) {
+        cache.remove("large" + std::to_string(i));
+    }
+    for (int i = 0; i < 5000; ++i) {
+        cache.remove("small" + std::to_string(i));
+    }
+    CHECK_EQ(cache.size(), 0u);
+    // a whole 16 KiB shard arena merged back into one block
+    CHECK(cache.store("whole", std::string(16000, 'z')));
+    SharedMemoryCache::unlink(name);
+}
+
+// a put that cannot get a block for its new size keeps the old value
+void test_failedUpdateKeepsValue() {
+    std::string name = region_name();
+    SharedMemoryCache::unlink(name);
+    SharedMemoryCache cache(name, 64, 16 * 1024, 1);
+    CHECK(cache.store("key", "old"));
+    CHECK(!cache.store("key", std::string(32 * 1024, 'n')));
+    std::string value;
+    CHECK(cache.get("key", value));
+    CHECK_EQ(value, "old");
+
+    // growing into a block that needs every other entry evicted works
+    CHECK(cache.store("other", std::string(1000, 'o')));
+    CHECK(cache.store("key", std::string(16000, 'n')));
+    CHECK(cache.get("key", value));
+    CHECK_EQ(value.size(), 16000u);
+    CHECK(!cache.get("other", value));
+    SharedMemoryCache::unlink(name);
+}
+
+} // namespace
+
+int main() {
+    test_multiProcess();
+    test_fragmentation();
+    test_failedUpdateKeepsValue();
+    std::puts("shared_memory_cache_test passed");
+    return 0;
+}
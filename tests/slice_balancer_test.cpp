@@ -0,0 +1,26 @@
+#include "../SliceBalancer.h"
+#include "TestUtil.h"
+
+using namespace MinCache;
+
+namespace {
+
+// one fingerprint can fill a large ring; its counter must not wrap
+void test_ghostCounterWidth() {
+    constexpr size_t kCapacity = 70000;
+    GhostFilter ghosts;
+    ghosts.resize(kCapacity);
+    const uint64_t hot = 12345;
+    for (size_t i = 0; i < 65536; ++i) {
+        ghosts.add(hot);
+    }
+    CHECK(ghosts.contains(hot));
+}
+
+} // namespace
+
+int main() {
+    test_ghostCounterWidth();
+    std::puts("slice_balancer_test passed");
+    return 0;
+}
@@ -0,0 +1,97 @@
+#include "../LfuCache.h"
+#include "../LruCache.h"
+#include "TestUtil.h"
+#include <cstdio>
+#include <fstream>
+#include <future>
+#include <iterator>
+#include <string>
+#include <vector>
+
+using namespace MinCache;
+
+namespace {
+
+const std::string kPath = "mincache_snapshot_test.snap";
+
+std::string read_file(const std::string &path) {
+    std::ifstream in(path, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(in), {});
+}
+
+void write_file(const std::string &path, const std::string &bytes) {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+}
+
+void test_roundTrip() {
+    HashLruCache<int, std::string> cache(1000, 4);
+    for (int i = 0; i < 500; ++i) {
+        cache.put(i, "value" + std::to_string(i));
+    }
+    CHECK(cache.save_snapshot(kPath));
+
+    HashLruCache<int, std::string> restored(1000, 4);
+    CHECK(restored.load_snapshot(kPath));
+    std::string value;
+    CHECK(restored.get(499, value));
+    CHECK_EQ(value, "value499");
+
+    // an LRU snapshot is not an LFU one
+    HashLfuCache<int, std::string> other(1000, 4);
+    CHECK(!other.load_snapshot(kPath));
+}
+
+// any flipped byte, in the header, the index or a slice, fails the load
+void test_corruption() {
+    HashLfuCache<int, int> cache(1000, 4);
+    for (int i = 0; i < 300; ++i) {
+        cache.put(i, i);
+    }
+    CHECK(cache.save_snapshot(kPath));
+    std::string bytes = read_file(kPath);
+    CHECK(!bytes.empty());
+
+    for (size_t position : {size_t(3), size_t(40), bytes.size() / 2,
+                            bytes.size() - 1}) {
+        std::string damaged = bytes;
+        damaged[position] ^= 0x5a;
+        write_file(kPath, damaged);
+        HashLfuCache<int, int> restored(1000, 4);
+        CHECK(!restored.load_snapshot(kPath));
+    }
+    write_file(kPath, bytes.substr(0, bytes.size() - 8));
+    HashLfuCache<int, int> truncated(1000, 4);
+    CHECK(!truncated.load_snapshot(kPath));
+}
+
+// overlapping saves to one path each write their own temporary file
+void test_overlappingSaves() {
+    HashLruCache<int, std::string> cache(20000, 4);
+    for (int i = 0; i < 20000; ++i) {
+        cache.put(i, std::string(64, 'a' + i % 26));
+    }
+    std::vector<std::future<bool>> saves;
+    for (int i = 0; i < 4; ++i) {
+        saves.push_back(cache.save_snapshotAsync(kPath));
+    }
+    for (auto &save : saves) {
+        CHECK(save.get());
+    }
+    HashLruCache<int, std::string> restored(20000, 4);
+    CHECK(restored.load_snapshot(kPath));
+    std::string value;
+    CHECK(restored.get(12345, value));
+    CHECK_EQ(value, std::string(64, 'a' + 12345 % 26));
+}
+
+} // namespace
+
+int main() {
+    test_roundTrip();
+    test_corruption();
+    test_overlappingSaves();
+    std::remove(kPath.c_str());
+    std::puts("snapshot_test passed");
+    return 0;
+}
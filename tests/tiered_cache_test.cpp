@@ -0,0 +1,93 @@
+#include "../DiskTier.h"
+#include "TestUtil.h"
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace MinCache;
+
+namespace {
+
+const std::string kPath = "mincache_tiered_test.dat";
+
+// entries pushed out of memory land on disk and a get brings them back
+void test_spillAndPromote() {
+    TieredCache<int, std::string> cache(kPath, 8 << 20, 64, 1);
+    CHECK(cache.disk_enabled());
+    for (int i = 0; i < 1000; ++i) {
+        cache.put(i, "value" + std::to_string(i));
+    }
+    CHECK(cache.disk().size() > 0);
+
+    std::string value;
+    CHECK(!cache.memory().get(0, value));
+    CHECK(cache.get(0, value));
+    CHECK_EQ(value, "value0");
+    // promoted: back in memory and gone from disk
+    CHECK(cache.memory().get(0, value));
+    CHECK(!cache.disk().get(0, value));
+
+    cache.remove(1);
+    CHECK(!cache.get(1, value));
+    cache.put(2, "newer");
+    CHECK(cache.get(2, value));
+    CHECK_EQ(value, "newer");
+}
+
+// evicting a hot-key replica must not write the key to disk while its
+// home entry is still in memory
+void test_replicasDoNotSpill() {
+    constexpr int kSlices = 8;
+    TieredCache<int, int> cache(kPath, 8 << 20, 1024, kSlices);
+    cache.memory().enable_hotKeyReplication(4);
+    const int hot = 7;
+    auto slice = [](int key) {
+        return slice_of(MixedHash<int>()(key), kSlices - 1);
+    };
+    cache.put(hot, hot);
+
+    std::atomic<bool> stop{false};
+    std::vector<std::thread> readers;
+    for (int t = 0; t < 4; ++t) {
+        readers.emplace_back([&] {
+            int value;
+            while (!stop) {
+                for (int i = 0; i < 64; ++i) {
+                    cache.memory().get(hot, value);
+                }
+                std::this_thread::yield();
+            }
+        });
+    }
+    // fillers avoid the hot key's home slice, so its home entry stays
+    // while every other slice, replicas included, keeps evicting
+    int key = 1000;
+    for (int round = 0; round < 100; ++round) {
+        for (int i = 0; i < 1000; ++i, ++key) {
+            if (slice(key) != slice(hot)) {
+                cache.put(key, key);
+            }
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    stop = true;
+    for (auto &reader : readers) {
+        reader.join();
+    }
+    CHECK(!cache.memory().hot_keyHashes().empty());
+    int value;
+    CHECK(!cache.disk().get(hot, value));
+    CHECK(cache.get(hot, value));
+    CHECK_EQ(value, hot);
+}
+
+} // namespace
+
+int main() {
+    test_spillAndPromote();
+    test_replicasDoNotSpill();
+    std::puts("tiered_cache_test passed");
+    return 0;
+}